@@ -0,0 +1,329 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef ARENA_ALLOCATOR_HPP_
+#define ARENA_ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "indexing_tree.hpp"
+
+namespace osoken
+{
+
+// Small fixed-size blocks, such as tree nodes, in 16 byte size classes of
+// up to max_block bytes. Freed blocks go to a free list per class and are
+// reused first; other requests are cut from the chunk of fresh memory last
+// handed to refill(). Larger blocks are cut from the chunk too and, once
+// freed, reused only for a request of the same rounded size. The arena
+// that owns the pool supplies the memory and any locking.
+class block_pool
+{
+public:
+  static const std::size_t max_block = 256;
+
+  block_pool();
+
+  // returns 0 once the chunk is used up; the caller refills and retries
+  void* allocate(std::size_t size);
+  void deallocate(void* p, std::size_t size);
+  // the rest of the previous chunk is left unused unless first continues it
+  void refill(char* first, char* last);
+  std::size_t used() const;
+private:
+  block_pool(const block_pool&);
+  block_pool& operator = (const block_pool&);
+
+  struct free_block
+  {
+    free_block* next_;
+    std::size_t size_;
+  };
+
+  static const std::size_t granule_ = 16;
+  static const std::size_t classes_ = max_block / granule_;
+
+  char* next_;
+  char* limit_;
+  free_block* free_[classes_];
+  free_block* large_;
+  std::size_t used_;
+
+  void* allocate_large(std::size_t bytes);
+};
+
+// Allocator drawing from an Arena, for use as the Alloc of an
+// indexing_tree: its nodes then come from the arena, while requests larger
+// than Arena::max_block go to operator new. An Arena that serves blocks of
+// any size sets max_block to std::size_t(-1). The Arena provides
+// max_block, allocate(size) and deallocate(p, size), and instance() if
+// allocators are to be default-constructed.
+template<class T, class Arena>
+class arena_allocator
+{
+public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Arena arena_type;
+  template<class U>
+  struct rebind
+  {
+    typedef arena_allocator<U, Arena> other;
+  };
+
+  arena_allocator() throw();
+  explicit arena_allocator(Arena& arena) throw();
+  template<class U>
+  arena_allocator(const arena_allocator<U, Arena>& that) throw();
+
+  pointer address(reference x) const;
+  const_pointer address(const_reference x) const;
+  pointer allocate(size_type n, const void* hint = 0);
+  void deallocate(pointer p, size_type n);
+  size_type max_size() const throw();
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args);
+#else
+  void construct(pointer p, const T& x);
+#endif
+  void destroy(pointer p);
+  Arena& arena() const;
+private:
+  Arena* arena_;
+};
+
+template<class T, class U, class Arena>
+bool operator == (const arena_allocator<T, Arena>& a, const arena_allocator<U, Arena>& b);
+template<class T, class U, class Arena>
+bool operator != (const arena_allocator<T, Arena>& a, const arena_allocator<U, Arena>& b);
+
+//////////////////
+// block_pool
+//////////////////
+inline block_pool::block_pool()
+  : next_(0),limit_(0),large_(0),used_(0)
+{
+  for (std::size_t i = 0; i < classes_; ++i)
+  {
+    free_[i] = 0;
+  }
+}
+
+inline void* block_pool::allocate(std::size_t size)
+{
+  std::size_t c = (size == 0) ? 0 : (size - 1) / granule_;
+  if (classes_ <= c)
+  {
+    return allocate_large((c + 1) * granule_);
+  }
+  std::size_t bytes = (c + 1) * granule_;
+  if (free_[c] != 0)
+  {
+    free_block* b = free_[c];
+    free_[c] = b->next_;
+    used_ += bytes;
+    return b;
+  }
+  if (static_cast<std::size_t>(limit_ - next_) < bytes)
+  {
+    return 0;
+  }
+  void* p = next_;
+  next_ += bytes;
+  used_ += bytes;
+  return p;
+}
+
+inline void block_pool::deallocate(void* p, std::size_t size)
+{
+  std::size_t c = (size == 0) ? 0 : (size - 1) / granule_;
+  free_block* b = static_cast<free_block*>(p);
+  used_ -= (c + 1) * granule_;
+  if (classes_ <= c)
+  {
+    b->next_ = large_;
+    b->size_ = (c + 1) * granule_;
+    large_ = b;
+    return;
+  }
+  b->next_ = free_[c];
+  free_[c] = b;
+}
+
+inline void block_pool::refill(char* first, char* last)
+{
+  if (first != limit_)
+  {
+    next_ = first;
+  }
+  limit_ = last;
+}
+
+// Large blocks are rare, such as the array of a vector over the arena, so
+// their free list is searched linearly.
+inline void* block_pool::allocate_large(std::size_t bytes)
+{
+  for (free_block** b = &large_; *b != 0; b = &(*b)->next_)
+  {
+    if ((*b)->size_ == bytes)
+    {
+      free_block* p = *b;
+      *b = p->next_;
+      used_ += bytes;
+      return p;
+    }
+  }
+  if (static_cast<std::size_t>(limit_ - next_) < bytes)
+  {
+    return 0;
+  }
+  void* p = next_;
+  next_ += bytes;
+  used_ += bytes;
+  return p;
+}
+
+inline std::size_t block_pool::used() const
+{
+  return used_;
+}
+
+//////////////////
+// arena_allocator
+//////////////////
+template<class T, class Arena>
+inline arena_allocator<T,Arena>::arena_allocator() throw()
+  : arena_(&Arena::instance())
+{
+}
+
+template<class T, class Arena>
+inline arena_allocator<T,Arena>::arena_allocator(Arena& arena) throw()
+  : arena_(&arena)
+{
+}
+
+template<class T, class Arena>
+template<class U>
+inline arena_allocator<T,Arena>::arena_allocator(const arena_allocator<U, Arena>& that) throw()
+  : arena_(&that.arena())
+{
+}
+
+template<class T, class Arena>
+inline typename arena_allocator<T,Arena>::pointer arena_allocator<T,Arena>::address(reference x) const
+{
+  return &x;
+}
+
+template<class T, class Arena>
+inline typename arena_allocator<T,Arena>::const_pointer arena_allocator<T,Arena>::address(const_reference x) const
+{
+  return &x;
+}
+
+template<class T, class Arena>
+inline typename arena_allocator<T,Arena>::pointer arena_allocator<T,Arena>::allocate(size_type n, const void*)
+{
+  if (max_size() < n)
+  {
+    throw std::bad_alloc();
+  }
+  std::size_t bytes = n * sizeof(T);
+  if (bytes <= Arena::max_block)
+  {
+    return static_cast<pointer>(arena_->allocate(bytes));
+  }
+  return static_cast<pointer>(::operator new(bytes));
+}
+
+template<class T, class Arena>
+inline void arena_allocator<T,Arena>::deallocate(pointer p, size_type n)
+{
+  std::size_t bytes = n * sizeof(T);
+  if (bytes <= Arena::max_block)
+  {
+    arena_->deallocate(p, bytes);
+  }
+  else
+  {
+    ::operator delete(p);
+  }
+}
+
+template<class T, class Arena>
+inline typename arena_allocator<T,Arena>::size_type arena_allocator<T,Arena>::max_size() const throw()
+{
+  return static_cast<size_type>(-1) / sizeof(T);
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+template<class T, class Arena>
+template<class U, class... Args>
+inline void arena_allocator<T,Arena>::construct(U* p, Args&&... args)
+{
+  ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+}
+#else
+template<class T, class Arena>
+inline void arena_allocator<T,Arena>::construct(pointer p, const T& x)
+{
+  ::new (static_cast<void*>(p)) T(x);
+}
+#endif
+
+template<class T, class Arena>
+inline void arena_allocator<T,Arena>::destroy(pointer p)
+{
+  p->~T();
+}
+
+template<class T, class Arena>
+inline Arena& arena_allocator<T,Arena>::arena() const
+{
+  return *arena_;
+}
+
+template<class T, class U, class Arena>
+inline bool operator == (const arena_allocator<T, Arena>& a, const arena_allocator<U, Arena>& b)
+{
+  return &a.arena() == &b.arena();
+}
+
+template<class T, class U, class Arena>
+inline bool operator != (const arena_allocator<T, Arena>& a, const arena_allocator<U, Arena>& b)
+{
+  return &a.arena() != &b.arena();
+}
+
+} // end of namespace osoken
+
+#endif // ARENA_ALLOCATOR_HPP_
@@ -0,0 +1,889 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+// Micro benchmarks for indexing_tree.
+//   g++ -O2 -std=c++11 -pthread -I.. bench.cpp -o bench
+//   ./bench [elements] [repeat]
+// Every workload is run against each balance policy and reports the best of
+// `repeat` runs in nanoseconds per operation; the last column names the
+// fastest policy for that workload. On Linux the hardware counters of the
+// best run are then listed per operation for each policy; an operation is
+// one element for iterate and one edit for apply_batch. Counters that
+// perf_event_open refuses (perf_event_paranoid, virtual machines) are
+// shown as n/a. On Linux the weight-balanced tree also runs with its nodes
+// in a hugepage_arena (column weight/thp), to show what transparent huge
+// pages save on the TLB misses of descents.
+//
+// With threads, the concurrent front ends close the run: 1, 2, 4, ...
+// threads edit one shared sequence of the same size, and the tables give
+// the wall-clock nanoseconds per edit of all threads together, for an
+// indexing_tree behind a mutex, combining_indexing_tree and
+// sharded_indexing_tree. The threads edit at random positions of the
+// whole sequence, and then contend for its first 1024 positions only.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __linux__
+#  include <cerrno>
+#  include <cstring>
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include "indexing_tree.hpp"
+#ifdef __linux__
+#  include "hugepage_allocator.hpp"
+#endif
+#if INDEXING_TREE_HAS_THREADS
+#  include <mutex>
+#  include <thread>
+#  include "combining_indexing_tree.hpp"
+#  include "sharded_indexing_tree.hpp"
+#endif
+
+namespace
+{
+
+class xorshift
+{
+public:
+  explicit xorshift(unsigned long seed) : state_(seed * 2654435761UL + 1) {}
+  std::size_t operator()(std::size_t n)
+  {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return static_cast<std::size_t>(state_ % n);
+  }
+private:
+  unsigned long long state_;
+};
+
+double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Hardware event counters of the calling thread, counting only while
+// enabled and accumulating until reset. Each event is opened on its own, so
+// one the kernel refuses leaves the others usable; values are scaled up
+// when the kernel had to multiplex them.
+class counters
+{
+public:
+  enum event
+  {
+    cycles,
+    instructions,
+    l1d_misses,
+    llc_misses,
+    dtlb_misses,
+    branch_misses,
+    event_count
+  };
+  static const char* const names[event_count];
+
+  counters();
+  ~counters();
+  bool available(int e) const { return 0 <= fd_[e]; }
+  bool any() const;
+  const char* error() const { return error_; }
+  void reset();
+  void enable();
+  void disable();
+  double read(int e) const;
+private:
+  counters(const counters&);
+  counters& operator = (const counters&);
+  int fd_[event_count];
+  const char* error_;
+};
+
+const char* const counters::names[event_count] =
+{
+  "cycles", "instr", "L1d miss", "LLC miss", "dTLB miss", "br miss"
+};
+
+#ifdef __linux__
+counters::counters()
+  : error_(0)
+{
+  static const unsigned long long cache_read_miss =
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  static const unsigned int types[event_count] =
+  {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+    PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+  };
+  static const unsigned long long configs[event_count] =
+  {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | cache_read_miss, PERF_COUNT_HW_CACHE_LL | cache_read_miss,
+    PERF_COUNT_HW_CACHE_DTLB | cache_read_miss, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  for (int e = 0; e < event_count; ++e)
+  {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[e];
+    attr.config = configs[e];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fd_[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd_[e] < 0 && error_ == 0)
+    {
+      error_ = std::strerror(errno);
+    }
+  }
+}
+
+counters::~counters()
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    if (available(e))
+    {
+      close(fd_[e]);
+    }
+  }
+}
+
+void counters::reset()
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    if (available(e))
+    {
+      ioctl(fd_[e], PERF_EVENT_IOC_RESET, 0);
+    }
+  }
+}
+
+void counters::enable()
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    if (available(e))
+    {
+      ioctl(fd_[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void counters::disable()
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    if (available(e))
+    {
+      ioctl(fd_[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+double counters::read(int e) const
+{
+  unsigned long long v[3];
+  if (!available(e) || ::read(fd_[e], v, sizeof(v)) != static_cast<ssize_t>(sizeof(v)) || v[2] == 0)
+  {
+    return 0;
+  }
+  return static_cast<double>(v[0]) * v[1] / v[2];
+}
+#else
+counters::counters()
+  : error_("not supported on this platform")
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    fd_[e] = -1;
+  }
+}
+
+counters::~counters() {}
+void counters::reset() {}
+void counters::enable() {}
+void counters::disable() {}
+double counters::read(int) const { return 0; }
+#endif
+
+bool counters::any() const
+{
+  for (int e = 0; e < event_count; ++e)
+  {
+    if (available(e))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+counters hardware;
+
+// Bracket the timed part of a workload: the counters run exactly while
+// the clock does.
+double start()
+{
+  hardware.enable();
+  return now();
+}
+
+double stop(double t0)
+{
+  double t = now() - t0;
+  hardware.disable();
+  return t;
+}
+
+#ifdef __linux__
+const char* const backends[] = { "weight", "treap", "splay", "weight/thp" };
+#else
+const char* const backends[] = { "weight", "treap", "splay" };
+#endif
+const int backend_count = sizeof(backends) / sizeof(backends[0]);
+const int workload_count = 15;
+
+// nanoseconds and hardware events per operation of the fastest run
+struct result
+{
+  double ns_;
+  double events_[counters::event_count];
+};
+
+void report(const char* name, const result (&best)[backend_count])
+{
+  int winner = 0;
+  std::printf("%-24s", name);
+  for (int b = 0; b < backend_count; ++b)
+  {
+    std::printf(" %10.1f", best[b].ns_);
+    if (best[b].ns_ < best[winner].ns_)
+    {
+      winner = b;
+    }
+  }
+  std::printf("   %s\n", backends[winner]);
+}
+
+void report_events(const char* name, const result& r)
+{
+  std::printf("%-24s", name);
+  for (int e = 0; e < counters::event_count; ++e)
+  {
+    if (hardware.available(e))
+    {
+      std::printf(" %10.2f", r.events_[e]);
+    }
+    else
+    {
+      std::printf(" %10s", "n/a");
+    }
+  }
+  std::printf("\n");
+}
+
+template<class Body>
+result measure(std::size_t ops, int repeat, Body body)
+{
+  result best;
+  best.ns_ = 1e300;
+  for (int i = 0; i < repeat; ++i)
+  {
+    hardware.reset();
+    double t = body();
+    if (t / ops * 1e9 < best.ns_)
+    {
+      best.ns_ = t / ops * 1e9;
+      for (int e = 0; e < counters::event_count; ++e)
+      {
+        best.events_[e] = hardware.read(e) / ops;
+      }
+    }
+  }
+  return best;
+}
+
+template<class Tree>
+struct push_back_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    return stop(t0);
+  }
+};
+
+template<class Tree>
+struct push_front_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_front(static_cast<int>(i));
+    }
+    return stop(t0);
+  }
+};
+
+template<class Tree>
+struct pop_body
+{
+  std::size_t n_;
+  bool back_;
+  double operator()() const
+  {
+    Tree t;
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      if (back_)
+      {
+        t.pop_back();
+      }
+      else
+      {
+        t.pop_front();
+      }
+    }
+    return stop(t0);
+  }
+};
+
+// a FIFO of n elements: push_back and pop_front n times each, with the
+// given end_buffer()
+template<class Tree>
+struct queue_body
+{
+  std::size_t n_;
+  std::size_t buffer_;
+  double operator()() const
+  {
+    Tree t;
+    t.set_end_buffer(buffer_);
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+      t.pop_front();
+    }
+    return stop(t0);
+  }
+};
+
+// insert in front of a fixed set of iterators, so that only the linking and
+// the fix-up walk are timed
+template<class Tree>
+struct insert_at_iterator_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    xorshift rnd(1);
+    std::vector<typename Tree::iterator> pos;
+    for (std::size_t i = 0; i < 1024; ++i)
+    {
+      pos.push_back(t.begin() + rnd(n_));
+    }
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.insert(pos[i % pos.size()], static_cast<int>(i));
+    }
+    return stop(t0);
+  }
+};
+
+// erase every other element in one sweep
+template<class Tree>
+struct erase_at_iterator_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    for (std::size_t i = 0; i < 2 * n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    typename Tree::iterator it = t.begin();
+    double t0 = start();
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      it = t.erase(it);
+      ++it;
+    }
+    return stop(t0);
+  }
+};
+
+// runs of 64 inserts at random positions through a cursor
+template<class Tree>
+struct cursor_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    xorshift rnd(7);
+    double t0 = start();
+    typename Tree::cursor c(t, t.begin());
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      if (i % 64 == 0)
+      {
+        c.move_to(t.begin() + rnd(t.size() + 1));
+      }
+      c.insert(static_cast<int>(i));
+    }
+    c.flush();
+    return stop(t0);
+  }
+};
+
+template<class Tree>
+struct insert_at_random_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    Tree t;
+    xorshift rnd(3);
+    t.push_back(0);
+    double t0 = start();
+    for (std::size_t i = 1; i < n_; ++i)
+    {
+      t.insert(t.begin() + rnd(t.size() + 1), static_cast<int>(i));
+    }
+    return stop(t0);
+  }
+};
+
+// sorted batches of n/16 random inserts and erases each, applied with
+// apply_batch(); reported per edit
+template<class Tree>
+struct apply_batch_body
+{
+  std::size_t n_;
+  double operator()() const
+  {
+    typedef typename Tree::edit edit;
+    Tree t;
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    xorshift rnd(6);
+    std::size_t k = n_ / 16 + 1;
+    double total = 0;
+    for (int round = 0; round < 8; ++round)
+    {
+      std::vector<std::size_t> pos;
+      for (std::size_t i = 0; i < k; ++i)
+      {
+        pos.push_back(rnd(t.size()));
+      }
+      std::sort(pos.begin(), pos.end());
+      std::vector<edit> batch;
+      for (std::size_t i = 0; i < k; ++i)
+      {
+        if (i % 2 == 0 && (i == 0 || pos[i] != pos[i - 1]))
+        {
+          batch.push_back(edit::erasure(pos[i]));
+        }
+        else
+        {
+          batch.push_back(edit::insertion(pos[i], static_cast<int>(i)));
+        }
+      }
+      double t0 = start();
+      t.apply_batch(batch.begin(), batch.end());
+      total += stop(t0);
+    }
+    return total;
+  }
+};
+
+template<class Tree>
+struct random_access_body
+{
+  Tree* t_;
+  std::size_t ops_;
+  double operator()() const
+  {
+    xorshift rnd(4);
+    long sum = 0;
+    double t0 = start();
+    for (std::size_t i = 0; i < ops_; ++i)
+    {
+      sum += (*t_)[rnd(t_->size())];
+    }
+    double t = stop(t0);
+    if (sum == 42)
+    {
+      std::printf(" ");
+    }
+    return t;
+  }
+};
+
+// random access confined to a window of 1024 elements that drifts slowly,
+// the case self-adjusting trees are made for
+template<class Tree>
+struct local_access_body
+{
+  Tree* t_;
+  std::size_t ops_;
+  double operator()() const
+  {
+    xorshift rnd(5);
+    std::size_t n = t_->size();
+    std::size_t window = (n < 1024) ? n : 1024;
+    long sum = 0;
+    double t0 = start();
+    for (std::size_t i = 0; i < ops_; ++i)
+    {
+      std::size_t base = (i / 64) % (n - window + 1);
+      sum += (*t_)[base + rnd(window)];
+    }
+    double t = stop(t0);
+    if (sum == 42)
+    {
+      std::printf(" ");
+    }
+    return t;
+  }
+};
+
+// iterator += d over random distances up to n/8, through advance_forward()
+template<class Tree>
+struct advance_body
+{
+  Tree* t_;
+  std::size_t ops_;
+  double operator()() const
+  {
+    xorshift rnd(6);
+    std::size_t n = t_->size();
+    std::size_t reach = n / 8 + 1;
+    long sum = 0;
+    double t0 = start();
+    typename Tree::iterator it = t_->begin();
+    std::size_t position = 0;
+    for (std::size_t i = 0; i < ops_; ++i)
+    {
+      std::size_t d = rnd(reach);
+      if (n <= position + d)
+      {
+        it = t_->begin();
+        position = 0;
+        d %= n;
+      }
+      it += static_cast<typename Tree::difference_type>(d);
+      position += d;
+      sum += *it;
+    }
+    double t = stop(t0);
+    if (sum == 42)
+    {
+      std::printf(" ");
+    }
+    return t;
+  }
+};
+
+template<class Tree>
+struct iterate_body
+{
+  const Tree* t_;
+  double operator()() const
+  {
+    long sum = 0;
+    double t0 = start();
+    for (typename Tree::const_iterator it = t_->begin(); it != t_->end(); ++it)
+    {
+      sum += *it;
+    }
+    double t = stop(t0);
+    if (sum == 42)
+    {
+      std::printf(" ");
+    }
+    return t;
+  }
+};
+
+template<class Tree>
+void run(std::size_t n, int repeat, int b, result (&best)[workload_count][backend_count])
+{
+  push_back_body<Tree> pb = { n };
+  best[0][b] = measure(n, repeat, pb);
+  push_front_body<Tree> pf = { n };
+  best[1][b] = measure(n, repeat, pf);
+  pop_body<Tree> popb = { n, true };
+  best[2][b] = measure(n, repeat, popb);
+  pop_body<Tree> popf = { n, false };
+  best[3][b] = measure(n, repeat, popf);
+  insert_at_iterator_body<Tree> ii = { n };
+  best[4][b] = measure(n, repeat, ii);
+  erase_at_iterator_body<Tree> ei = { n };
+  best[5][b] = measure(n, repeat, ei);
+  insert_at_random_body<Tree> ir = { n };
+  best[6][b] = measure(n, repeat, ir);
+  apply_batch_body<Tree> ab = { n };
+  best[10][b] = measure(8 * (n / 16 + 1), repeat, ab);
+  queue_body<Tree> q = { n, 0 };
+  best[11][b] = measure(n, repeat, q);
+  queue_body<Tree> qb = { n, 32 };
+  best[12][b] = measure(n, repeat, qb);
+  cursor_body<Tree> cb = { n };
+  best[13][b] = measure(n, repeat, cb);
+
+  Tree t;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    t.push_back(static_cast<int>(i));
+  }
+  random_access_body<Tree> ra = { &t, n };
+  best[7][b] = measure(n, repeat, ra);
+  local_access_body<Tree> la = { &t, n };
+  best[8][b] = measure(n, repeat, la);
+  iterate_body<Tree> it = { &t };
+  best[9][b] = measure(n, repeat, it);
+  advance_body<Tree> ad = { &t, n };
+  best[14][b] = measure(n, repeat, ad);
+}
+
+#if INDEXING_TREE_HAS_THREADS
+// indexing_tree behind one mutex, with the positional interface of the
+// concurrent front ends
+class locked_tree
+{
+public:
+  typedef osoken::indexing_tree<int> tree_type;
+  typedef tree_type::size_type size_type;
+  void insert(size_type position, int x)
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tree_.insert(position, x);
+  }
+  void erase(size_type position)
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tree_.erase(position);
+  }
+  void push_back(int x)
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tree_.push_back(x);
+  }
+private:
+  std::mutex lock_;
+  tree_type tree_;
+};
+
+const int front_end_count = 3;
+const char* const front_ends[] = { "mutex", "combining", "sharded" };
+
+// Each thread inserts and then erases at random positions below range_,
+// ops_ times each. A thread has at most one insertion outstanding, so the
+// sequence never drops below the n elements it starts with.
+template<class Tree>
+struct writer
+{
+  Tree* t_;
+  std::size_t range_;
+  std::size_t ops_;
+  unsigned seed_;
+  void operator()() const
+  {
+    xorshift rnd(seed_);
+    for (std::size_t i = 0; i < ops_; ++i)
+    {
+      t_->insert(rnd(range_), static_cast<int>(i));
+      t_->erase(rnd(range_));
+    }
+  }
+};
+
+template<class Tree>
+struct shared_writers_body
+{
+  std::size_t n_;
+  std::size_t range_;
+  unsigned threads_;
+  double operator()() const
+  {
+    Tree t;
+    for (std::size_t i = 0; i < n_; ++i)
+    {
+      t.push_back(static_cast<int>(i));
+    }
+    std::vector<std::thread> workers;
+    double t0 = now();
+    for (unsigned k = 0; k < threads_; ++k)
+    {
+      writer<Tree> w = { &t, range_, n_ / threads_ / 2, k + 1 };
+      workers.push_back(std::thread(w));
+    }
+    for (unsigned k = 0; k < threads_; ++k)
+    {
+      workers[k].join();
+    }
+    return now() - t0;
+  }
+};
+
+// best of repeat runs, in nanoseconds per edit
+template<class Body>
+double wall_clock(std::size_t ops, int repeat, Body body)
+{
+  double best = 1e300;
+  for (int i = 0; i < repeat; ++i)
+  {
+    best = std::min(best, body() / ops * 1e9);
+  }
+  return best;
+}
+
+void run_concurrent(const char* name, std::size_t n, std::size_t range, int repeat)
+{
+  unsigned most = std::max(8u, std::thread::hardware_concurrency());
+  std::printf("\n%s, %lu elements, ns per edit (wall clock)\n", name, static_cast<unsigned long>(n));
+  std::printf("%-24s", "threads");
+  for (int f = 0; f < front_end_count; ++f)
+  {
+    std::printf(" %10s", front_ends[f]);
+  }
+  std::printf("\n");
+  for (unsigned threads = 1; threads <= most; threads *= 2)
+  {
+    std::size_t ops = n / threads / 2 * 2 * threads;
+    shared_writers_body<locked_tree> locked = { n, range, threads };
+    shared_writers_body<osoken::combining_indexing_tree<int> > combining = { n, range, threads };
+    shared_writers_body<osoken::sharded_indexing_tree<int> > sharded = { n, range, threads };
+    std::printf("%-24u", threads);
+    std::printf(" %10.1f", wall_clock(ops, repeat, locked));
+    std::printf(" %10.1f", wall_clock(ops, repeat, combining));
+    std::printf(" %10.1f", wall_clock(ops, repeat, sharded));
+    std::printf("\n");
+  }
+}
+#endif
+
+} // end of anonymous namespace
+
+int main(int argc, char** argv)
+{
+  std::size_t n = (1 < argc) ? std::strtoul(argv[1], 0, 10) : 1000000;
+  int repeat = (2 < argc) ? std::atoi(argv[2]) : 5;
+  std::printf("indexing_tree<int>, %lu elements, best of %d\n", static_cast<unsigned long>(n), repeat);
+
+  static const char* const names[workload_count] =
+  {
+    "push_back", "push_front", "pop_back", "pop_front",
+    "insert(iterator)", "erase(iterator)", "insert(begin()+rand)",
+    "operator[] random", "operator[] local", "iterate",
+    "apply_batch", "queue", "queue, end_buffer(32)",
+    "cursor, runs of 64", "iterator += rand"
+  };
+  result best[workload_count][backend_count];
+  run<osoken::indexing_tree<int> >(n, repeat, 0, best);
+  run<osoken::indexing_tree<int, std::allocator<int>, osoken::treap_balance> >(n, repeat, 1, best);
+  run<osoken::indexing_tree<int, std::allocator<int>, osoken::splay_balance> >(n, repeat, 2, best);
+#ifdef __linux__
+  run<osoken::indexing_tree<int, osoken::hugepage_allocator<int> > >(n, repeat, 3, best);
+#endif
+
+  std::printf("%-24s", "");
+  for (int b = 0; b < backend_count; ++b)
+  {
+    std::printf(" %10s", backends[b]);
+  }
+  std::printf("   best\n");
+  for (int w = 0; w < workload_count; ++w)
+  {
+    report(names[w], best[w]);
+  }
+
+  if (!hardware.any())
+  {
+    std::printf("\nhardware counters unavailable: %s\n", hardware.error());
+  }
+  else
+  {
+    for (int b = 0; b < backend_count; ++b)
+    {
+      std::printf("\n%-24s", backends[b]);
+      for (int e = 0; e < counters::event_count; ++e)
+      {
+        std::printf(" %10s", counters::names[e]);
+      }
+      std::printf("\n");
+      for (int w = 0; w < workload_count; ++w)
+      {
+        report_events(names[w], best[w][b]);
+      }
+    }
+  }
+#if INDEXING_TREE_HAS_THREADS
+  run_concurrent("concurrent edits, spread out", n, n, repeat);
+  run_concurrent("concurrent edits, contended", n, std::min<std::size_t>(n, 1024), repeat);
+#endif
+  return 0;
+}
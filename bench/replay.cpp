@@ -0,0 +1,292 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+// Replays a trace recorded by traced_indexing_tree.
+//   g++ -O2 -std=c++11 -I.. replay.cpp -o replay
+//   ./replay trace [repeat]
+// The trace is run against each balance policy and, for comparison, against
+// std::vector and std::deque, starting from as many elements as the traced
+// sequence held when recording began. Throughput is the best of `repeat`
+// runs in nanoseconds per operation; the latency percentiles come from one
+// further run that times every operation on its own, clock overhead
+// included.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include "indexing_tree.hpp"
+#include "traced_indexing_tree.hpp"
+
+namespace
+{
+
+typedef osoken::indexing_tree_trace trace;
+typedef std::vector<trace::record> trace_type;
+
+double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Positional edits that a sequence does not provide itself.
+template<class Seq>
+void push_front(Seq& s, int x)
+{
+  s.push_front(x);
+}
+
+template<class T, class A>
+void push_front(std::vector<T,A>& s, int x)
+{
+  s.insert(s.begin(), x);
+}
+
+template<class Seq>
+void pop_front(Seq& s)
+{
+  s.pop_front();
+}
+
+template<class T, class A>
+void pop_front(std::vector<T,A>& s)
+{
+  s.erase(s.begin());
+}
+
+template<class Seq>
+void erase(Seq& s, std::size_t position, std::size_t n)
+{
+  s.erase(s.begin() + position, s.begin() + (position + n));
+}
+
+template<class T, class A, class B>
+void erase(osoken::indexing_tree<T,A,B>& s, std::size_t position, std::size_t n)
+{
+  typename osoken::indexing_tree<T,A,B>::iterator it = s.begin() + position;
+  for (; n != 0; --n)
+  {
+    it = s.erase(it);
+  }
+}
+
+template<class Seq>
+inline void apply(Seq& s, const trace::record& r, int x, long long& sum)
+{
+  switch (r.op_)
+  {
+  case trace::read_op:
+    sum += s[r.position_];
+    break;
+  case trace::insert_op:
+    s.insert(s.begin() + r.position_, x);
+    break;
+  case trace::erase_op:
+    erase(s, r.position_, r.count_);
+    break;
+  case trace::push_back_op:
+    s.push_back(x);
+    break;
+  case trace::pop_back_op:
+    s.pop_back();
+    break;
+  case trace::push_front_op:
+    push_front(s, x);
+    break;
+  case trace::pop_front_op:
+    pop_front(s);
+    break;
+  case trace::clear_op:
+    s.clear();
+    break;
+  }
+}
+
+template<class Seq>
+void fill(Seq& s, const trace_type& t)
+{
+  std::size_t n = t.empty() ? 0 : t[0].size_;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    s.push_back(static_cast<int>(i));
+  }
+}
+
+template<class Seq>
+double replay(const trace_type& t, long long& sum)
+{
+  Seq s;
+  fill(s, t);
+  double t0 = now();
+  for (std::size_t i = 0; i < t.size(); ++i)
+  {
+    apply(s, t[i], static_cast<int>(i), sum);
+  }
+  return now() - t0;
+}
+
+template<class Seq>
+void replay_timed(const trace_type& t, std::vector<double>& latency, long long& sum)
+{
+  Seq s;
+  fill(s, t);
+  latency.resize(t.size());
+  for (std::size_t i = 0; i < t.size(); ++i)
+  {
+    double t0 = now();
+    apply(s, t[i], static_cast<int>(i), sum);
+    latency[i] = now() - t0;
+  }
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  std::size_t i = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[i] * 1e9;
+}
+
+template<class Seq>
+void run(const char* name, const trace_type& t, int repeat)
+{
+  long long sum = 0;
+  double best = 1e300;
+  for (int i = 0; i < repeat; ++i)
+  {
+    best = std::min(best, replay<Seq>(t, sum));
+  }
+  std::vector<double> latency;
+  replay_timed<Seq>(t, latency, sum);
+  std::sort(latency.begin(), latency.end());
+  std::printf("%-10s %10.1f %8.0f %8.0f %8.0f %8.0f %10.0f\n", name,
+              t.empty() ? 0.0 : best / t.size() * 1e9,
+              percentile(latency, 0.5), percentile(latency, 0.9),
+              percentile(latency, 0.99), percentile(latency, 0.999),
+              percentile(latency, 1.0));
+  if (sum == 42)
+  {
+    std::printf(" ");
+  }
+}
+
+// Checks every record against the size the trace implies, so that a
+// replay never leaves the sequence, and prints what the trace contains.
+bool summarize(const trace_type& t)
+{
+  static const char* const names[] =
+  {
+    "", "read", "insert", "erase", "push_back", "pop_back", "push_front", "pop_front", "clear"
+  };
+  std::size_t count[9] = { 0 };
+  std::size_t size = t.empty() ? 0 : t[0].size_;
+  std::size_t peak = size;
+  for (std::size_t i = 0; i < t.size(); ++i)
+  {
+    const trace::record& r = t[i];
+    bool valid = r.size_ == size;
+    switch (r.op_)
+    {
+    case trace::read_op:
+      valid = valid && r.position_ < size;
+      break;
+    case trace::insert_op:
+      valid = valid && r.position_ <= size;
+      ++size;
+      break;
+    case trace::erase_op:
+      valid = valid && r.count_ <= size && r.position_ <= size - r.count_;
+      size -= std::min(size, r.count_);
+      break;
+    case trace::push_back_op:
+    case trace::push_front_op:
+      ++size;
+      break;
+    case trace::pop_back_op:
+    case trace::pop_front_op:
+      valid = valid && size != 0;
+      --size;
+      break;
+    case trace::clear_op:
+      size = 0;
+      break;
+    }
+    if (!valid)
+    {
+      std::fprintf(stderr, "record %lu does not match the traced sequence\n", static_cast<unsigned long>(i));
+      return false;
+    }
+    peak = std::max(peak, size);
+    ++count[r.op_];
+  }
+  std::printf("%lu operations, %lu elements at start, %lu at peak, %lu at end\n",
+              static_cast<unsigned long>(t.size()), static_cast<unsigned long>(t.empty() ? 0 : t[0].size_),
+              static_cast<unsigned long>(peak), static_cast<unsigned long>(size));
+  for (int op = trace::read_op; op <= trace::clear_op; ++op)
+  {
+    if (count[op] != 0)
+    {
+      std::printf("  %-10s %10lu\n", names[op], static_cast<unsigned long>(count[op]));
+    }
+  }
+  return true;
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s trace [repeat]\n", argv[0]);
+    return 2;
+  }
+  int repeat = (2 < argc) ? std::atoi(argv[2]) : 5;
+  trace_type t;
+  try
+  {
+    trace::read(argv[1], t);
+  }
+  catch (const std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  if (!summarize(t))
+  {
+    return 1;
+  }
+
+  std::printf("%-10s %10s %8s %8s %8s %8s %10s\n", "", "ns/op", "p50", "p90", "p99", "p99.9", "max");
+  run<osoken::indexing_tree<int> >("weight", t, repeat);
+  run<osoken::indexing_tree<int, std::allocator<int>, osoken::treap_balance> >("treap", t, repeat);
+  run<osoken::indexing_tree<int, std::allocator<int>, osoken::splay_balance> >("splay", t, repeat);
+  run<std::vector<int> >("vector", t, repeat);
+  run<std::deque<int> >("deque", t, repeat);
+  return 0;
+}
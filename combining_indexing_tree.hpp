@@ -0,0 +1,458 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef COMBINING_INDEXING_TREE_HPP_
+#define COMBINING_INDEXING_TREE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "indexing_tree.hpp"
+
+#if !INDEXING_TREE_HAS_THREADS
+#  error "combining_indexing_tree needs C++11 threads"
+#endif
+
+namespace osoken
+{
+
+// indexing_tree shared by several threads through flat combining. A call
+// publishes its request in a slot (a thread starts probing at a slot
+// picked from its id, so it usually keeps the same one) and then either
+// takes the lock and serves the pending requests of all threads, or waits
+// until another thread has served it. The combining thread orders the
+// requests it has collected by descending position, with push_back() in
+// front of them all, and applies each such round as one apply_batch(), or
+// a round of a single edit directly.
+// In that order no request moves the position of a later one, so the
+// positions given by the callers hold unchanged; a second erasure at a
+// position already erased in the round is held back for the next one.
+// at() returns a copy, since the element may be erased as soon as the
+// lock is released. A request that fails throws in its own thread; the
+// others are still applied. exclusive() runs a function on the tree under
+// the lock, e.g. to iterate over it.
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
+class combining_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc,Balance> tree_type;
+  typedef typename tree_type::size_type size_type;
+  typedef T value_type;
+
+  explicit combining_indexing_tree(size_type slots = 0, const Alloc& alloc = Alloc());
+
+  size_type size() const;
+  bool empty() const;
+  T at(size_type n);
+
+  void insert(size_type position, const T& x);
+  void erase(size_type position);
+  void push_back(const T& x);
+  void push_front(const T& x);
+  template<class F>
+  void exclusive(F f);
+private:
+  combining_indexing_tree(const combining_indexing_tree&);
+  combining_indexing_tree& operator = (const combining_indexing_tree&);
+
+  // in the order of requests at the same position within a round
+  enum opcode { read_op, erase_op, insert_op, push_back_op };
+  enum slot_state { free_state, claimed_state, pending_state, done_state };
+
+  // padded so that threads spinning on neighbouring slots do not share
+  // cache lines
+  struct slot
+  {
+    std::atomic<int> state_;
+    opcode op_;
+    size_type position_;
+    const T* in_;
+    T* out_;
+    std::exception_ptr error_;
+    char padding_[64];
+  };
+
+  struct request
+  {
+    slot* slot_;
+    opcode op_;
+    size_type position_;
+  };
+
+  struct serial_order
+  {
+    bool operator () (const request& a, const request& b) const;
+  };
+
+  static const int passes_ = 4;
+
+  tree_type tree_;
+  std::unique_ptr<slot[]> slots_;
+  size_type slot_count_;
+  std::mutex lock_;
+  std::atomic<size_type> size_;
+  std::vector<request> requests_;
+  std::vector<request> deferred_;
+  std::vector<request> edits_;
+  std::vector<typename tree_type::edit> batch_;
+
+  void submit(opcode op, size_type position, const T* in, T* out);
+  slot* claim();
+  void combine();
+  void apply_round();
+  void apply_serially();
+  static void finish(slot* s, std::exception_ptr error);
+};
+
+//////////////////
+// combining_indexing_tree
+//////////////////
+// private member functions
+template<class T, class A, class B>
+inline bool combining_indexing_tree<T,A,B>::serial_order::operator () (const request& a, const request& b) const
+{
+  if ((a.op_ == push_back_op) != (b.op_ == push_back_op))
+  {
+    return a.op_ == push_back_op;
+  }
+  if (a.position_ != b.position_)
+  {
+    return b.position_ < a.position_;
+  }
+  return a.op_ < b.op_;
+}
+
+template<class T, class A, class B>
+typename combining_indexing_tree<T,A,B>::slot* combining_indexing_tree<T,A,B>::claim()
+{
+  size_type start = std::hash<std::thread::id>()(std::this_thread::get_id()) % slot_count_;
+  for (;;)
+  {
+    for (size_type i = 0; i < slot_count_; ++i)
+    {
+      slot& s = slots_[(start + i) % slot_count_];
+      int expected = free_state;
+      if (s.state_.load(std::memory_order_relaxed) == free_state &&
+          s.state_.compare_exchange_strong(expected, claimed_state, std::memory_order_acquire))
+      {
+        return &s;
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+template<class T, class A, class B>
+void combining_indexing_tree<T,A,B>::submit(opcode op, size_type position, const T* in, T* out)
+{
+  slot* s = claim();
+  s->op_ = op;
+  s->position_ = position;
+  s->in_ = in;
+  s->out_ = out;
+  s->state_.store(pending_state, std::memory_order_release);
+  while (s->state_.load(std::memory_order_acquire) != done_state)
+  {
+    std::unique_lock<std::mutex> guard(lock_, std::try_to_lock);
+    if (guard.owns_lock())
+    {
+      combine();
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+  std::exception_ptr error = s->error_;
+  s->error_ = std::exception_ptr();
+  s->state_.store(free_state, std::memory_order_release);
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+// Called with the lock held. Collects pending requests a few times over,
+// so that requests published while a round was applied join the next one
+// instead of waiting for the lock.
+template<class T, class A, class B>
+void combining_indexing_tree<T,A,B>::combine()
+{
+  for (int pass = 0; pass < passes_; ++pass)
+  {
+    for (size_type i = 0; i < slot_count_; ++i)
+    {
+      slot& s = slots_[i];
+      if (s.state_.load(std::memory_order_acquire) == pending_state)
+      {
+        request r = { &s, s.op_, s.position_ };
+        requests_.push_back(r);
+      }
+    }
+    if (requests_.empty())
+    {
+      break;
+    }
+    while (!requests_.empty())
+    {
+      apply_round();
+    }
+  }
+  size_.store(tree_.size(), std::memory_order_release);
+}
+
+// Serves the requests in requests_ as one round and leaves the held back
+// ones there for the next. Requests are checked against the size before
+// the round: in the serial order every position below the current one is
+// still untouched, so this is the same check as at the time of the call.
+template<class T, class A, class B>
+void combining_indexing_tree<T,A,B>::apply_round()
+{
+  size_type n = tree_.size();
+  std::stable_sort(requests_.begin(), requests_.end(), serial_order());
+  deferred_.clear();
+  edits_.clear();
+  size_type pushes = 0;
+  bool erased = false;
+  size_type erased_at = 0;
+  for (size_type i = 0; i < requests_.size(); ++i)
+  {
+    const request& r = requests_[i];
+    if (r.op_ == push_back_op)
+    {
+      edits_.push_back(r);
+      ++pushes;
+    }
+    else if (r.op_ == insert_op ? (n < r.position_) : (n <= r.position_))
+    {
+      finish(r.slot_, std::make_exception_ptr(std::out_of_range("indexing_tree::out_of_range")));
+    }
+    else if (r.op_ == read_op)
+    {
+      std::exception_ptr error;
+      try
+      {
+        ::new (static_cast<void*>(r.slot_->out_)) T(tree_[r.position_]);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      finish(r.slot_, error);
+    }
+    else if (r.op_ == erase_op && erased && erased_at == r.position_)
+    {
+      deferred_.push_back(r);
+    }
+    else
+    {
+      if (r.op_ == erase_op)
+      {
+        erased = true;
+        erased_at = r.position_;
+      }
+      edits_.push_back(r);
+    }
+  }
+  // a lone edit is applied as it is, without the set-up of a batch
+  if (edits_.size() == 1)
+  {
+    apply_serially();
+    requests_.swap(deferred_);
+    return;
+  }
+  // apply_batch() takes positions in ascending order and puts insertions
+  // at one position in front of each other in the order of the batch,
+  // i.e. the reverse of the serial order; the push_back()s come last
+  try
+  {
+    batch_.clear();
+    for (size_type i = edits_.size(); pushes < i; --i)
+    {
+      const request& r = edits_[i - 1];
+      batch_.push_back(r.op_ == erase_op ? tree_type::edit::erasure(r.position_) : tree_type::edit::insertion(r.position_, *r.slot_->in_));
+    }
+    for (size_type i = 0; i < pushes; ++i)
+    {
+      batch_.push_back(tree_type::edit::insertion(n, *edits_[i].slot_->in_));
+    }
+    tree_.apply_batch(batch_.begin(), batch_.end());
+  }
+  catch (...)
+  {
+    // the tree is unchanged; find out which requests fail
+    apply_serially();
+    requests_.swap(deferred_);
+    return;
+  }
+  for (size_type i = 0; i < edits_.size(); ++i)
+  {
+    finish(edits_[i].slot_, std::exception_ptr());
+  }
+  requests_.swap(deferred_);
+}
+
+template<class T, class A, class B>
+void combining_indexing_tree<T,A,B>::apply_serially()
+{
+  for (size_type i = 0; i < edits_.size(); ++i)
+  {
+    const request& r = edits_[i];
+    std::exception_ptr error;
+    try
+    {
+      if (r.op_ == push_back_op)
+      {
+        tree_.push_back(*r.slot_->in_);
+      }
+      else if (r.op_ == insert_op)
+      {
+        tree_.insert(r.position_, *r.slot_->in_);
+      }
+      else
+      {
+        tree_.erase(r.position_);
+      }
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    finish(r.slot_, error);
+  }
+}
+
+// The caller may reuse the slot as soon as it is marked done.
+template<class T, class A, class B>
+inline void combining_indexing_tree<T,A,B>::finish(slot* s, std::exception_ptr error)
+{
+  s->error_ = error;
+  s->state_.store(done_state, std::memory_order_release);
+}
+
+// public member functions
+template<class T, class A, class B>
+combining_indexing_tree<T,A,B>::combining_indexing_tree(size_type slots, const A& alloc)
+  : tree_(alloc),slots_(),slot_count_(slots),size_(0)
+{
+  if (slot_count_ == 0)
+  {
+    slot_count_ = std::max<size_type>(8, 2 * std::thread::hardware_concurrency());
+  }
+  slots_.reset(new slot[slot_count_]);
+  for (size_type i = 0; i < slot_count_; ++i)
+  {
+    slots_[i].state_.store(free_state, std::memory_order_relaxed);
+  }
+  // combine() must not fail between taking a request and serving it
+  requests_.reserve(slot_count_);
+  deferred_.reserve(slot_count_);
+  edits_.reserve(slot_count_);
+  batch_.reserve(slot_count_);
+}
+
+// The size after the latest round; other threads may change it at once.
+template<class T, class A, class B>
+inline typename combining_indexing_tree<T,A,B>::size_type combining_indexing_tree<T,A,B>::size() const
+{
+  return size_.load(std::memory_order_acquire);
+}
+
+template<class T, class A, class B>
+inline bool combining_indexing_tree<T,A,B>::empty() const
+{
+  return size() == 0;
+}
+
+template<class T, class A, class B>
+T combining_indexing_tree<T,A,B>::at(size_type n)
+{
+  typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type buffer;
+  T* p = reinterpret_cast<T*>(&buffer);
+  submit(read_op, n, 0, p);
+  struct destroyer
+  {
+    T* p_;
+    ~destroyer()
+    {
+      p_->~T();
+    }
+  } d = { p };
+  return std::move(*p);
+}
+
+template<class T, class A, class B>
+inline void combining_indexing_tree<T,A,B>::insert(size_type position, const T& x)
+{
+  submit(insert_op, position, &x, 0);
+}
+
+template<class T, class A, class B>
+inline void combining_indexing_tree<T,A,B>::erase(size_type position)
+{
+  submit(erase_op, position, 0, 0);
+}
+
+template<class T, class A, class B>
+inline void combining_indexing_tree<T,A,B>::push_back(const T& x)
+{
+  submit(push_back_op, 0, &x, 0);
+}
+
+template<class T, class A, class B>
+inline void combining_indexing_tree<T,A,B>::push_front(const T& x)
+{
+  submit(insert_op, 0, &x, 0);
+}
+
+// Runs f(tree) with the lock held; requests of other threads wait.
+template<class T, class A, class B>
+template<class F>
+void combining_indexing_tree<T,A,B>::exclusive(F f)
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  try
+  {
+    f(tree_);
+  }
+  catch (...)
+  {
+    size_.store(tree_.size(), std::memory_order_release);
+    throw;
+  }
+  size_.store(tree_.size(), std::memory_order_release);
+}
+
+} // end of namespace osoken
+
+#endif // COMBINING_INDEXING_TREE_HPP_
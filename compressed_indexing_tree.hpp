@@ -0,0 +1,1141 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef COMPRESSED_INDEXING_TREE_HPP_
+#define COMPRESSED_INDEXING_TREE_HPP_
+
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include "indexing_tree.hpp"
+
+namespace osoken
+{
+
+// Compressed variant of indexing_tree for integral T, meant for IDs and
+// timestamps that are close to sorted.
+// Each node holds a block: its first element as is, followed by up to
+// block_bytes bytes of differences between neighbouring elements, zigzag
+// and varint encoded so that small steps in either direction take one
+// byte. Every subtree keeps its element count, so an element is found in
+// O(log n) and decoded from the start of its block. Edits decode the one
+// block they touch and encode it again, splitting it when it overflows.
+// The tree is weight-balanced on the number of blocks, like indexing_rope.
+// Elements are returned by value; set() replaces one.
+template<class T, class Alloc = ::std::allocator<T> >
+class compressed_indexing_tree
+{
+public:
+  typedef T value_type;
+  typedef Alloc allocator_type;
+  typedef T const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  static const size_type block_bytes = 192;
+private:
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  static_assert(std::is_integral<T>::value, "compressed_indexing_tree requires an integral T");
+#else
+  typedef char integral_value_type_required[integral_trait_name_space::is_integral<T>::value_ ? 1 : -1];
+#endif
+  typedef unsigned long long code_type;
+  struct node
+  {
+    node *next_, *prev_, *left_, *right_, *parent_;
+    size_type size_;
+    size_type length_;
+    T first_;
+    unsigned short count_;
+    unsigned short bytes_;
+    unsigned char data_[block_bytes];
+  };
+  typedef node node_type;
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc< node_type > node_allocator_type;
+#else
+  typedef typename allocator_type::template rebind< node_type >::other node_allocator_type;
+#endif
+  // an overflowing block holds at most this many elements while it is split
+  static const size_type buffer_capacity = block_bytes + 3;
+public:
+  class const_iterator
+  {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const T* pointer;
+    typedef T reference;
+
+    const_iterator(const const_iterator& i);
+    const_iterator();
+    T operator*() const;
+    const_iterator& operator++();
+    const_iterator operator++(int);
+    const_iterator& operator--();
+    const_iterator operator--(int);
+    bool operator == (const const_iterator& i) const;
+    bool operator != (const const_iterator& i) const;
+  private:
+    const_iterator(node_type* node, size_type index);
+
+    node_type* node_;
+    size_type index_;
+    size_type offset_;
+    T value_;
+
+    void seek(size_type index);
+
+    friend class compressed_indexing_tree;
+  };
+  friend class const_iterator;
+
+  explicit compressed_indexing_tree(const Alloc& alloc = Alloc());
+  compressed_indexing_tree(size_type n, const T& x, const Alloc& alloc = Alloc());
+  compressed_indexing_tree(const compressed_indexing_tree& that);
+  ~compressed_indexing_tree();
+
+  compressed_indexing_tree& operator = (const compressed_indexing_tree& that);
+  Alloc get_allocator() const;
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  size_type size() const;
+  bool empty() const;
+  size_type block_count() const;
+  size_type memory_usage() const;
+
+  T operator [] (size_type n) const;
+  T at(size_type n) const;
+  T front() const;
+  T back() const;
+
+  void set(size_type n, const T& x);
+  void push_back(const T& x);
+  void push_front(const T& x);
+  void pop_back();
+  void pop_front();
+  template<class InputIterator>
+  void append(InputIterator first, InputIterator last);
+  void insert(size_type pos, const T& x);
+  void erase(size_type pos, size_type len = 1);
+  void swap(compressed_indexing_tree& that) throw();
+
+  void clear();
+private:
+  node_type* sentinel_;
+  allocator_type alloc_;
+  node_allocator_type nodealloc_;
+
+  void init_sentinel_();
+  node_type* locate(size_type& pos) const;
+  node_type* locate_for_insert(size_type& pos) const;
+  void range_check_lt(size_type n) const;
+  void range_check_leq(size_type n) const;
+  static void update(node_type* p);
+  void propagate(node_type* p, size_type length, bool incr);
+  void fix_up(node_type* p);
+  bool is_balanced(node_type* p) const;
+  void rebalance(node_type* p);
+  void ll_rotation(node_type* p);
+  void rr_rotation(node_type* p);
+  void lr_rotation(node_type* p);
+  void rl_rotation(node_type* p);
+  node_type* newblock();
+  void link_before(node_type* position, node_type* n);
+  void unlink(node_type* p);
+  void store(node_type* p, const T* values, size_type n);
+  void merge_with_next(node_type* p);
+  static size_type decode(const node_type* p, T* values);
+  static code_type zigzag(const T& from, const T& to);
+  static T unzigzag(const T& from, code_type z);
+  static size_type put(unsigned char* s, code_type z);
+  static size_type get(const unsigned char* s, code_type& z);
+  static size_type code_size(code_type z);
+  static void replace_child(node_type* parent, node_type* from, node_type* to);
+  static bool is_sentinel(node_type* p);
+};
+
+template<class T, class A>
+const typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::block_bytes;
+
+template<class T, class A>
+const typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::buffer_capacity;
+
+//////////////////
+// const_iterator
+//////////////////
+template<class T, class A>
+inline compressed_indexing_tree<T,A>::const_iterator::const_iterator(const const_iterator& i):
+node_(i.node_),index_(i.index_),offset_(i.offset_),value_(i.value_)
+{
+}
+
+template<class T, class A>
+inline compressed_indexing_tree<T,A>::const_iterator::const_iterator():
+node_(0),index_(0),offset_(0),value_()
+{
+}
+
+template<class T, class A>
+inline compressed_indexing_tree<T,A>::const_iterator::const_iterator(node_type* node, size_type index):
+node_(node),index_(0),offset_(0),value_()
+{
+  seek(index);
+}
+
+// Decodes the block of node_ up to element index; offset_ is left on the
+// code of the element after it.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::const_iterator::seek(size_type index)
+{
+  index_ = index;
+  offset_ = 0;
+  if (is_sentinel(node_))
+  {
+    return;
+  }
+  value_ = node_->first_;
+  for (size_type i = 0; i < index; ++i)
+  {
+    code_type z;
+    offset_ += get(node_->data_ + offset_, z);
+    value_ = unzigzag(value_, z);
+  }
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::const_iterator::operator*() const
+{
+  return value_;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator& compressed_indexing_tree<T,A>::const_iterator::operator++()
+{
+  if (++index_ < node_->count_)
+  {
+    code_type z;
+    offset_ += get(node_->data_ + offset_, z);
+    value_ = unzigzag(value_, z);
+    return *this;
+  }
+  node_ = node_->next_;
+  index_ = 0;
+  offset_ = 0;
+  if (!is_sentinel(node_))
+  {
+    value_ = node_->first_;
+  }
+  return *this;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator compressed_indexing_tree<T,A>::const_iterator::operator++(int)
+{
+  const_iterator tmp = *this;
+  operator++();
+  return tmp;
+}
+
+// Steps back over the code of the current element: the last byte of a code
+// is the only one without the high bit set. Leaving a block decodes the
+// previous one from its start.
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator& compressed_indexing_tree<T,A>::const_iterator::operator--()
+{
+  if (index_ == 0)
+  {
+    node_ = node_->prev_;
+    seek(node_->count_ - 1);
+    return *this;
+  }
+  size_type start = offset_ - 1;
+  while (start != 0 && (node_->data_[start - 1] & 0x80) != 0)
+  {
+    --start;
+  }
+  code_type z;
+  get(node_->data_ + start, z);
+  value_ = static_cast<T>(static_cast<code_type>(value_) - ((z >> 1) ^ (0 - (z & 1))));
+  offset_ = start;
+  --index_;
+  return *this;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator compressed_indexing_tree<T,A>::const_iterator::operator--(int)
+{
+  const_iterator tmp = *this;
+  operator--();
+  return tmp;
+}
+
+template<class T, class A>
+inline bool compressed_indexing_tree<T,A>::const_iterator::operator == (const const_iterator& i) const
+{
+  return node_ == i.node_ && index_ == i.index_;
+}
+
+template<class T, class A>
+inline bool compressed_indexing_tree<T,A>::const_iterator::operator != (const const_iterator& i) const
+{
+  return node_ != i.node_ || index_ != i.index_;
+}
+
+//////////////////
+// compressed_indexing_tree
+//////////////////
+// private member functions
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::init_sentinel_()
+{
+  sentinel_ = nodealloc_.allocate(1);
+  sentinel_->left_ = sentinel_;
+  sentinel_->next_ = sentinel_;
+  sentinel_->parent_ = sentinel_;
+  sentinel_->prev_ = sentinel_;
+  sentinel_->right_ = sentinel_;
+  sentinel_->size_ = 0;
+  sentinel_->length_ = 0;
+  sentinel_->count_ = 0;
+  sentinel_->bytes_ = 0;
+}
+
+// Returns the block holding the element at pos and makes pos an index into it.
+template<class T, class A>
+typename compressed_indexing_tree<T,A>::node_type* compressed_indexing_tree<T,A>::locate(size_type& pos) const
+{
+  node_type* p = sentinel_->left_;
+  while (!is_sentinel(p))
+  {
+    if (pos < p->left_->length_)
+    {
+      p = p->left_;
+      continue;
+    }
+    pos -= p->left_->length_;
+    if (pos < p->count_)
+    {
+      return p;
+    }
+    pos -= p->count_;
+    p = p->right_;
+  }
+  return p;
+}
+
+// Like locate, but a position on a block boundary resolves to the end of the
+// block on its left so that appending does not open a new block.
+template<class T, class A>
+typename compressed_indexing_tree<T,A>::node_type* compressed_indexing_tree<T,A>::locate_for_insert(size_type& pos) const
+{
+  node_type* p = sentinel_->left_;
+  while (!is_sentinel(p))
+  {
+    if (pos <= p->left_->length_ && !is_sentinel(p->left_))
+    {
+      p = p->left_;
+      continue;
+    }
+    pos -= p->left_->length_;
+    if (pos <= p->count_)
+    {
+      return p;
+    }
+    pos -= p->count_;
+    p = p->right_;
+  }
+  return p;
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::range_check_lt(size_type n) const
+{
+  if ( sentinel_->left_->length_ < n )
+  {
+    throw std::out_of_range("compressed_indexing_tree::out_of_range");
+  }
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::range_check_leq(size_type n) const
+{
+  if ( sentinel_->left_->length_ <= n )
+  {
+    throw std::out_of_range("compressed_indexing_tree::out_of_range");
+  }
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::update(node_type* p)
+{
+  p->size_ = p->left_->size_ + p->right_->size_ + 1;
+  p->length_ = p->left_->length_ + p->right_->length_ + p->count_;
+}
+
+// Carries a change of block contents up to the root. The shape of the tree
+// does not change, so no rebalancing is needed.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::propagate(node_type* p, size_type length, bool incr)
+{
+  while (!is_sentinel(p))
+  {
+    if (incr)
+    {
+      p->length_ += length;
+    }
+    else
+    {
+      p->length_ -= length;
+    }
+    p = p->parent_;
+  }
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::fix_up(node_type* p)
+{
+  while (!is_sentinel(p))
+  {
+    node_type *parent = p->parent_;
+    update(p);
+    rebalance(p);
+    p = parent;
+  }
+}
+
+template<class T, class A>
+inline bool compressed_indexing_tree<T,A>::is_balanced(node_type* p) const
+{
+  if (p->left_->size_ < p->right_->size_)
+  {
+    return ( (p->right_->size_ - p->left_->size_) <= (p->left_->size_ + 1) );
+  }
+  return ( (p->left_->size_ - p->right_->size_) <= (p->right_->size_ + 1) );
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::rebalance(node_type* p)
+{
+  while (!is_balanced(p))
+  {
+    if (p->right_->size_ < p->left_->size_)
+    {
+      if (p->right_->size_ + p->left_->right_->size_ <= 2*p->left_->left_->size_)
+      {
+        ll_rotation(p);
+        return;
+      }
+      node_type* pp = p;
+      if (p->left_->right_->left_->size_ < p->left_->right_->right_->size_)
+      {
+        pp = p->left_;
+      }
+      lr_rotation(p);
+      p = pp;
+    }
+    else
+    {
+      if (p->left_->size_ + p->right_->left_->size_ <= 2*p->right_->right_->size_)
+      {
+        rr_rotation(p);
+        return;
+      }
+      node_type* pp = p;
+      if (p->right_->left_->right_->size_ < p->right_->left_->left_->size_)
+      {
+        pp = p->right_;
+      }
+      rl_rotation(p);
+      p = pp;
+    }
+  }
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::ll_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  replace_child(p->parent_, p, q);
+  q->parent_ = p->parent_;
+  p->left_ = q->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = p;
+  p->parent_ = q;
+  update(p);
+  update(q);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::rr_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  replace_child(p->parent_, p, q);
+  q->parent_ = p->parent_;
+  p->right_ = q->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = p;
+  p->parent_ = q;
+  update(p);
+  update(q);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::lr_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  node_type *r = q->right_;
+  replace_child(p->parent_, p, r);
+  r->parent_ = p->parent_;
+  p->left_ = r->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = r->left_;
+  if (!is_sentinel(q->right_))
+  {
+    q->right_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->left_ = q;
+  r->right_ = p;
+  update(p);
+  update(q);
+  update(r);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::rl_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  node_type *r = q->left_;
+  replace_child(p->parent_, p, r);
+  r->parent_ = p->parent_;
+  p->right_ = r->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = r->right_;
+  if (!is_sentinel(q->left_))
+  {
+    q->left_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->right_ = q;
+  r->left_ = p;
+  update(p);
+  update(q);
+  update(r);
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::node_type* compressed_indexing_tree<T,A>::newblock()
+{
+  node_type* item = nodealloc_.allocate(1);
+  item->first_ = T();
+  item->count_ = 0;
+  item->bytes_ = 0;
+  item->size_ = 1;
+  item->length_ = 0;
+  item->left_ = sentinel_;
+  item->right_ = sentinel_;
+  return item;
+}
+
+// Links a detached block n in front of position (or at the back when
+// position is the sentinel), in the same way indexing_tree::insert does.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::link_before(node_type* position, node_type* n)
+{
+  node_type* m = position->prev_;
+  n->next_ = position;
+  n->prev_ = m;
+  position->prev_ = n;
+  m->next_ = n;
+  if (is_sentinel(sentinel_->left_))
+  {
+    sentinel_->left_ = n;
+    n->parent_ = sentinel_;
+    return;
+  }
+  if (!is_sentinel(position) && is_sentinel(position->left_))
+  {
+    position->left_ = n;
+    n->parent_ = position;
+    fix_up(position);
+  }
+  else
+  {
+    m->right_ = n;
+    n->parent_ = m;
+    fix_up(m);
+  }
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::unlink(node_type* del)
+{
+  node_type* pp = del->parent_;
+  node_type* l = del->left_;
+  node_type* r = del->right_;
+  del->prev_->next_ = del->next_;
+  del->next_->prev_ = del->prev_;
+  if (is_sentinel(l) || is_sentinel(r))
+  {
+    node_type* c = is_sentinel(l) ? r : l;
+    replace_child(pp, del, c);
+    if (!is_sentinel(c))
+    {
+      c->parent_ = pp;
+    }
+    fix_up(pp);
+    return;
+  }
+  node_type* n = del->next_;
+  node_type* start = n;
+  if (n != r)
+  {
+    start = n->parent_;
+    start->left_ = n->right_;
+    if (!is_sentinel(n->right_))
+    {
+      n->right_->parent_ = start;
+    }
+    n->right_ = r;
+    r->parent_ = n;
+  }
+  n->left_ = l;
+  l->parent_ = n;
+  n->parent_ = pp;
+  replace_child(pp, del, n);
+  fix_up(start);
+}
+
+// Encodes the n (at least one) values into block p, which is linked into
+// the tree, and into new blocks behind it when they do not fit. The split
+// points divide the encoded bytes evenly so that later edits find some room.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::store(node_type* p, const T* values, size_type n)
+{
+  size_type total = 0;
+  for (size_type i = 1; i < n; ++i)
+  {
+    total += code_size(zigzag(values[i - 1], values[i]));
+  }
+  size_type blocks = total / block_bytes + 1;
+  size_type target = (blocks == 1) ? block_bytes : (total + blocks - 1) / blocks;
+  size_type old_count = p->count_;
+  node_type* next = p->next_;
+  node_type* q = p;
+  size_type i = 0;
+  while (i < n)
+  {
+    if (q == 0)
+    {
+      q = newblock();
+    }
+    q->first_ = values[i++];
+    size_type bytes = 0;
+    size_type count = 1;
+    while (i < n)
+    {
+      code_type z = zigzag(values[i - 1], values[i]);
+      size_type len = code_size(z);
+      if (target < bytes + len)
+      {
+        break;
+      }
+      put(q->data_ + bytes, z);
+      bytes += len;
+      ++i;
+      ++count;
+    }
+    q->count_ = static_cast<unsigned short>(count);
+    q->bytes_ = static_cast<unsigned short>(bytes);
+    if (q == p)
+    {
+      if (old_count < count)
+      {
+        propagate(p, count - old_count, true);
+      }
+      else
+      {
+        propagate(p, old_count - count, false);
+      }
+    }
+    else
+    {
+      q->length_ = count;
+      link_before(next, q);
+    }
+    q = 0;
+  }
+}
+
+// Folds the following block into p when both fit in one block and either is
+// less than half full.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::merge_with_next(node_type* p)
+{
+  node_type* n = p->next_;
+  if (is_sentinel(p) || is_sentinel(n))
+  {
+    return;
+  }
+  if (block_bytes / 2 <= p->bytes_ && block_bytes / 2 <= n->bytes_)
+  {
+    return;
+  }
+  T last = p->first_;
+  code_type z;
+  for (size_type offset = 0; offset < p->bytes_; )
+  {
+    offset += get(p->data_ + offset, z);
+    last = unzigzag(last, z);
+  }
+  z = zigzag(last, n->first_);
+  size_type len = code_size(z);
+  if (block_bytes < p->bytes_ + len + n->bytes_)
+  {
+    return;
+  }
+  put(p->data_ + p->bytes_, z);
+  std::memcpy(p->data_ + p->bytes_ + len, n->data_, n->bytes_);
+  p->bytes_ = static_cast<unsigned short>(p->bytes_ + len + n->bytes_);
+  p->count_ = static_cast<unsigned short>(p->count_ + n->count_);
+  propagate(p, n->count_, true);
+  n->count_ = 0;
+  unlink(n);
+  nodealloc_.deallocate(n,1);
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::decode(const node_type* p, T* values)
+{
+  values[0] = p->first_;
+  size_type offset = 0;
+  for (size_type i = 1; i < p->count_; ++i)
+  {
+    code_type z;
+    offset += get(p->data_ + offset, z);
+    values[i] = unzigzag(values[i - 1], z);
+  }
+  return p->count_;
+}
+
+// The difference is taken modulo 2^64 and folded so that small steps down
+// get small codes as well: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::code_type compressed_indexing_tree<T,A>::zigzag(const T& from, const T& to)
+{
+  code_type d = static_cast<code_type>(to) - static_cast<code_type>(from);
+  return (d << 1) ^ (0 - (d >> 63));
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::unzigzag(const T& from, code_type z)
+{
+  return static_cast<T>(static_cast<code_type>(from) + ((z >> 1) ^ (0 - (z & 1))));
+}
+
+// Seven bits per byte, low bits first; the high bit marks a following byte.
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::put(unsigned char* s, code_type z)
+{
+  size_type n = 0;
+  while (0x80 <= z)
+  {
+    s[n++] = static_cast<unsigned char>(z | 0x80);
+    z >>= 7;
+  }
+  s[n++] = static_cast<unsigned char>(z);
+  return n;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::get(const unsigned char* s, code_type& z)
+{
+  if (s[0] < 0x80)
+  {
+    z = s[0];
+    return 1;
+  }
+  z = 0;
+  size_type n = 0;
+  unsigned shift = 0;
+  do
+  {
+    z |= static_cast<code_type>(s[n] & 0x7f) << shift;
+    shift += 7;
+  } while ((s[n++] & 0x80) != 0);
+  return n;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::code_size(code_type z)
+{
+  size_type n = 1;
+  while (0x80 <= z)
+  {
+    z >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::replace_child(node_type* parent, node_type* from, node_type* to)
+{
+  if (parent->left_ == from)
+  {
+    parent->left_ = to;
+  }
+  else
+  {
+    parent->right_ = to;
+  }
+}
+
+template<class T, class A>
+inline bool compressed_indexing_tree<T,A>::is_sentinel(node_type* p)
+{
+  return p->parent_ == p;
+}
+
+// public member functions
+template<class T, class A>
+compressed_indexing_tree<T,A>::compressed_indexing_tree(const A& alloc)
+  : sentinel_(0),alloc_(alloc),nodealloc_(alloc)
+{
+  init_sentinel_();
+}
+
+template<class T, class A>
+compressed_indexing_tree<T,A>::compressed_indexing_tree(size_type n, const T& x, const A& alloc)
+  : sentinel_(0),alloc_(alloc),nodealloc_(alloc)
+{
+  init_sentinel_();
+  try
+  {
+    for (size_type i = 0; i < n; ++i)
+    {
+      push_back(x);
+    }
+  }
+  catch (...)
+  {
+    clear();
+    nodealloc_.deallocate(sentinel_,1);
+    throw;
+  }
+}
+
+template<class T, class A>
+compressed_indexing_tree<T,A>::compressed_indexing_tree(const compressed_indexing_tree& that)
+  : sentinel_(0),alloc_(that.get_allocator()),nodealloc_(that.nodealloc_)
+{
+  init_sentinel_();
+  try
+  {
+    for (node_type* p = that.sentinel_->next_; p != that.sentinel_; p = p->next_)
+    {
+      node_type* q = newblock();
+      q->first_ = p->first_;
+      q->count_ = p->count_;
+      q->bytes_ = p->bytes_;
+      q->length_ = p->count_;
+      std::memcpy(q->data_, p->data_, p->bytes_);
+      link_before(sentinel_, q);
+    }
+  }
+  catch (...)
+  {
+    clear();
+    nodealloc_.deallocate(sentinel_,1);
+    throw;
+  }
+}
+
+template<class T, class A>
+compressed_indexing_tree<T,A>::~compressed_indexing_tree()
+{
+  clear();
+  nodealloc_.deallocate(sentinel_,1);
+}
+
+template<class T, class A>
+compressed_indexing_tree<T,A>& compressed_indexing_tree<T,A>::operator=(const compressed_indexing_tree& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  compressed_indexing_tree tmp(that);
+  swap(tmp);
+  return *this;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::allocator_type compressed_indexing_tree<T,A>::get_allocator() const
+{
+  return alloc_;
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator compressed_indexing_tree<T,A>::begin() const
+{
+  return const_iterator(sentinel_->next_, 0);
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::const_iterator compressed_indexing_tree<T,A>::end() const
+{
+  return const_iterator(sentinel_, 0);
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::size() const
+{
+  return sentinel_->left_->length_;
+}
+
+template<class T, class A>
+inline bool compressed_indexing_tree<T,A>::empty() const
+{
+  return (sentinel_->left_->length_ == 0);
+}
+
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::block_count() const
+{
+  return sentinel_->left_->size_;
+}
+
+// Bytes taken by the blocks and the sentinel, not counting allocator overhead.
+template<class T, class A>
+inline typename compressed_indexing_tree<T,A>::size_type compressed_indexing_tree<T,A>::memory_usage() const
+{
+  return (sentinel_->left_->size_ + 1) * sizeof(node_type);
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::operator[](size_type n) const
+{
+  range_check_leq(n);
+  node_type* p = locate(n);
+  return *const_iterator(p, n);
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::at(size_type n) const
+{
+  range_check_leq(n);
+  node_type* p = locate(n);
+  return *const_iterator(p, n);
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::front() const
+{
+  range_check_leq(0);
+  return sentinel_->next_->first_;
+}
+
+template<class T, class A>
+inline T compressed_indexing_tree<T,A>::back() const
+{
+  range_check_leq(0);
+  return *const_iterator(sentinel_->prev_, sentinel_->prev_->count_ - 1);
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::set(size_type n, const T& x)
+{
+  range_check_leq(n);
+  node_type* p = locate(n);
+  T values[buffer_capacity];
+  size_type count = decode(p, values);
+  values[n] = x;
+  store(p, values, count);
+}
+
+// Appends the code of x to the last block when it fits; only the element
+// counts on the path to the root change then.
+template<class T, class A>
+void compressed_indexing_tree<T,A>::push_back(const T& x)
+{
+  node_type* p = sentinel_->prev_;
+  if (!is_sentinel(p))
+  {
+    code_type z = zigzag(*const_iterator(p, p->count_ - 1), x);
+    size_type len = code_size(z);
+    if (p->bytes_ + len <= block_bytes)
+    {
+      put(p->data_ + p->bytes_, z);
+      p->bytes_ = static_cast<unsigned short>(p->bytes_ + len);
+      ++p->count_;
+      propagate(p, 1, true);
+      return;
+    }
+  }
+  node_type* q = newblock();
+  q->first_ = x;
+  q->count_ = 1;
+  q->length_ = 1;
+  link_before(sentinel_, q);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::push_front(const T& x)
+{
+  insert(0, x);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::pop_back()
+{
+  range_check_leq(0);
+  erase(size() - 1);
+}
+
+template<class T, class A>
+inline void compressed_indexing_tree<T,A>::pop_front()
+{
+  range_check_leq(0);
+  erase(0);
+}
+
+template<class T, class A>
+template<class InputIterator>
+void compressed_indexing_tree<T,A>::append(InputIterator first, InputIterator last)
+{
+  for (; first != last; ++first)
+  {
+    push_back(*first);
+  }
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::insert(size_type pos, const T& x)
+{
+  range_check_lt(pos);
+  if (pos == size())
+  {
+    push_back(x);
+    return;
+  }
+  node_type* p = locate_for_insert(pos);
+  T values[buffer_capacity];
+  size_type count = decode(p, values);
+  std::memmove(values + pos + 1, values + pos, (count - pos) * sizeof(T));
+  values[pos] = x;
+  store(p, values, count + 1);
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::erase(size_type pos, size_type len)
+{
+  range_check_lt(pos);
+  if (size() - pos < len)
+  {
+    len = size() - pos;
+  }
+  if (len == 0)
+  {
+    return;
+  }
+  size_type off = pos;
+  node_type* p = locate(off);
+  node_type* first = (off != 0) ? p : p->prev_;
+  while (len != 0)
+  {
+    node_type* next = p->next_;
+    size_type n = p->count_ - off;
+    if (len < n)
+    {
+      n = len;
+    }
+    if (n == p->count_)
+    {
+      unlink(p);
+      nodealloc_.deallocate(p,1);
+    }
+    else
+    {
+      T values[buffer_capacity];
+      size_type count = decode(p, values);
+      std::memmove(values + off, values + off + n, (count - off - n) * sizeof(T));
+      store(p, values, count - n);
+    }
+    len -= n;
+    off = 0;
+    p = next;
+  }
+  if (!is_sentinel(first))
+  {
+    merge_with_next(first);
+  }
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::swap(compressed_indexing_tree& that) throw()
+{
+  node_type* p = sentinel_;
+  sentinel_ = that.sentinel_;
+  that.sentinel_ = p;
+}
+
+template<class T, class A>
+void compressed_indexing_tree<T,A>::clear()
+{
+  node_type* p = sentinel_->next_;
+  while (p != sentinel_)
+  {
+    node_type* next = p->next_;
+    nodealloc_.deallocate(p,1);
+    p = next;
+  }
+  sentinel_->left_ = sentinel_;
+  sentinel_->right_ = sentinel_;
+  sentinel_->next_ = sentinel_;
+  sentinel_->prev_ = sentinel_;
+}
+
+} // end of namespace osoken
+
+#endif // COMPRESSED_INDEXING_TREE_HPP_
@@ -0,0 +1,263 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef HUGEPAGE_ALLOCATOR_HPP_
+#define HUGEPAGE_ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena_allocator.hpp"
+#include "indexing_tree.hpp"
+
+#if INDEXING_TREE_HAS_THREADS
+#  include <mutex>
+#endif
+
+namespace osoken
+{
+
+// Storage for small fixed-size blocks, such as tree nodes, carved from
+// large anonymous mappings (POSIX only). Every region is aligned to and a
+// multiple of 2 MiB and advised with MADV_HUGEPAGE where the system has
+// it, so that transparent huge pages can back it and a descent through a
+// large tree misses the TLB far less often; without them the region
+// simply stays on normal pages. Blocks of up to max_block bytes come from
+// a block_pool; freed blocks are reused but regions are only unmapped by
+// the destructor, so the arena must outlive everything allocated from it.
+// stats() reports how much of the arena the kernel backs with huge pages.
+class hugepage_arena
+{
+public:
+  struct statistics
+  {
+    std::size_t regions_;
+    std::size_t mapped_bytes_;
+    std::size_t used_bytes_;
+    std::size_t advised_bytes_;
+    std::size_t huge_bytes_;
+  };
+
+  static const std::size_t huge_page_size = 2 << 20;
+  static const std::size_t max_block = block_pool::max_block;
+
+  explicit hugepage_arena(std::size_t region_size = 32 << 20);
+  ~hugepage_arena();
+
+  void* allocate(std::size_t size);
+  void deallocate(void* p, std::size_t size);
+  statistics stats() const;
+
+  // the arena of default-constructed allocators; never destroyed
+  static hugepage_arena& instance();
+private:
+  hugepage_arena(const hugepage_arena&);
+  hugepage_arena& operator = (const hugepage_arena&);
+
+  std::size_t region_size_;
+  std::vector<char*> regions_;
+  block_pool pool_;
+  std::size_t advised_;
+#if INDEXING_TREE_HAS_THREADS
+  mutable std::mutex lock_;
+#endif
+
+  void grow();
+};
+
+// arena_allocator over a hugepage_arena; default-constructed allocators
+// share hugepage_arena::instance().
+template<class T>
+class hugepage_allocator : public arena_allocator<T, hugepage_arena>
+{
+public:
+  template<class U>
+  struct rebind
+  {
+    typedef hugepage_allocator<U> other;
+  };
+
+  hugepage_allocator() throw();
+  explicit hugepage_allocator(hugepage_arena& arena) throw();
+  template<class U>
+  hugepage_allocator(const hugepage_allocator<U>& that) throw();
+};
+
+//////////////////
+// hugepage_arena
+//////////////////
+inline hugepage_arena::hugepage_arena(std::size_t region_size)
+  : region_size_((region_size + huge_page_size - 1) / huge_page_size * huge_page_size),regions_(),pool_(),advised_(0)
+{
+  if (region_size_ == 0)
+  {
+    region_size_ = huge_page_size;
+  }
+}
+
+inline hugepage_arena::~hugepage_arena()
+{
+  for (std::size_t i = 0; i < regions_.size(); ++i)
+  {
+    ::munmap(regions_[i], region_size_);
+  }
+}
+
+inline hugepage_arena& hugepage_arena::instance()
+{
+  static hugepage_arena* arena = new hugepage_arena();
+  return *arena;
+}
+
+// Maps a new region aligned to huge_page_size: maps one huge page more than
+// needed and unmaps the misaligned ends.
+inline void hugepage_arena::grow()
+{
+  regions_.reserve(regions_.size() + 1);
+  std::size_t length = region_size_ + huge_page_size;
+  void* m = ::mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED)
+  {
+    throw std::bad_alloc();
+  }
+  char* raw = static_cast<char*>(m);
+  std::size_t head = (huge_page_size - reinterpret_cast<std::size_t>(raw) % huge_page_size) % huge_page_size;
+  if (head != 0)
+  {
+    ::munmap(raw, head);
+  }
+  ::munmap(raw + head + region_size_, huge_page_size - head);
+  char* region = raw + head;
+#ifdef MADV_HUGEPAGE
+  if (::madvise(region, region_size_, MADV_HUGEPAGE) == 0)
+  {
+    advised_ += region_size_;
+  }
+#endif
+  regions_.push_back(region);
+  pool_.refill(region, region + region_size_);
+}
+
+inline void* hugepage_arena::allocate(std::size_t size)
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  void* p = pool_.allocate(size);
+  if (p == 0)
+  {
+    grow();
+    p = pool_.allocate(size);
+  }
+  return p;
+}
+
+inline void hugepage_arena::deallocate(void* p, std::size_t size)
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  pool_.deallocate(p, size);
+}
+
+// huge_bytes_ sums AnonHugePages of the mappings in /proc/self/smaps that
+// lie within the regions; it stays 0 where that file does not exist.
+inline hugepage_arena::statistics hugepage_arena::stats() const
+{
+  statistics s;
+  std::vector<char*> regions;
+  {
+#if INDEXING_TREE_HAS_THREADS
+    std::lock_guard<std::mutex> guard(lock_);
+#endif
+    s.regions_ = regions_.size();
+    s.mapped_bytes_ = regions_.size() * region_size_;
+    s.used_bytes_ = pool_.used();
+    s.advised_bytes_ = advised_;
+    regions = regions_;
+  }
+  s.huge_bytes_ = 0;
+  std::FILE* f = std::fopen("/proc/self/smaps", "r");
+  if (f == 0)
+  {
+    return s;
+  }
+  char line[512];
+  bool inside = false;
+  while (std::fgets(line, sizeof(line), f) != 0)
+  {
+    unsigned long first;
+    unsigned long last;
+    unsigned long kb;
+    if (std::sscanf(line, "%lx-%lx ", &first, &last) == 2)
+    {
+      inside = false;
+      for (std::size_t i = 0; i < regions.size(); ++i)
+      {
+        unsigned long begin = reinterpret_cast<unsigned long>(regions[i]);
+        if (begin <= first && last <= begin + region_size_)
+        {
+          inside = true;
+          break;
+        }
+      }
+    }
+    else if (inside && std::sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+    {
+      s.huge_bytes_ += static_cast<std::size_t>(kb) * 1024;
+    }
+  }
+  std::fclose(f);
+  return s;
+}
+
+//////////////////
+// hugepage_allocator
+//////////////////
+template<class T>
+inline hugepage_allocator<T>::hugepage_allocator() throw()
+{
+}
+
+template<class T>
+inline hugepage_allocator<T>::hugepage_allocator(hugepage_arena& arena) throw()
+  : arena_allocator<T, hugepage_arena>(arena)
+{
+}
+
+template<class T>
+template<class U>
+inline hugepage_allocator<T>::hugepage_allocator(const hugepage_allocator<U>& that) throw()
+  : arena_allocator<T, hugepage_arena>(that)
+{
+}
+
+} // end of namespace osoken
+
+#endif // HUGEPAGE_ALLOCATOR_HPP_
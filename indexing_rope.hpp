@@ -0,0 +1,1099 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+#ifndef INDEXING_ROPE_HPP_
+#define INDEXING_ROPE_HPP_
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace osoken
+{
+
+// Text buffer variant of indexing_tree<char>.
+// Each node holds a run of up to run_capacity characters, and every subtree
+// keeps its character count and its '\n' count so that offsets and
+// line/column positions are both reachable in O(log n).
+// The tree is weight-balanced on the number of runs, like indexing_tree.
+template<class Alloc = ::std::allocator<char> >
+class indexing_rope
+{
+public:
+  typedef char value_type;
+  typedef Alloc allocator_type;
+  typedef const char& const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  static const size_type run_capacity = 64;
+  static const size_type npos = static_cast<size_type>(-1);
+private:
+  struct node
+  {
+    node *next_, *prev_, *left_, *right_, *parent_;
+    size_type size_;
+    size_type length_;
+    size_type lines_;
+    size_type run_length_;
+    size_type run_lines_;
+    char run_[run_capacity];
+  };
+  typedef node node_type;
+  typedef typename allocator_type::template rebind< node_type >::other node_allocator_type;
+public:
+  class const_span_iterator
+  {
+  public:
+    const_span_iterator(const const_span_iterator& i);
+    const_span_iterator();
+    const_span_iterator& operator++();
+    const_span_iterator operator++(int);
+    const_span_iterator& operator--();
+    const_span_iterator operator--(int);
+    bool operator == (const const_span_iterator& i) const;
+    bool operator != (const const_span_iterator& i) const;
+    const char* data() const;
+    size_type size() const;
+  private:
+    const_span_iterator(node_type* node);
+
+    node_type* node_;
+
+    friend class indexing_rope;
+  };
+  friend class const_span_iterator;
+
+  explicit indexing_rope(const Alloc& alloc = Alloc());
+  indexing_rope(const char* s, size_type n, const Alloc& alloc = Alloc());
+  explicit indexing_rope(const std::string& s, const Alloc& alloc = Alloc());
+  indexing_rope(const indexing_rope& that);
+  ~indexing_rope();
+
+  indexing_rope& operator = (const indexing_rope& that);
+  Alloc get_allocator() const;
+
+  const_span_iterator span_begin() const;
+  const_span_iterator span_end() const;
+  template<class Function>
+  Function for_each_span(size_type pos, size_type len, Function f) const;
+
+  size_type size() const;
+  size_type length() const;
+  bool empty() const;
+
+  const_reference operator [] (size_type n) const;
+  const_reference at(size_type n) const;
+
+  std::string substr(size_type pos = 0, size_type len = npos) const;
+  size_type copy(char* dest, size_type len, size_type pos = 0) const;
+  std::string str() const;
+
+  size_type line_count() const;
+  size_type line_of(size_type pos) const;
+  size_type column_of(size_type pos) const;
+  size_type offset_of(size_type line, size_type column = 0) const;
+
+  void push_back(char c);
+  void append(const char* s, size_type n);
+  void append(const std::string& s);
+  void insert(size_type pos, const char* s, size_type n);
+  void insert(size_type pos, const std::string& s);
+  void erase(size_type pos = 0, size_type len = npos);
+  void swap(indexing_rope& that) throw();
+
+  void clear();
+private:
+  node_type* sentinel_;
+  allocator_type alloc_;
+  node_allocator_type nodealloc_;
+
+  void init_sentinel_();
+  node_type* locate(size_type& pos) const;
+  node_type* locate_for_insert(size_type& pos) const;
+  void range_check_lt(size_type n) const;
+  void range_check_leq(size_type n) const;
+  static void update(node_type* p);
+  void propagate(node_type* p, size_type length, size_type lines, bool incr);
+  void fix_up(node_type* p);
+  bool is_balanced(node_type* p) const;
+  void rebalance(node_type* p);
+  void ll_rotation(node_type* p);
+  void rr_rotation(node_type* p);
+  void lr_rotation(node_type* p);
+  void rl_rotation(node_type* p);
+  node_type* newrun(const char* s, size_type n);
+  void link_before(node_type* position, node_type* n);
+  void unlink(node_type* p);
+  void insert_runs_before(node_type* position, const char* s, size_type n, const char* t, size_type m);
+  void merge_with_next(node_type* p);
+  static void replace_child(node_type* parent, node_type* from, node_type* to);
+  static size_type count_lines(const char* s, size_type n);
+  static bool is_sentinel(node_type* p);
+};
+
+template<class A>
+const typename indexing_rope<A>::size_type indexing_rope<A>::run_capacity;
+
+template<class A>
+const typename indexing_rope<A>::size_type indexing_rope<A>::npos;
+
+//////////////////
+// const_span_iterator
+//////////////////
+template<class A>
+inline indexing_rope<A>::const_span_iterator::const_span_iterator(const const_span_iterator& i):
+node_(i.node_)
+{
+}
+
+template<class A>
+inline indexing_rope<A>::const_span_iterator::const_span_iterator():
+node_(0)
+{
+}
+
+template<class A>
+inline indexing_rope<A>::const_span_iterator::const_span_iterator(node_type* node):
+node_(node)
+{
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator& indexing_rope<A>::const_span_iterator::operator++()
+{
+  node_ = node_->next_;
+  return *this;
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator indexing_rope<A>::const_span_iterator::operator++(int)
+{
+  const_span_iterator tmp = *this;
+  operator++();
+  return tmp;
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator& indexing_rope<A>::const_span_iterator::operator--()
+{
+  node_ = node_->prev_;
+  return *this;
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator indexing_rope<A>::const_span_iterator::operator--(int)
+{
+  const_span_iterator tmp = *this;
+  operator--();
+  return tmp;
+}
+
+template<class A>
+inline bool indexing_rope<A>::const_span_iterator::operator == (const const_span_iterator& i) const
+{
+  return node_ == i.node_;
+}
+
+template<class A>
+inline bool indexing_rope<A>::const_span_iterator::operator != (const const_span_iterator& i) const
+{
+  return node_ != i.node_;
+}
+
+template<class A>
+inline const char* indexing_rope<A>::const_span_iterator::data() const
+{
+  return node_->run_;
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::const_span_iterator::size() const
+{
+  return node_->run_length_;
+}
+
+//////////////////
+// indexing_rope
+//////////////////
+// private member functions
+template<class A>
+inline void indexing_rope<A>::init_sentinel_()
+{
+  sentinel_ = nodealloc_.allocate(1);
+  sentinel_->left_ = sentinel_;
+  sentinel_->next_ = sentinel_;
+  sentinel_->parent_ = sentinel_;
+  sentinel_->prev_ = sentinel_;
+  sentinel_->right_ = sentinel_;
+  sentinel_->size_ = 0;
+  sentinel_->length_ = 0;
+  sentinel_->lines_ = 0;
+  sentinel_->run_length_ = 0;
+  sentinel_->run_lines_ = 0;
+}
+
+// Returns the run holding the character at pos and makes pos an offset into it.
+template<class A>
+typename indexing_rope<A>::node_type* indexing_rope<A>::locate(size_type& pos) const
+{
+  node_type* p = sentinel_->left_;
+  while (!is_sentinel(p))
+  {
+    if (pos < p->left_->length_)
+    {
+      p = p->left_;
+      continue;
+    }
+    pos -= p->left_->length_;
+    if (pos < p->run_length_)
+    {
+      return p;
+    }
+    pos -= p->run_length_;
+    p = p->right_;
+  }
+  return p;
+}
+
+// Like locate, but a position on a run boundary resolves to the end of the
+// run on its left so that short runs are filled up before new ones are made.
+template<class A>
+typename indexing_rope<A>::node_type* indexing_rope<A>::locate_for_insert(size_type& pos) const
+{
+  node_type* p = sentinel_->left_;
+  while (!is_sentinel(p))
+  {
+    if (pos <= p->left_->length_ && !is_sentinel(p->left_))
+    {
+      p = p->left_;
+      continue;
+    }
+    pos -= p->left_->length_;
+    if (pos <= p->run_length_)
+    {
+      return p;
+    }
+    pos -= p->run_length_;
+    p = p->right_;
+  }
+  return p;
+}
+
+template<class A>
+inline void indexing_rope<A>::range_check_lt(size_type n) const
+{
+  if ( sentinel_->left_->length_ < n )
+  {
+    throw std::out_of_range("indexing_rope::out_of_range");
+  }
+}
+
+template<class A>
+inline void indexing_rope<A>::range_check_leq(size_type n) const
+{
+  if ( sentinel_->left_->length_ <= n )
+  {
+    throw std::out_of_range("indexing_rope::out_of_range");
+  }
+}
+
+template<class A>
+inline void indexing_rope<A>::update(node_type* p)
+{
+  p->size_ = p->left_->size_ + p->right_->size_ + 1;
+  p->length_ = p->left_->length_ + p->right_->length_ + p->run_length_;
+  p->lines_ = p->left_->lines_ + p->right_->lines_ + p->run_lines_;
+}
+
+// Carries a change of run contents up to the root. The shape of the tree does
+// not change, so no rebalancing is needed.
+template<class A>
+void indexing_rope<A>::propagate(node_type* p, size_type length, size_type lines, bool incr)
+{
+  while (!is_sentinel(p))
+  {
+    if (incr)
+    {
+      p->length_ += length;
+      p->lines_ += lines;
+    }
+    else
+    {
+      p->length_ -= length;
+      p->lines_ -= lines;
+    }
+    p = p->parent_;
+  }
+}
+
+template<class A>
+void indexing_rope<A>::fix_up(node_type* p)
+{
+  while (!is_sentinel(p))
+  {
+    node_type *parent = p->parent_;
+    update(p);
+    rebalance(p);
+    p = parent;
+  }
+}
+
+template<class A>
+inline bool indexing_rope<A>::is_balanced(node_type* p) const
+{
+  if (p->left_->size_ < p->right_->size_)
+  {
+    return ( (p->right_->size_ - p->left_->size_) <= (p->left_->size_ + 1) );
+  }
+  return ( (p->left_->size_ - p->right_->size_) <= (p->right_->size_ + 1) );
+}
+
+template<class A>
+void indexing_rope<A>::rebalance(node_type* p)
+{
+  while (!is_balanced(p))
+  {
+    if (p->right_->size_ < p->left_->size_)
+    {
+      if (p->right_->size_ + p->left_->right_->size_ <= 2*p->left_->left_->size_)
+      {
+        ll_rotation(p);
+        return;
+      }
+      node_type* pp = p;
+      if (p->left_->right_->left_->size_ < p->left_->right_->right_->size_)
+      {
+        pp = p->left_;
+      }
+      lr_rotation(p);
+      p = pp;
+    }
+    else
+    {
+      if (p->left_->size_ + p->right_->left_->size_ <= 2*p->right_->right_->size_)
+      {
+        rr_rotation(p);
+        return;
+      }
+      node_type* pp = p;
+      if (p->right_->left_->right_->size_ < p->right_->left_->left_->size_)
+      {
+        pp = p->right_;
+      }
+      rl_rotation(p);
+      p = pp;
+    }
+  }
+}
+
+template<class A>
+inline void indexing_rope<A>::ll_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  replace_child(p->parent_, p, q);
+  q->parent_ = p->parent_;
+  p->left_ = q->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = p;
+  p->parent_ = q;
+  update(p);
+  update(q);
+}
+
+template<class A>
+inline void indexing_rope<A>::rr_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  replace_child(p->parent_, p, q);
+  q->parent_ = p->parent_;
+  p->right_ = q->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = p;
+  p->parent_ = q;
+  update(p);
+  update(q);
+}
+
+template<class A>
+inline void indexing_rope<A>::lr_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  node_type *r = q->right_;
+  replace_child(p->parent_, p, r);
+  r->parent_ = p->parent_;
+  p->left_ = r->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = r->left_;
+  if (!is_sentinel(q->right_))
+  {
+    q->right_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->left_ = q;
+  r->right_ = p;
+  update(p);
+  update(q);
+  update(r);
+}
+
+template<class A>
+inline void indexing_rope<A>::rl_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  node_type *r = q->left_;
+  replace_child(p->parent_, p, r);
+  r->parent_ = p->parent_;
+  p->right_ = r->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = r->right_;
+  if (!is_sentinel(q->left_))
+  {
+    q->left_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->right_ = q;
+  r->left_ = p;
+  update(p);
+  update(q);
+  update(r);
+}
+
+template<class A>
+inline typename indexing_rope<A>::node_type* indexing_rope<A>::newrun(const char* s, size_type n)
+{
+  node_type* item = nodealloc_.allocate(1);
+  std::memcpy(item->run_, s, n);
+  item->run_length_ = n;
+  item->run_lines_ = count_lines(s, n);
+  item->size_ = 1;
+  item->length_ = n;
+  item->lines_ = item->run_lines_;
+  item->left_ = sentinel_;
+  item->right_ = sentinel_;
+  return item;
+}
+
+// Links a detached run n in front of position (or at the back when position
+// is the sentinel), in the same way indexing_tree::insert does.
+template<class A>
+void indexing_rope<A>::link_before(node_type* position, node_type* n)
+{
+  node_type* m = position->prev_;
+  n->next_ = position;
+  n->prev_ = m;
+  position->prev_ = n;
+  m->next_ = n;
+  if (is_sentinel(sentinel_->left_))
+  {
+    sentinel_->left_ = n;
+    n->parent_ = sentinel_;
+    return;
+  }
+  if (!is_sentinel(position) && is_sentinel(position->left_))
+  {
+    position->left_ = n;
+    n->parent_ = position;
+    fix_up(position);
+  }
+  else
+  {
+    m->right_ = n;
+    n->parent_ = m;
+    fix_up(m);
+  }
+}
+
+template<class A>
+void indexing_rope<A>::unlink(node_type* del)
+{
+  node_type* pp = del->parent_;
+  node_type* l = del->left_;
+  node_type* r = del->right_;
+  del->prev_->next_ = del->next_;
+  del->next_->prev_ = del->prev_;
+  if (is_sentinel(l) || is_sentinel(r))
+  {
+    node_type* c = is_sentinel(l) ? r : l;
+    replace_child(pp, del, c);
+    if (!is_sentinel(c))
+    {
+      c->parent_ = pp;
+    }
+    fix_up(pp);
+    return;
+  }
+  node_type* n = del->next_;
+  node_type* start = n;
+  if (n != r)
+  {
+    start = n->parent_;
+    start->left_ = n->right_;
+    if (!is_sentinel(n->right_))
+    {
+      n->right_->parent_ = start;
+    }
+    n->right_ = r;
+    r->parent_ = n;
+  }
+  n->left_ = l;
+  l->parent_ = n;
+  n->parent_ = pp;
+  replace_child(pp, del, n);
+  fix_up(start);
+}
+
+// Inserts the characters of s followed by those of t as new runs in front of
+// position. The runs are filled evenly so that later edits find some room.
+template<class A>
+void indexing_rope<A>::insert_runs_before(node_type* position, const char* s, size_type n, const char* t, size_type m)
+{
+  size_type total = n + m;
+  size_type runs = (total + run_capacity - 1) / run_capacity;
+  char buf[run_capacity];
+  while (runs != 0)
+  {
+    size_type len = (total + runs - 1) / runs;
+    size_type from_s = (len < n) ? len : n;
+    std::memcpy(buf, s, from_s);
+    s += from_s;
+    n -= from_s;
+    if (from_s < len)
+    {
+      std::memcpy(buf + from_s, t, len - from_s);
+      t += len - from_s;
+      m -= len - from_s;
+    }
+    link_before(position, newrun(buf, len));
+    total -= len;
+    --runs;
+  }
+}
+
+// Folds the following run into p when both fit in one run.
+template<class A>
+void indexing_rope<A>::merge_with_next(node_type* p)
+{
+  node_type* n = p->next_;
+  if (is_sentinel(p) || is_sentinel(n) || run_capacity < p->run_length_ + n->run_length_)
+  {
+    return;
+  }
+  if (run_capacity / 2 <= p->run_length_ && run_capacity / 2 <= n->run_length_)
+  {
+    return;
+  }
+  std::memcpy(p->run_ + p->run_length_, n->run_, n->run_length_);
+  p->run_length_ += n->run_length_;
+  p->run_lines_ += n->run_lines_;
+  propagate(p, n->run_length_, n->run_lines_, true);
+  n->run_length_ = 0;
+  n->run_lines_ = 0;
+  unlink(n);
+  nodealloc_.deallocate(n,1);
+}
+
+template<class A>
+inline void indexing_rope<A>::replace_child(node_type* parent, node_type* from, node_type* to)
+{
+  if (parent->left_ == from)
+  {
+    parent->left_ = to;
+  }
+  else
+  {
+    parent->right_ = to;
+  }
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::count_lines(const char* s, size_type n)
+{
+  size_type ret = 0;
+  const char* last = s + n;
+  while ((s = static_cast<const char*>(std::memchr(s, '\n', last - s))) != 0)
+  {
+    ++ret;
+    ++s;
+  }
+  return ret;
+}
+
+template<class A>
+inline bool indexing_rope<A>::is_sentinel(node_type* p)
+{
+  return p->parent_ == p;
+}
+
+// public member functions
+template<class A>
+indexing_rope<A>::indexing_rope(const A& alloc)
+  : sentinel_(0),alloc_(alloc),nodealloc_(node_allocator_type())
+{
+  init_sentinel_();
+}
+
+template<class A>
+indexing_rope<A>::indexing_rope(const char* s, size_type n, const A& alloc)
+  : sentinel_(0),alloc_(alloc),nodealloc_(node_allocator_type())
+{
+  init_sentinel_();
+  try
+  {
+    append(s, n);
+  }
+  catch (...)
+  {
+    clear();
+    nodealloc_.deallocate(sentinel_,1);
+    throw;
+  }
+}
+
+template<class A>
+indexing_rope<A>::indexing_rope(const std::string& s, const A& alloc)
+  : sentinel_(0),alloc_(alloc),nodealloc_(node_allocator_type())
+{
+  init_sentinel_();
+  try
+  {
+    append(s);
+  }
+  catch (...)
+  {
+    clear();
+    nodealloc_.deallocate(sentinel_,1);
+    throw;
+  }
+}
+
+template<class A>
+indexing_rope<A>::indexing_rope(const indexing_rope& that)
+  : sentinel_(0),alloc_(that.get_allocator()),nodealloc_(node_allocator_type())
+{
+  init_sentinel_();
+  try
+  {
+    for (const_span_iterator it = that.span_begin(); it != that.span_end(); ++it)
+    {
+      link_before(sentinel_, newrun(it.data(), it.size()));
+    }
+  }
+  catch (...)
+  {
+    clear();
+    nodealloc_.deallocate(sentinel_,1);
+    throw;
+  }
+}
+
+template<class A>
+indexing_rope<A>::~indexing_rope()
+{
+  clear();
+  nodealloc_.deallocate(sentinel_,1);
+}
+
+template<class A>
+indexing_rope<A>& indexing_rope<A>::operator=(const indexing_rope& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  indexing_rope tmp(that);
+  swap(tmp);
+  return *this;
+}
+
+template<class A>
+inline typename indexing_rope<A>::allocator_type indexing_rope<A>::get_allocator() const
+{
+  return alloc_;
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator indexing_rope<A>::span_begin() const
+{
+  return const_span_iterator(sentinel_->next_);
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_span_iterator indexing_rope<A>::span_end() const
+{
+  return const_span_iterator(sentinel_);
+}
+
+// Calls f(const char* data, size_type n) for every piece of [pos, pos+len)
+// without copying the characters.
+template<class A>
+template<class Function>
+Function indexing_rope<A>::for_each_span(size_type pos, size_type len, Function f) const
+{
+  range_check_lt(pos);
+  if (size() - pos < len)
+  {
+    len = size() - pos;
+  }
+  if (len == 0)
+  {
+    return f;
+  }
+  size_type off = pos;
+  node_type* p = locate(off);
+  while (len != 0)
+  {
+    size_type n = p->run_length_ - off;
+    if (len < n)
+    {
+      n = len;
+    }
+    f(p->run_ + off, n);
+    len -= n;
+    off = 0;
+    p = p->next_;
+  }
+  return f;
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::size() const
+{
+  return sentinel_->left_->length_;
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::length() const
+{
+  return sentinel_->left_->length_;
+}
+
+template<class A>
+inline bool indexing_rope<A>::empty() const
+{
+  return (sentinel_->left_->length_ == 0);
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_reference indexing_rope<A>::operator[](size_type n) const
+{
+  range_check_leq(n);
+  node_type* p = locate(n);
+  return p->run_[n];
+}
+
+template<class A>
+inline typename indexing_rope<A>::const_reference indexing_rope<A>::at(size_type n) const
+{
+  range_check_leq(n);
+  node_type* p = locate(n);
+  return p->run_[n];
+}
+
+template<class A>
+std::string indexing_rope<A>::substr(size_type pos, size_type len) const
+{
+  range_check_lt(pos);
+  if (size() - pos < len)
+  {
+    len = size() - pos;
+  }
+  std::string ret(len, '\0');
+  if (len != 0)
+  {
+    copy(&ret[0], len, pos);
+  }
+  return ret;
+}
+
+template<class A>
+typename indexing_rope<A>::size_type indexing_rope<A>::copy(char* dest, size_type len, size_type pos) const
+{
+  range_check_lt(pos);
+  if (size() - pos < len)
+  {
+    len = size() - pos;
+  }
+  size_type rest = len;
+  size_type off = pos;
+  node_type* p = (len == 0) ? sentinel_ : locate(off);
+  while (rest != 0)
+  {
+    size_type n = p->run_length_ - off;
+    if (rest < n)
+    {
+      n = rest;
+    }
+    std::memcpy(dest, p->run_ + off, n);
+    dest += n;
+    rest -= n;
+    off = 0;
+    p = p->next_;
+  }
+  return len;
+}
+
+template<class A>
+inline std::string indexing_rope<A>::str() const
+{
+  return substr(0, npos);
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::line_count() const
+{
+  return sentinel_->left_->lines_ + 1;
+}
+
+// Number of '\n' in front of pos, i.e. the zero-based line holding pos.
+template<class A>
+typename indexing_rope<A>::size_type indexing_rope<A>::line_of(size_type pos) const
+{
+  range_check_lt(pos);
+  size_type ret = 0;
+  node_type* p = sentinel_->left_;
+  while (!is_sentinel(p))
+  {
+    if (pos < p->left_->length_)
+    {
+      p = p->left_;
+      continue;
+    }
+    ret += p->left_->lines_;
+    pos -= p->left_->length_;
+    if (pos < p->run_length_)
+    {
+      return ret + count_lines(p->run_, pos);
+    }
+    ret += p->run_lines_;
+    pos -= p->run_length_;
+    p = p->right_;
+  }
+  return ret;
+}
+
+template<class A>
+inline typename indexing_rope<A>::size_type indexing_rope<A>::column_of(size_type pos) const
+{
+  return pos - offset_of(line_of(pos));
+}
+
+template<class A>
+typename indexing_rope<A>::size_type indexing_rope<A>::offset_of(size_type line, size_type column) const
+{
+  if (sentinel_->left_->lines_ < line)
+  {
+    throw std::out_of_range("indexing_rope::out_of_range");
+  }
+  size_type ret = 0;
+  node_type* p = sentinel_->left_;
+  while (line != 0)
+  {
+    if (line <= p->left_->lines_)
+    {
+      p = p->left_;
+      continue;
+    }
+    line -= p->left_->lines_;
+    ret += p->left_->length_;
+    if (line <= p->run_lines_)
+    {
+      const char* s = p->run_;
+      while (true)
+      {
+        s = static_cast<const char*>(std::memchr(s, '\n', p->run_ + p->run_length_ - s)) + 1;
+        if (--line == 0)
+        {
+          break;
+        }
+      }
+      ret += s - p->run_;
+      break;
+    }
+    line -= p->run_lines_;
+    ret += p->run_length_;
+    p = p->right_;
+  }
+  range_check_lt(ret + column);
+  return ret + column;
+}
+
+template<class A>
+inline void indexing_rope<A>::push_back(char c)
+{
+  append(&c, 1);
+}
+
+template<class A>
+inline void indexing_rope<A>::append(const char* s, size_type n)
+{
+  insert(size(), s, n);
+}
+
+template<class A>
+inline void indexing_rope<A>::append(const std::string& s)
+{
+  insert(size(), s.data(), s.size());
+}
+
+template<class A>
+inline void indexing_rope<A>::insert(size_type pos, const std::string& s)
+{
+  insert(pos, s.data(), s.size());
+}
+
+template<class A>
+void indexing_rope<A>::insert(size_type pos, const char* s, size_type n)
+{
+  range_check_lt(pos);
+  if (n == 0)
+  {
+    return;
+  }
+  node_type* p = locate_for_insert(pos);
+  if (is_sentinel(p))
+  {
+    insert_runs_before(sentinel_, s, n, 0, 0);
+    return;
+  }
+  if (p->run_length_ + n <= run_capacity)
+  {
+    std::memmove(p->run_ + pos + n, p->run_ + pos, p->run_length_ - pos);
+    std::memcpy(p->run_ + pos, s, n);
+    size_type lines = count_lines(s, n);
+    p->run_length_ += n;
+    p->run_lines_ += lines;
+    propagate(p, n, lines, true);
+    return;
+  }
+  // split the run at pos and push the tail behind the inserted characters
+  char tail[run_capacity];
+  size_type tail_length = p->run_length_ - pos;
+  size_type tail_lines = count_lines(p->run_ + pos, tail_length);
+  std::memcpy(tail, p->run_ + pos, tail_length);
+  p->run_length_ = pos;
+  p->run_lines_ -= tail_lines;
+  propagate(p, tail_length, tail_lines, false);
+  size_type total = pos + n + tail_length;
+  size_type runs = (total + run_capacity - 1) / run_capacity;
+  size_type target = (total + runs - 1) / runs;
+  size_type room = (pos < target) ? target - pos : 0;
+  if (n < room)
+  {
+    room = n;
+  }
+  std::memcpy(p->run_ + pos, s, room);
+  size_type lines = count_lines(s, room);
+  p->run_length_ += room;
+  p->run_lines_ += lines;
+  propagate(p, room, lines, true);
+  insert_runs_before(p->next_, s + room, n - room, tail, tail_length);
+}
+
+template<class A>
+void indexing_rope<A>::erase(size_type pos, size_type len)
+{
+  range_check_lt(pos);
+  if (size() - pos < len)
+  {
+    len = size() - pos;
+  }
+  if (len == 0)
+  {
+    return;
+  }
+  size_type off = pos;
+  node_type* p = locate(off);
+  node_type* first = (off != 0) ? p : p->prev_;
+  while (len != 0)
+  {
+    node_type* next = p->next_;
+    size_type n = p->run_length_ - off;
+    if (len < n)
+    {
+      n = len;
+    }
+    if (n == p->run_length_)
+    {
+      unlink(p);
+      nodealloc_.deallocate(p,1);
+    }
+    else
+    {
+      size_type lines = count_lines(p->run_ + off, n);
+      std::memmove(p->run_ + off, p->run_ + off + n, p->run_length_ - off - n);
+      p->run_length_ -= n;
+      p->run_lines_ -= lines;
+      propagate(p, n, lines, false);
+    }
+    len -= n;
+    off = 0;
+    p = next;
+  }
+  if (!is_sentinel(first))
+  {
+    merge_with_next(first);
+  }
+}
+
+template<class A>
+void indexing_rope<A>::swap(indexing_rope& that) throw()
+{
+  node_type* p = sentinel_;
+  sentinel_ = that.sentinel_;
+  that.sentinel_ = p;
+}
+
+template<class A>
+void indexing_rope<A>::clear()
+{
+  node_type* p = sentinel_->next_;
+  while (p != sentinel_)
+  {
+    node_type* next = p->next_;
+    nodealloc_.deallocate(p,1);
+    p = next;
+  }
+  sentinel_->left_ = sentinel_;
+  sentinel_->right_ = sentinel_;
+  sentinel_->next_ = sentinel_;
+  sentinel_->prev_ = sentinel_;
+}
+
+} // end of namespace osoken
+
+#endif // INDEXING_ROPE_HPP_
@@ -23,7 +23,14 @@ THE SOFTWARE.
 #ifndef INDEXING_TREE_HPP_
 #define INDEXING_TREE_HPP_
 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <ostream>
 #include <stdexcept>
+#include <vector>
 
 #ifdef INDEXING_TREE_USES_TR1
 #  include <type_traits>
@@ -33,6 +40,67 @@ THE SOFTWARE.
 #  endif
 #endif
 
+#ifndef INDEXING_TREE_CONSTEXPR
+#  if __cplusplus >= 201103L
+#    define INDEXING_TREE_CONSTEXPR constexpr
+#  else
+#    define INDEXING_TREE_CONSTEXPR
+#  endif
+#endif
+
+#ifndef INDEXING_TREE_HAS_THREADS
+#  if __cplusplus >= 201103L
+#    define INDEXING_TREE_HAS_THREADS 1
+#  else
+#    define INDEXING_TREE_HAS_THREADS 0
+#  endif
+#endif
+#if INDEXING_TREE_HAS_THREADS
+#  include <thread>
+#endif
+
+#ifndef INDEXING_TREE_HAS_RVALUE_REFERENCES
+#  if __cplusplus >= 201103L
+#    define INDEXING_TREE_HAS_RVALUE_REFERENCES 1
+#  else
+#    define INDEXING_TREE_HAS_RVALUE_REFERENCES 0
+#  endif
+#endif
+
+#ifndef INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+#  if __cplusplus >= 201103L
+#    define INDEXING_TREE_HAS_ALLOCATOR_TRAITS 1
+#  else
+#    define INDEXING_TREE_HAS_ALLOCATOR_TRAITS 0
+#  endif
+#endif
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+#  include <type_traits>
+#  include <utility>
+#endif
+
+#ifndef INDEXING_TREE_HAS_MEMORY_RESOURCE
+#  if __cplusplus >= 201703L && defined(__has_include)
+#    if __has_include(<memory_resource>)
+#      define INDEXING_TREE_HAS_MEMORY_RESOURCE 1
+#    endif
+#  endif
+#  ifndef INDEXING_TREE_HAS_MEMORY_RESOURCE
+#    define INDEXING_TREE_HAS_MEMORY_RESOURCE 0
+#  endif
+#endif
+#if INDEXING_TREE_HAS_MEMORY_RESOURCE
+#  include <memory_resource>
+#endif
+
+#ifndef INDEXING_TREE_PREFETCH
+#  ifdef __GNUC__
+#    define INDEXING_TREE_PREFETCH(p) __builtin_prefetch(p)
+#  else
+#    define INDEXING_TREE_PREFETCH(p) ((void)0)
+#  endif
+#endif
+
 namespace osoken
 {
 #ifdef INDEXING_TREE_USES_TR1
@@ -56,34 +124,343 @@ namespace osoken
       template<> struct is_integral<unsigned int> { static const bool value_ = true; };
       template<> struct is_integral<unsigned short> { static const bool value_ = true; };
       template<> struct is_integral<unsigned long> { static const bool value_ = true; };
+      template<> struct is_integral<long long> { static const bool value_ = true; };
+      template<> struct is_integral<unsigned long long> { static const bool value_ = true; };
       template<> struct is_integral<signed char> { static const bool value_ = true; };
       template<> struct is_integral<bool> { static const bool value_ = true; };
     }
 # endif
 #endif
 
-template<class T, class Alloc = ::std::allocator<T> >
+// Balancing strategies of indexing_tree. The Balance parameter names one of
+// the policies below; its category selects how the tree is restructured
+// after insert/erase and on access, while nodes, iterators, select() and
+// index_of() are shared by all of them.
+struct weight_balanced_tag {};
+struct treap_tag {};
+struct splay_tag {};
+
+// Weight-balanced tree; the default strategy.
+// The policy is stated in terms of subtree weights (size + 1).
+// A node is balanced while its heavier side weighs at most Delta/Denominator
+// times its lighter side. When it is not, a single rotation is chosen if the
+// node that moves down weighs at most Gamma/Denominator times the outer
+// grandchild that moves up, otherwise a double rotation.
+// The default (2, 2) is the original rule |L-R| <= min(L,R)+1 and also the
+// tightest one: the two sides of a two-element subtree already weigh 2 and 1.
+// Larger values give taller trees but rotate less often.
+template<std::size_t Delta = 2, std::size_t Gamma = Delta, std::size_t Denominator = 1>
+struct weight_balance
+{
+  typedef weight_balanced_tag category;
+  struct node_base {};
+
+  static const std::size_t delta = Delta;
+  static const std::size_t gamma = Gamma;
+  static const std::size_t denominator = Denominator;
+
+  static INDEXING_TREE_CONSTEXPR bool is_balanced(std::size_t heavy, std::size_t light)
+  {
+    return Denominator * (heavy + 1) <= Delta * (light + 1);
+  }
+  static INDEXING_TREE_CONSTEXPR bool is_single_rotation(std::size_t outer, std::size_t inner, std::size_t light)
+  {
+    return Denominator * (inner + light + 2) <= Gamma * (outer + 1);
+  }
+private:
+  typedef char delta_must_be_at_least_two[(2 * Denominator <= Delta) ? 1 : -1];
+  typedef char gamma_must_be_within_one_and_delta[(Denominator <= Gamma && Gamma <= Delta) ? 1 : -1];
+};
+
+template<std::size_t D, std::size_t G, std::size_t N>
+const std::size_t weight_balance<D,G,N>::delta;
+
+template<std::size_t D, std::size_t G, std::size_t N>
+const std::size_t weight_balance<D,G,N>::gamma;
+
+template<std::size_t D, std::size_t G, std::size_t N>
+const std::size_t weight_balance<D,G,N>::denominator;
+
+// Implicit treap: every node draws a random priority and the tree is kept in
+// heap order of priorities, so its shape is that of a random binary search
+// tree regardless of the order of operations. Insertion and erasure do at
+// most a few expected rotations and never look at subtree sizes.
+class treap_balance
+{
+public:
+  typedef treap_tag category;
+  struct node_base
+  {
+    std::size_t priority_;
+  };
+
+  treap_balance() : state_(0) {}
+  std::size_t next_priority()
+  {
+    // splitmix64 of a counter
+    unsigned long long z = (state_ += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return static_cast<std::size_t>(z ^ (z >> 31));
+  }
+private:
+  unsigned long long state_;
+};
+
+// Splay tree: inserted, erased-around and accessed nodes are moved to the
+// root, so workloads that keep touching a small region of the sequence run
+// in amortized O(log k) for a working set of k elements. Only non-const
+// access splays; const member functions never change the shape, so that
+// concurrent readers stay safe while no cursor holds elements. A single
+// access may still cost O(n), which also holds for iterator arithmetic on a
+// degenerate shape.
+struct splay_balance
+{
+  typedef splay_tag category;
+  struct node_base {};
+};
+
+// Maps an element to the integer that hashed<> feeds into its polynomial;
+// the default converts integral and character types.
+struct element_hash
+{
+  template<class U>
+  unsigned long long operator()(const U& x) const
+  {
+    return static_cast<unsigned long long>(x);
+  }
+};
+
+// Wraps a balance policy so that every node also keeps the polynomial hash
+// of its subtree, sum of h(x_i) * base^(n-1-i) modulo 2^61-1, next to its
+// size. This enables hash(first, last) in O(log n) and, through it, range
+// equality and common_prefix() across trees. The base is fixed, so trees in
+// different processes agree on hashes as long as Hash does.
+template<class Balance = weight_balance<>, class Hash = element_hash>
+struct hashed : Balance
+{
+  typedef unsigned long long hash_type;
+  struct node_base : Balance::node_base
+  {
+    hash_type hash_;
+    hash_type power_;
+  };
+
+  static const hash_type modulus = 0x1FFFFFFFFFFFFFFFULL;
+  static const hash_type base = 0x0F1BBCDCB7A56463ULL;
+
+  static hash_type add(hash_type a, hash_type b)
+  {
+    hash_type c = a + b;
+    return (modulus <= c) ? c - modulus : c;
+  }
+  static hash_type subtract(hash_type a, hash_type b)
+  {
+    return (b <= a) ? a - b : a + modulus - b;
+  }
+  // a * b mod 2^61-1 without a 128-bit product
+  static hash_type multiply(hash_type a, hash_type b)
+  {
+    const hash_type mask30 = (1ULL << 30) - 1;
+    const hash_type mask31 = (1ULL << 31) - 1;
+    hash_type au = a >> 31;
+    hash_type ad = a & mask31;
+    hash_type bu = b >> 31;
+    hash_type bd = b & mask31;
+    hash_type mid = ad * bu + au * bd;
+    hash_type c = au * bu * 2 + (mid >> 30) + ((mid & mask30) << 31) + ad * bd;
+    c = (c >> 61) + (c & modulus);
+    return (modulus <= c) ? c - modulus : c;
+  }
+  static hash_type power(std::size_t n)
+  {
+    hash_type r = 1;
+    hash_type b = base;
+    for (; n != 0; n >>= 1)
+    {
+      if (n & 1)
+      {
+        r = multiply(r, b);
+      }
+      b = multiply(b, b);
+    }
+    return r;
+  }
+  template<class U>
+  static hash_type element(const U& x)
+  {
+    return Hash()(x) % modulus;
+  }
+};
+
+template<class B, class H>
+const typename hashed<B,H>::hash_type hashed<B,H>::modulus;
+
+template<class B, class H>
+const typename hashed<B,H>::hash_type hashed<B,H>::base;
+
+// Wraps a balance policy so that elements can be erased lazily. mark_dead()
+// only flags the node and recounts the live elements on its path to the
+// root, without relinking or rotating; nth_live() and live_size() count
+// live elements only, and compact() removes the dead ones in one linear
+// rebuild. Dead elements still count in size() and are still visited by
+// iterators (see is_dead(), and tombstone_indexing_tree for a live view).
+// A copy of the tree revives them, so compact() before copying.
+template<class Balance = weight_balance<> >
+struct tombstoned : Balance
+{
+  struct node_base : Balance::node_base
+  {
+    std::size_t live_;
+    bool dead_;
+  };
+};
+
+// Subtree augmentations, selected by wrapping the balance policy.
+struct no_augmentation_tag {};
+struct hash_augmentation_tag {};
+struct live_count_augmentation_tag {};
+
+template<class Balance>
+struct augmentation_of
+{
+  typedef no_augmentation_tag type;
+};
+
+template<class Balance, class Hash>
+struct augmentation_of<hashed<Balance, Hash> >
+{
+  typedef hash_augmentation_tag type;
+};
+
+template<class Balance>
+struct augmentation_of<tombstoned<Balance> >
+{
+  typedef live_count_augmentation_tag type;
+};
+
+// Whether copy assignment, move assignment and swap hand the allocator
+// over along with the elements. Before std::allocator_traits an allocator
+// always stays with its tree.
+struct propagate_allocator_tag {};
+struct keep_allocator_tag {};
+
+template<class Alloc>
+struct allocator_propagation
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef std::allocator_traits<Alloc> traits;
+  typedef typename std::conditional<traits::propagate_on_container_copy_assignment::value,
+    propagate_allocator_tag, keep_allocator_tag>::type copy_assignment;
+  typedef typename std::conditional<traits::propagate_on_container_move_assignment::value,
+    propagate_allocator_tag, keep_allocator_tag>::type move_assignment;
+  typedef typename std::conditional<traits::propagate_on_container_swap::value,
+    propagate_allocator_tag, keep_allocator_tag>::type swap;
+#else
+  typedef keep_allocator_tag copy_assignment;
+  typedef keep_allocator_tag move_assignment;
+  typedef keep_allocator_tag swap;
+#endif
+};
+
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+// Allocator adaptor whose construct(p) default-initializes, so that resizing
+// a vector of trivial elements leaves them unwritten; every other call is
+// passed on to Alloc.
+template<class Alloc>
+class default_init_allocator : public Alloc
+{
+  typedef std::allocator_traits<Alloc> traits;
+public:
+  template<class U>
+  struct rebind
+  {
+    typedef default_init_allocator<typename traits::template rebind_alloc<U> > other;
+  };
+
+  default_init_allocator() {}
+  default_init_allocator(const Alloc& alloc) : Alloc(alloc) {}
+  template<class U>
+  default_init_allocator(const default_init_allocator<U>& that) : Alloc(static_cast<const U&>(that)) {}
+
+  template<class U>
+  void construct(U* p)
+  {
+    ::new(static_cast<void*>(p)) U;
+  }
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args)
+  {
+    traits::construct(static_cast<Alloc&>(*this), p, std::forward<Args>(args)...);
+  }
+};
+#endif
+
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
 class indexing_tree
 {
 public:
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef T& reference;
+  typedef typename std::allocator_traits<Alloc>::pointer pointer;
+  typedef const T& const_reference;
+  typedef typename std::allocator_traits<Alloc>::const_pointer const_pointer;
+#else
   typedef typename Alloc::reference reference;
   typedef typename Alloc::pointer pointer;
   typedef typename Alloc::const_reference const_reference;
   typedef typename Alloc::const_pointer const_pointer;
+#endif
   typedef Alloc allocator_type;
+  typedef Balance balance_type;
   typedef T value_type;
   typedef std::size_t size_type;
   typedef std::ptrdiff_t difference_type;
+  typedef unsigned long long hash_type;
+  typedef std::vector<T, Alloc> vector_type;
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef std::vector<T, default_init_allocator<Alloc> > uninitialized_vector_type;
+#else
+  typedef std::vector<T, Alloc> uninitialized_vector_type;
+#endif
 private:
   template<class U>
-  struct node
+  struct node : Balance::node_base
   {
     node *next_, *prev_, *left_, *right_, *parent_;
     size_type size_;
     U value_;
   };
   typedef node<T> node_type;
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc< node_type > node_allocator_type;
+#else
   typedef typename allocator_type::template rebind< node_type >::other node_allocator_type;
+#endif
+
+  // raw storage for the links of a node that has no value_: the sentinel
+  // of a tree, the empty subtree, or a stand-in parent of a detached subtree
+  struct sentinel_storage
+  {
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+    typename std::aligned_storage<sizeof(node<char>), std::alignment_of<node_type>::value>::type storage_;
+#else
+    union
+    {
+      char bytes_[sizeof(node<char>)];
+      long double long_double_;
+      void* pointer_;
+      long long_;
+    } storage_;
+#endif
+    sentinel_storage();
+    explicit sentinel_storage(node_type* nil);
+    node_type* address() const;
+  private:
+    sentinel_storage(const sentinel_storage&);
+    sentinel_storage& operator = (const sentinel_storage&);
+    void init(node_type* nil);
+  };
 
   class iterator_base : public std::iterator<std::random_access_iterator_tag, typename indexing_tree::value_type, typename indexing_tree::difference_type, typename indexing_tree::pointer, typename indexing_tree::reference>
   {
@@ -106,6 +483,7 @@ public:
   class iterator : public iterator_base
   {
   public:
+    using iterator_base::operator-;
     iterator(const iterator& i);
     iterator();
     iterator& operator++();
@@ -135,6 +513,7 @@ public:
   class const_iterator : public iterator_base
   {
   public:
+    using iterator_base::operator-;
     const_iterator(const iterator& i);
     const_iterator(const const_iterator& i);
     const_iterator();
@@ -218,18 +597,136 @@ public:
   friend class const_iterator;
   friend class reverse_iterator;
   friend class const_reverse_iterator;
+  class cursor;
+  friend class cursor;
+
+  // Owns a node detached by extract() until insert() links it into a tree
+  // of the same type; the element is neither copied nor reallocated on the
+  // way. The receiving tree must use an allocator that compares equal;
+  // insert() throws std::invalid_argument otherwise.
+  // Without rvalue references the handle transfers ownership on copy, like
+  // std::auto_ptr.
+  class node_handle
+  {
+    friend class indexing_tree;
+  public:
+    typedef T value_type;
+    typedef Alloc allocator_type;
+    node_handle();
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+    node_handle(node_handle&& that);
+    node_handle& operator = (node_handle&& that);
+#else
+    node_handle(const node_handle& that);
+    node_handle& operator = (const node_handle& that);
+#endif
+    ~node_handle();
+    bool empty() const;
+    value_type& value() const;
+    allocator_type get_allocator() const;
+    void swap(node_handle& that);
+  private:
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+    node_handle(const node_handle&);
+    node_handle& operator = (const node_handle&);
+#endif
+    node_handle(node_type* p, const allocator_type& alloc);
+    allocator_type& alloc() const;
+    void take(const node_handle& that);
+    node_type* release() const;
+    void reset();
+    // the allocator lives in alloc_ only while node_ != 0, so an empty
+    // handle never needs a default-constructible allocator
+    mutable node_type* node_;
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+    mutable typename std::aligned_storage<sizeof(allocator_type), std::alignment_of<allocator_type>::value>::type alloc_;
+#else
+    mutable union
+    {
+      char bytes_[sizeof(allocator_type)];
+      long double long_double_;
+      void* pointer_;
+      long long_;
+    } alloc_;
+#endif
+  };
+
+  // One entry of a batch for apply_batch(): insert value_ in front of the
+  // element at position_, or erase the element at position_.
+  struct edit
+  {
+    enum kind_type { insert_kind, erase_kind };
+    size_type position_;
+    kind_type kind_;
+    T value_;
+    static edit insertion(size_type position, const T& x);
+    static edit erasure(size_type position);
+  };
+
+  // A finger for clustered edits. Elements inserted through a cursor are
+  // kept in a small local buffer in front of its position and spliced into
+  // the tree in one piece, with a single walk to the root, when the cursor
+  // moves, is flushed or destroyed, or when the tree has to cross its
+  // position: handing out iterators, searching, hashing, editing by index
+  // or right at the position, and the bulk operations. size(), element
+  // access, front(), back(), copy_to(), the to_vector() family, live_size()
+  // and copies
+  // read through the buffer instead, so every member function sees the same
+  // sequence. While a cursor holds elements the tree counts as being
+  // modified: const member functions may splice them too and must not run
+  // concurrently. erase_before() takes back buffered elements in O(1). A
+  // tree serves one cursor at a time; attaching another flushes and
+  // detaches the previous one, and a detached cursor may only be destroyed.
+  // The position of a cursor is invalidated like an iterator.
+  class cursor
+  {
+    friend class indexing_tree;
+  public:
+    cursor(indexing_tree& tree, iterator position);
+    ~cursor();
+    iterator position() const;
+    size_type pending() const;
+    void insert(const T& x);
+    void erase();
+    void erase_before();
+    void move_to(iterator position);
+    void flush();
+  private:
+    cursor(const cursor&);
+    cursor& operator = (const cursor&);
+    void detach();
+    indexing_tree* tree_;
+    node_type* position_;
+    node_type* first_;
+    node_type* last_;
+    size_type pending_;
+  };
+
   // member functions
   explicit indexing_tree(const Alloc& alloc = Alloc());
   explicit indexing_tree(size_type n, const T& x, const Alloc& alloc = Alloc());
   template<class InIter>
   indexing_tree(InIter first, InIter last, const Alloc& alloc = Alloc());
   indexing_tree(const indexing_tree& that);
+  indexing_tree(const indexing_tree& that, const Alloc& alloc);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  indexing_tree(indexing_tree&& that) throw();
+  indexing_tree(indexing_tree&& that, const Alloc& alloc);
+#endif
   ~indexing_tree();
 
   indexing_tree& operator = (const indexing_tree& that);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  indexing_tree& operator = (indexing_tree&& that);
+#endif
   template<class InIter>
   void assign(InIter first, InIter last);
   void assign(size_type n, const T& x);
+  void assign_from(const T* first, size_type n);
+  template<class OutIter>
+  OutIter copy_to(OutIter out) const;
+  vector_type to_vector(unsigned threads = 1) const;
+  uninitialized_vector_type to_uninitialized_vector(unsigned threads = 1) const;
   Alloc get_allocator() const;
 
   iterator begin();
@@ -246,6 +743,8 @@ public:
   size_type capacity() const;
   bool empty() const;
   void reserve(size_type n);
+  size_type end_buffer() const;
+  void set_end_buffer(size_type n);
 
   reference operator [] (size_type n);
   const_reference operator [] (size_type n) const;
@@ -264,26 +763,187 @@ public:
   void insert(iterator position, size_type n, const T& x);
   template<class InIter>
   void insert(iterator position, InIter first, InIter last);
-//  iterator insert(size_type position, const T& x);
-//  iterator insert(size_type position, size_type n, const T& x);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  iterator insert(iterator position, node_handle&& nh);
+#else
+  iterator insert(iterator position, const node_handle& nh);
+#endif
+  node_handle extract(iterator position);
+  template<class InIter>
+  void apply_batch(InIter first, InIter last, unsigned threads = 1);
+  iterator insert(size_type position, const T& x);
+  iterator insert(size_type position, size_type n, const T& x);
   iterator erase(iterator position);
   iterator erase(iterator first, iterator last);
-//  iterator erase(size_type position);
-//  iterator erase(size_type position, size_type n);
+  iterator erase(size_type position);
+  iterator erase(size_type position, size_type n);
   void swap(indexing_tree& that) throw();
 
   void clear();
+
+  // Moves the elements [position, position + n) into nodes allocated anew
+  // in sequence order and returns position + n; call it repeatedly to do
+  // the whole tree in bounded slices. Iterators into the slice become
+  // invalid.
+  size_type relayout(size_type position = 0, size_type n = size_type(-1));
+
+  // Calls f(p, bytes) for the storage of each node within levels of the
+  // root, level by level, until f returns false; returns how many nodes it
+  // accepted. These are the nodes every descent passes, for an arena to
+  // keep resident.
+  template<class Function>
+  size_type visit_top(unsigned levels, Function f) const;
+
+  // Erase the matching elements in one pass over the sequence and rebuild
+  // the tree over the rest in linear time; they return the number erased.
+  template<class Pred>
+  size_type erase_if(Pred pred);
+  size_type remove(const T& x);
+  size_type unique();
+  template<class BinaryPred>
+  size_type unique(BinaryPred pred);
+
+  // Binary searches in one descent from the root. The elements satisfying
+  // pred must precede the others, or the sequence be sorted by comp; the
+  // position of the result is stored to *index when index is given.
+  template<class Pred>
+  iterator partition_point(Pred pred, size_type* index = 0);
+  template<class Pred>
+  const_iterator partition_point(Pred pred, size_type* index = 0) const;
+  iterator lower_bound(const T& x, size_type* index = 0);
+  const_iterator lower_bound(const T& x, size_type* index = 0) const;
+  template<class Compare>
+  iterator lower_bound(const T& x, Compare comp, size_type* index = 0);
+  template<class Compare>
+  const_iterator lower_bound(const T& x, Compare comp, size_type* index = 0) const;
+  iterator upper_bound(const T& x, size_type* index = 0);
+  const_iterator upper_bound(const T& x, size_type* index = 0) const;
+  template<class Compare>
+  iterator upper_bound(const T& x, Compare comp, size_type* index = 0);
+  template<class Compare>
+  const_iterator upper_bound(const T& x, Compare comp, size_type* index = 0) const;
+
+  // available with a hashed<> balance policy
+  hash_type hash() const;
+  hash_type hash(const_iterator first, const_iterator last) const;
+  bool equal(const_iterator first, const_iterator last, const indexing_tree& that, const_iterator that_first) const;
+  size_type common_prefix(const_iterator first, const indexing_tree& that, const_iterator that_first) const;
+  void rehash(iterator position);
+
+  // available with a tombstoned<> balance policy
+  void mark_dead(iterator position);
+  bool is_dead(const_iterator position) const;
+  size_type live_size() const;
+  iterator nth_live(size_type n);
+  const_iterator nth_live(size_type n) const;
+  size_type compact();
 private:
-  node_type* sentinel_;
+  sentinel_storage header_;
   allocator_type alloc_;
   node_allocator_type nodealloc_;
-
-  void init_sentinel_();
-  node_type* select(size_type n);
+  balance_type balance_;
+  // the settings only some trees use, allocated on first use
+  struct extension
+  {
+    size_type end_buffer_;
+    cursor* cursor_;
+  };
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<extension> extension_allocator_type;
+#else
+  typedef typename allocator_type::template rebind<extension>::other extension_allocator_type;
+#endif
+  extension* extension_;
+
+  static allocator_type select_allocator(const allocator_type& alloc);
+  static void construct_value(allocator_type& alloc, T* p, const T& x);
+  static void destroy_value(allocator_type& alloc, T* p);
+  static void relocate_value(allocator_type& alloc, T* p, T& x);
+  void copy_construct(const indexing_tree& that);
+  void copy_assign(const indexing_tree& that, propagate_allocator_tag);
+  void copy_assign(const indexing_tree& that, keep_allocator_tag);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  void move_assign(indexing_tree& that, propagate_allocator_tag);
+  void move_assign(indexing_tree& that, keep_allocator_tag);
+#endif
+  void swap_elements(indexing_tree& that);
+  extension* extend();
+  cursor* attached_cursor() const;
+  static void take_links(node_type* s, node_type* other);
+  void swap_allocators(indexing_tree& that, propagate_allocator_tag);
+  void swap_allocators(indexing_tree& that, keep_allocator_tag);
+  node_type* sentinel() const;
+  static node_type* nil();
+  node_type* select(size_type n) const;
+  static node_type* select(node_type* s, size_type n);
+  static bool is_buffered(node_type* p);
+  static size_type head_buffered(node_type* s);
+  static size_type tail_buffered(node_type* s);
+  static node_type* sentinel_of(node_type* p);
+  void flush_ends();
+  void flush_head();
+  void flush_tail();
+  void flush_cursor();
+  void flush_cursor() const;
+  void flush_cursor_at(node_type* position);
+  size_type cursor_pending() const;
+  node_type* cursor_node() const;
+  node_type* element(size_type n) const;
+  void splice_before(node_type* position, node_type* first, node_type* last, size_type n, weight_balanced_tag);
+  template<class Category>
+  void splice_before(node_type* position, node_type* first, node_type* last, size_type n, Category);
+  void attach_front(node_type* first, node_type* last, size_type n, weight_balanced_tag);
+  template<class Category>
+  void attach_front(node_type* first, node_type* last, size_type n, Category);
+  void attach_back(node_type* first, size_type n, weight_balanced_tag);
+  template<class Category>
+  void attach_back(node_type* first, size_type n, Category);
+  void refill_front(weight_balanced_tag);
+  template<class Category>
+  void refill_front(Category);
+  void refill_back(weight_balanced_tag);
+  template<class Category>
+  void refill_back(Category);
+  static void pull(node_type* p);
+  static void pull(node_type* p, no_augmentation_tag);
+  static void pull(node_type* p, hash_augmentation_tag);
+  static void pull(node_type* p, live_count_augmentation_tag);
+  static void init_sentinel_node(node_type* s);
+  static void init_sentinel_node(node_type* s, no_augmentation_tag);
+  static void init_sentinel_node(node_type* s, hash_augmentation_tag);
+  static void init_sentinel_node(node_type* s, live_count_augmentation_tag);
+  template<class Augmentation>
+  static void init_item(node_type* p, Augmentation);
+  static void init_item(node_type* p, live_count_augmentation_tag);
+  node_type* live_node(size_type n) const;
+  hash_type prefix_hash(size_type n) const;
+  void fix_up_grow(node_type* p, size_type n);
+  void fix_up_shrink(node_type* p, size_type n);
   void range_check_lt(size_type n) const;
   void range_check_leq(size_type n) const;
+  void fix_up_insert(node_type* n);
+  void fix_up_insert(node_type* n, weight_balanced_tag);
+  void fix_up_insert(node_type* n, treap_tag);
+  void fix_up_insert(node_type* n, splay_tag);
+  void fix_up_erase(node_type* p);
+  void fix_up_erase(node_type* p, weight_balanced_tag);
+  void fix_up_erase(node_type* p, treap_tag);
+  void fix_up_erase(node_type* p, splay_tag);
+  void prepare_erase(node_type* p, weight_balanced_tag);
+  void prepare_erase(node_type* p, treap_tag);
+  void prepare_erase(node_type* p, splay_tag);
+  void init_node(node_type* p, weight_balanced_tag);
+  void init_node(node_type* p, treap_tag);
+  void init_node(node_type* p, splay_tag);
+  void touch(node_type* p, weight_balanced_tag);
+  void touch(node_type* p, treap_tag);
+  void touch(node_type* p, splay_tag);
   void fix_up_incr(node_type* p);
   void fix_up_decr(node_type* p);
+  void increment_sizes(node_type* p);
+  void decrement_sizes(node_type* p);
+  void rotate_up(node_type* p);
+  void splay(node_type* p);
   void fix_up(node_type* p);
   bool is_balanced(node_type* p) const;
   void rebalance(node_type* p);
@@ -294,8 +954,117 @@ private:
   node_type* newitem(const T& x);
   void deleteitem(node_type* p);
   void put_first_element(node_type* p);
+  void link_back(node_type* n);
+  node_type* link_before(node_type* position, node_type* p);
+  node_type* unlink(node_type* p);
+  void relocate(node_type* p, node_type* q);
+  node_type* insert_copies(node_type* position, size_type n, const T& x);
+  void insert_at(size_type position, node_type* p, weight_balanced_tag);
+  template<class Category>
+  void insert_at(size_type position, node_type* p, Category);
+  void insert_below(node_type* t, size_type i, node_type* p);
+  node_type* erase_at(size_type position, weight_balanced_tag);
+  template<class Category>
+  node_type* erase_at(size_type position, Category);
+  node_type* erase_below(node_type* t, size_type i);
+  node_type* erase_first_below(node_type* t);
+  node_type* erase_last_below(node_type* t);
+  static void replace_child(node_type* parent, node_type* child, node_type* p);
   static bool is_sentinel(node_type* p);
 
+  // node_ is the node to link or, once located, the node to erase; anchor_
+  // is the element an insertion goes in front of.
+  struct batch_record
+  {
+    size_type position_;
+    node_type* node_;
+    node_type* anchor_;
+    bool erase_;
+  };
+  typedef std::vector<batch_record> batch_type;
+  void apply_batch(batch_type& batch, unsigned threads, weight_balanced_tag);
+  void apply_batch(batch_type& batch, unsigned threads, treap_tag);
+  void apply_batch(batch_type& batch, unsigned threads, splay_tag);
+  void apply_batch_one_by_one(batch_type& batch);
+  static batch_record* batch_split(batch_record* first, batch_record* last, size_type position);
+  void batch_locate(node_type* t, batch_record* first, batch_record* last, size_type offset, node_type* succ);
+  node_type* batch_subtree(node_type* t, batch_record* first, batch_record* last, size_type offset, unsigned threads);
+  node_type* batch_join(node_type* l, node_type* r);
+  node_type* rebalance_detached(node_type* t);
+  node_type* build_balanced(node_type*& first, size_type n);
+  void build_from(const T* first, size_type n, weight_balanced_tag);
+  template<class Category>
+  void build_from(const T* first, size_type n, Category);
+  static void copy_subtree(node_type* t, T* out, unsigned threads);
+  template<class Vector>
+  Vector copy_to_vector(unsigned threads) const;
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  template<class Vector>
+  bool copy_parallel(Vector& v, unsigned threads, std::true_type) const;
+  template<class Vector>
+  bool copy_parallel(Vector& v, unsigned threads, std::false_type) const;
+#endif
+  template<class Pred>
+  node_type* partition_node(Pred& pred, size_type* index) const;
+  template<class Filter>
+  size_type erase_where(Filter& filter);
+  void rebuild(size_type n);
+  template<class Category>
+  node_type* build_shape(node_type* first, size_type n, Category);
+  node_type* build_shape(node_type* first, size_type n, treap_tag);
+  size_type fix_sizes(node_type* t);
+
+  // filters of erase_where(), given the last element kept so far (or the
+  // sentinel) and the element in question
+  template<class Pred>
+  struct element_filter
+  {
+    element_filter(Pred& pred) : pred_(pred) {}
+    bool operator()(node_type*, node_type* p) { return pred_(p->value_); }
+    Pred& pred_;
+  };
+  template<class BinaryPred>
+  struct duplicate_filter
+  {
+    duplicate_filter(BinaryPred& pred, node_type* sentinel) : pred_(pred), sentinel_(sentinel) {}
+    bool operator()(node_type* last, node_type* p) { return last != sentinel_ && pred_(last->value_, p->value_); }
+    BinaryPred& pred_;
+    node_type* sentinel_;
+  };
+  struct equal_to_value
+  {
+    explicit equal_to_value(const T& x) : x_(x) {}
+    bool operator()(const T& y) const { return y == x_; }
+    T x_;
+  };
+  struct equal_values
+  {
+    bool operator()(const T& x, const T& y) const { return x == y; }
+  };
+  struct dead_filter
+  {
+    bool operator()(node_type*, node_type* p) const { return p->dead_; }
+  };
+
+  // predicates of lower_bound() and upper_bound()
+  template<class Compare>
+  struct less_than
+  {
+    less_than(const T& x, Compare comp) : x_(&x), comp_(comp) {}
+    bool operator()(const T& y) { return comp_(y, *x_); }
+    const T* x_;
+    Compare comp_;
+  };
+  template<class Compare>
+  struct not_greater_than
+  {
+    not_greater_than(const T& x, Compare comp) : x_(&x), comp_(comp) {}
+    bool operator()(const T& y) { return !comp_(*x_, y); }
+    const T* x_;
+    Compare comp_;
+  };
+  node_type* build_balanced(batch_record* first, batch_record* last);
+
   template<bool Is_integral, class InIter>
   class private_insert
   {
@@ -323,47 +1092,65 @@ public:
 //////////////////
 // iterator_base
 //////////////////
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator_base::operator == (const iterator_base& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator_base::operator == (const iterator_base& i) const
 {
   return node_ == i.node_;
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator_base::operator != (const iterator_base& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator_base::operator != (const iterator_base& i) const
 {
   return node_ != i.node_;
 }
 
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::difference_type indexing_tree<T,A>::iterator_base::operator - (const iterator_base& i) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::difference_type indexing_tree<T,A,B>::iterator_base::operator - (const iterator_base& i) const
 {
   return static_cast<difference_type>(index_of()) - static_cast<difference_type>(i.index_of());
 }
 
 
-template<class T,class A>
-inline indexing_tree<T,A>::iterator_base::iterator_base(const iterator_base& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator_base::iterator_base(const iterator_base& i):
 node_(i.node_)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::iterator_base::iterator_base(node_type* node):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator_base::iterator_base(node_type* node):
 node_(node)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::iterator_base::iterator_base()
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator_base::iterator_base():
+node_(0)
 {
 }
 
-template<class T,class A>
-void indexing_tree<T,A>::iterator_base::advance_forward(difference_type diff)
+template<class T,class A,class B>
+void indexing_tree<T,A,B>::iterator_base::advance_forward(difference_type diff)
 {
   difference_type d = diff;
+  if (indexing_tree::is_buffered(this->node_) || (indexing_tree::is_sentinel(this->node_) && indexing_tree::tail_buffered(this->node_) != 0))
+  {
+    // end buffers are only reachable along the chain; go by absolute index
+    difference_type i = static_cast<difference_type>(index_of()) + d;
+    if (i < 0)
+    {
+      throw std::out_of_range("indexing_tree::out_of_range");
+    }
+    this->node_ = indexing_tree::select(indexing_tree::sentinel_of(this->node_), static_cast<size_type>(i));
+    return;
+  }
+  if (indexing_tree::is_sentinel(this->node_) && d < 0 && !indexing_tree::is_sentinel(this->node_->left_))
+  {
+    // end() stands at index size(), right above the root
+    d += this->node_->left_->right_->size_ + 1;
+    this->node_ = this->node_->left_;
+  }
   while (!indexing_tree::is_sentinel(this->node_))
   {
     if (d == 0)
@@ -411,14 +1198,33 @@ void indexing_tree<T,A>::iterator_base::advance_forward(difference_type diff)
       }
     }
   }
-  throw std::out_of_range("indexing_tree::out_of_range");
+  if (d == 0 && indexing_tree::tail_buffered(this->node_) == 0)
+  {
+    return;
+  }
+  // d is relative to the end of the tree part, where the tail buffer starts
+  d += static_cast<difference_type>(indexing_tree::head_buffered(this->node_) + this->node_->left_->size_);
+  if (d < 0)
+  {
+    throw std::out_of_range("indexing_tree::out_of_range");
+  }
+  this->node_ = indexing_tree::select(this->node_, static_cast<size_type>(d));
 }
 
-template<class T,class A>
-typename indexing_tree<T,A>::size_type indexing_tree<T,A>::iterator_base::index_of() const
+template<class T,class A,class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::iterator_base::index_of() const
 {
   difference_type ret = 0;
   node_type* nd = node_;
+  while (indexing_tree::is_buffered(nd))
+  {
+    --ret;
+    nd = nd->next_;
+  }
+  if (indexing_tree::is_sentinel(nd))
+  {
+    ret += indexing_tree::tail_buffered(nd);
+  }
   while (!indexing_tree::is_sentinel(nd))
   {
     if (nd->parent_->left_ == nd)
@@ -431,149 +1237,149 @@ typename indexing_tree<T,A>::size_type indexing_tree<T,A>::iterator_base::index_
     }
     nd = nd->parent_;
   }
-  ret += nd->left_->size_;
+  ret += nd->left_->size_ + indexing_tree::head_buffered(nd);
   return static_cast<size_type>(ret);
 }
 
 //////////////////
 // iterator
 //////////////////
-template<class T,class A>
-inline indexing_tree<T,A>::iterator::iterator(const iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator::iterator(const iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::iterator::iterator():
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator::iterator():
 iterator_base()
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::iterator::iterator(node_type* node):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::iterator::iterator(node_type* node):
 iterator_base(node)
 {
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator& indexing_tree<T,A>::iterator::operator++()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator& indexing_tree<T,A,B>::iterator::operator++()
 {
   this->node_ = this->node_->next_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::iterator::operator++(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::iterator::operator++(int)
 {
   iterator tmp = *this;
   operator++();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator& indexing_tree<T,A>::iterator::operator--()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator& indexing_tree<T,A,B>::iterator::operator--()
 {
   this->node_ = this->node_->prev_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::iterator::operator--(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::iterator::operator--(int)
 {
   iterator tmp = *this;
   operator--();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::iterator::operator + (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::iterator::operator + (difference_type diff) const
 {
   iterator tmp = *this;
   tmp += diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::iterator::operator - (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::iterator::operator - (difference_type diff) const
 {
   iterator tmp = *this;
   tmp -= diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator& indexing_tree<T,A>::iterator::operator += (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator& indexing_tree<T,A,B>::iterator::operator += (difference_type diff)
 {
   iterator_base::advance_forward(diff);
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::iterator& indexing_tree<T,A>::iterator::operator -= (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::iterator& indexing_tree<T,A,B>::iterator::operator -= (difference_type diff)
 {
   iterator_base::advance_forward(-diff);
   return *this;
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator::operator < (const iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator::operator < (const iterator& i) const
 {
   return this->index_of() < i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator::operator <= (const iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator::operator <= (const iterator& i) const
 {
   return this->index_of() <= i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator::operator > (const iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator::operator > (const iterator& i) const
 {
   return this->index_of() > i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::iterator::operator >= (const iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::iterator::operator >= (const iterator& i) const
 {
   return this->index_of() >= i.index_of();
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::iterator::operator*()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::iterator::operator*()
 {
   return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::iterator::operator*() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::iterator::operator*() const
 {
-  return this->node_value_;
+  return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::pointer indexing_tree<T,A>::iterator::operator->()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::pointer indexing_tree<T,A,B>::iterator::operator->()
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_pointer indexing_tree<T,A>::iterator::operator->() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_pointer indexing_tree<T,A,B>::iterator::operator->() const
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::iterator::operator [] (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::iterator::operator [] (difference_type diff)
 {
   iterator tmp = *this;
   tmp += diff;
   return *tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::iterator::operator [] (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::iterator::operator [] (difference_type diff) const
 {
   const_iterator tmp = *this;
   tmp += diff;
@@ -583,128 +1389,128 @@ inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::iterator
 //////////////////
 // const_iterator
 //////////////////
-template<class T,class A>
-inline indexing_tree<T,A>::const_iterator::const_iterator(const iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_iterator::const_iterator(const iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_iterator::const_iterator(const const_iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_iterator::const_iterator(const const_iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_iterator::const_iterator(node_type* node):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_iterator::const_iterator(node_type* node):
 iterator_base(node)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_iterator::const_iterator():
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_iterator::const_iterator():
 iterator_base()
 {
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator& indexing_tree<T,A>::const_iterator::operator++()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator& indexing_tree<T,A,B>::const_iterator::operator++()
 {
   this->node_ = this->node_->next_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::const_iterator::operator++(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::const_iterator::operator++(int)
 {
   const_iterator tmp = *this;
   operator++();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator& indexing_tree<T,A>::const_iterator::operator--()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator& indexing_tree<T,A,B>::const_iterator::operator--()
 {
   this->node_ = this->node_->prev_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::const_iterator::operator--(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::const_iterator::operator--(int)
 {
   const_iterator tmp = *this;
   operator--();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::const_iterator::operator + (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::const_iterator::operator + (difference_type diff) const
 {
   const_iterator tmp = *this;
   tmp += diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::const_iterator::operator - (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::const_iterator::operator - (difference_type diff) const
 {
   const_iterator tmp = *this;
   tmp -= diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator& indexing_tree<T,A>::const_iterator::operator += (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator& indexing_tree<T,A,B>::const_iterator::operator += (difference_type diff)
 {
   iterator_base::advance_forward(diff);
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_iterator& indexing_tree<T,A>::const_iterator::operator -= (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_iterator& indexing_tree<T,A,B>::const_iterator::operator -= (difference_type diff)
 {
   iterator_base::advance_forward(-diff);
   return *this;
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_iterator::operator < (const const_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_iterator::operator < (const const_iterator& i) const
 {
   return this->index_of() < i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_iterator::operator <= (const const_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_iterator::operator <= (const const_iterator& i) const
 {
   return this->index_of() <= i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_iterator::operator > (const const_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_iterator::operator > (const const_iterator& i) const
 {
   return this->index_of() > i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_iterator::operator >= (const const_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_iterator::operator >= (const const_iterator& i) const
 {
   return this->index_of() >= i.index_of();
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_iterator::operator*() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::const_iterator::operator*() const
 {
   return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_pointer indexing_tree<T,A>::const_iterator::operator->() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_pointer indexing_tree<T,A,B>::const_iterator::operator->() const
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_iterator::operator [] (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::const_iterator::operator [] (difference_type diff) const
 {
   const_iterator tmp = *this;
   tmp += diff;
@@ -714,142 +1520,142 @@ inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_it
 //////////////////
 // reverse_iterator
 //////////////////
-template<class T,class A>
-inline indexing_tree<T,A>::reverse_iterator::reverse_iterator(const reverse_iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::reverse_iterator::reverse_iterator(const reverse_iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::reverse_iterator::reverse_iterator():
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::reverse_iterator::reverse_iterator():
 iterator_base()
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::reverse_iterator::reverse_iterator(node_type* node):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::reverse_iterator::reverse_iterator(node_type* node):
 iterator_base(node)
 {
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator& indexing_tree<T,A>::reverse_iterator::operator++()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator& indexing_tree<T,A,B>::reverse_iterator::operator++()
 {
   this->node_ = this->node_->prev_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::reverse_iterator::operator++(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::reverse_iterator::operator++(int)
 {
   reverse_iterator tmp = *this;
   operator++();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator& indexing_tree<T,A>::reverse_iterator::operator--()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator& indexing_tree<T,A,B>::reverse_iterator::operator--()
 {
   this->node_ = this->node_->next_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::reverse_iterator::operator--(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::reverse_iterator::operator--(int)
 {
   reverse_iterator tmp = *this;
   operator--();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::reverse_iterator::operator + (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::reverse_iterator::operator + (difference_type diff) const
 {
   reverse_iterator tmp = *this;
   tmp += diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::reverse_iterator::operator - (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::reverse_iterator::operator - (difference_type diff) const
 {
   reverse_iterator tmp = *this;
   tmp -= diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator& indexing_tree<T,A>::reverse_iterator::operator += (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator& indexing_tree<T,A,B>::reverse_iterator::operator += (difference_type diff)
 {
   iterator_base::advance_forward(-diff);
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reverse_iterator& indexing_tree<T,A>::reverse_iterator::operator -= (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator& indexing_tree<T,A,B>::reverse_iterator::operator -= (difference_type diff)
 {
   iterator_base::advance_forward(diff);
   return *this;
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::reverse_iterator::operator < (const reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::reverse_iterator::operator < (const reverse_iterator& i) const
 {
   return this->index_of() < i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::reverse_iterator::operator <= (const reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::reverse_iterator::operator <= (const reverse_iterator& i) const
 {
   return this->index_of() <= i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::reverse_iterator::operator > (const reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::reverse_iterator::operator > (const reverse_iterator& i) const
 {
   return this->index_of() > i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::reverse_iterator::operator >= (const reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::reverse_iterator::operator >= (const reverse_iterator& i) const
 {
   return this->index_of() >= i.index_of();
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::reverse_iterator::operator*()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::reverse_iterator::operator*()
 {
   return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::reverse_iterator::operator*() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::reverse_iterator::operator*() const
 {
   return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::pointer indexing_tree<T,A>::reverse_iterator::operator->()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::pointer indexing_tree<T,A,B>::reverse_iterator::operator->()
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_pointer indexing_tree<T,A>::reverse_iterator::operator->() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_pointer indexing_tree<T,A,B>::reverse_iterator::operator->() const
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::reverse_iterator::operator [] (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::reverse_iterator::operator [] (difference_type diff)
 {
   reverse_iterator tmp = *this;
   tmp += diff;
   return *tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::reverse_iterator::operator [] (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::reverse_iterator::operator [] (difference_type diff) const
 {
   const_reverse_iterator tmp = *this;
   tmp += diff;
@@ -859,128 +1665,128 @@ inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::reverse_
 //////////////////
 // const_reverse_iterator
 //////////////////
-template<class T,class A>
-inline indexing_tree<T,A>::const_reverse_iterator::const_reverse_iterator(const reverse_iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_reverse_iterator::const_reverse_iterator(const reverse_iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_reverse_iterator::const_reverse_iterator(const const_reverse_iterator& i):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_reverse_iterator::const_reverse_iterator(const const_reverse_iterator& i):
 iterator_base(i)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_reverse_iterator::const_reverse_iterator(node_type* node):
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_reverse_iterator::const_reverse_iterator(node_type* node):
 iterator_base(node)
 {
 }
 
-template<class T,class A>
-inline indexing_tree<T,A>::const_reverse_iterator::const_reverse_iterator():
+template<class T,class A,class B>
+inline indexing_tree<T,A,B>::const_reverse_iterator::const_reverse_iterator():
 iterator_base()
 {
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator& indexing_tree<T,A>::const_reverse_iterator::operator++()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator& indexing_tree<T,A,B>::const_reverse_iterator::operator++()
 {
   this->node_ = this->node_->prev_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::const_reverse_iterator::operator++(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::const_reverse_iterator::operator++(int)
 {
   const_reverse_iterator tmp = *this;
   operator++();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator& indexing_tree<T,A>::const_reverse_iterator::operator--()
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator& indexing_tree<T,A,B>::const_reverse_iterator::operator--()
 {
   this->node_ = this->node_->next_;
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::const_reverse_iterator::operator--(int)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::const_reverse_iterator::operator--(int)
 {
   const_reverse_iterator tmp = *this;
   operator--();
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::const_reverse_iterator::operator + (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::const_reverse_iterator::operator + (difference_type diff) const
 {
   const_reverse_iterator tmp = *this;
   tmp += diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::const_reverse_iterator::operator - (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::const_reverse_iterator::operator - (difference_type diff) const
 {
   const_reverse_iterator tmp = *this;
   tmp -= diff;
   return tmp;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator& indexing_tree<T,A>::const_reverse_iterator::operator += (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator& indexing_tree<T,A,B>::const_reverse_iterator::operator += (difference_type diff)
 {
   iterator_base::advance_forward(-diff);
   return *this;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator& indexing_tree<T,A>::const_reverse_iterator::operator -= (difference_type diff)
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator& indexing_tree<T,A,B>::const_reverse_iterator::operator -= (difference_type diff)
 {
   iterator_base::advance_forward(diff);
   return *this;
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_reverse_iterator::operator < (const const_reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_reverse_iterator::operator < (const const_reverse_iterator& i) const
 {
   return this->index_of() < i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_reverse_iterator::operator <= (const const_reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_reverse_iterator::operator <= (const const_reverse_iterator& i) const
 {
   return this->index_of() <= i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_reverse_iterator::operator > (const const_reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_reverse_iterator::operator > (const const_reverse_iterator& i) const
 {
   return this->index_of() > i.index_of();
 }
 
-template<class T,class A>
-inline bool indexing_tree<T,A>::const_reverse_iterator::operator >= (const const_reverse_iterator& i) const
+template<class T,class A,class B>
+inline bool indexing_tree<T,A,B>::const_reverse_iterator::operator >= (const const_reverse_iterator& i) const
 {
   return this->index_of() >= i.index_of();
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_reverse_iterator::operator*() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::const_reverse_iterator::operator*() const
 {
-  return this->node_value_;
+  return this->node_->value_;
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_pointer indexing_tree<T,A>::const_reverse_iterator::operator->() const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_pointer indexing_tree<T,A,B>::const_reverse_iterator::operator->() const
 {
   return &(this->node_->value_);
 }
 
-template<class T,class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_reverse_iterator::operator [] (difference_type diff) const
+template<class T,class A,class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::const_reverse_iterator::operator [] (difference_type diff) const
 {
   const_reverse_iterator tmp = *this;
   tmp += diff;
@@ -988,726 +1794,3785 @@ inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::const_re
 }
 
 //////////////////
-// indexing_tree
+// edit
 //////////////////
-// private member functions
-template<class T, class A>
-inline void indexing_tree<T,A>::init_sentinel_()
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::edit indexing_tree<T,A,B>::edit::insertion(size_type position, const T& x)
 {
-  sentinel_ = nodealloc_.allocate(1);
-  sentinel_->left_ = sentinel_;
-  sentinel_->next_ = sentinel_;
-  sentinel_->parent_ = sentinel_;
-  sentinel_->prev_ = sentinel_;
-  sentinel_->right_ = sentinel_;
-  sentinel_->size_ = 0;
+  edit e = { position, insert_kind, x };
+  return e;
 }
 
-template<class T, class A>
-typename indexing_tree<T,A>::node_type* indexing_tree<T,A>::select(size_type n)
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::edit indexing_tree<T,A,B>::edit::erasure(size_type position)
 {
-  size_type i = n;
-  node_type *p = sentinel_->left_;
-  while ( !is_sentinel(p) && (i != p->left_->size_))
-  {
-    if ( i < p->left_->size_ )
-    {
-      p = p->left_;
-    }
-    else
-    {
-      i -= p->left_->size_ + 1;
-      p = p->right_;
-    }
-  }
-  return p;
+  edit e = { position, erase_kind, T() };
+  return e;
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::range_check_lt(size_type n) const
+//////////////////
+// node_handle
+//////////////////
+template<class T, class A, class B>
+inline indexing_tree<T,A,B>::node_handle::node_handle()
+  : node_(0)
 {
-  if ( sentinel_->left_->size_ < n )
-  {
-    throw std::out_of_range("indexing_tree::out_of_range");
-  }
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::range_check_leq(size_type n) const
+template<class T, class A, class B>
+inline indexing_tree<T,A,B>::node_handle::node_handle(node_type* p, const allocator_type& alloc)
+  : node_(0)
 {
-  if ( sentinel_->left_->size_ <= n )
-  {
-    throw std::out_of_range("indexing_tree::out_of_range");
-  }
+  ::new(static_cast<void*>(&alloc_)) allocator_type(alloc);
+  node_ = p;
 }
 
-template<class T, class A>
-inline bool indexing_tree<T,A>::is_balanced(node_type* p) const
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+template<class T, class A, class B>
+inline indexing_tree<T,A,B>::node_handle::node_handle(node_handle&& that)
+  : node_(0)
 {
-  if (p->left_->size_ < p->right_->size_)
+  take(that);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_handle& indexing_tree<T,A,B>::node_handle::operator = (node_handle&& that)
+{
+  if (this != &that)
   {
-    return ( (p->right_->size_ - p->left_->size_) <= (p->left_->size_ + 1) );
+    reset();
+    take(that);
   }
-  return ( (p->left_->size_ - p->right_->size_) <= (p->right_->size_ + 1) );
+  return *this;
+}
+#else
+template<class T, class A, class B>
+inline indexing_tree<T,A,B>::node_handle::node_handle(const node_handle& that)
+  : node_(0)
+{
+  take(that);
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::fix_up(node_type* p)
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_handle& indexing_tree<T,A,B>::node_handle::operator = (const node_handle& that)
 {
-  while (!is_sentinel(p))
+  if (this != &that)
   {
-    node_type *parent = p->parent_;
-    rebalance(p);
-    p = parent;
+    reset();
+    take(that);
   }
+  return *this;
 }
+#endif
 
-template<class T, class A>
-void indexing_tree<T,A>::fix_up_incr(node_type* p)
+template<class T, class A, class B>
+inline indexing_tree<T,A,B>::node_handle::~node_handle()
 {
-  while (!is_sentinel(p))
+  reset();
+}
+
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::node_handle::empty() const
+{
+  return node_ == 0;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_handle::value_type& indexing_tree<T,A,B>::node_handle::value() const
+{
+  return node_->value_;
+}
+
+// requires !empty(): an empty handle holds no allocator
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_handle::allocator_type indexing_tree<T,A,B>::node_handle::get_allocator() const
+{
+  return alloc();
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::node_handle::swap(node_handle& that)
+{
+  if (this != &that)
   {
-    node_type *parent = p->parent_;
-    ++p->size_;
-    rebalance(p);
-    p = parent;
+    node_handle tmp;
+    tmp.take(*this);
+    take(that);
+    that.take(tmp);
   }
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::fix_up_decr(node_type* p)
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_handle::allocator_type& indexing_tree<T,A,B>::node_handle::alloc() const
 {
-  while (!is_sentinel(p))
+  return *static_cast<allocator_type*>(static_cast<void*>(&alloc_));
+}
+
+// moves the node and its allocator out of that; requires empty()
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::node_handle::take(const node_handle& that)
+{
+  if (that.node_ != 0)
   {
-    node_type *parent = p->parent_;
-    --p->size_;
-    rebalance(p);
-    p = parent;
+    ::new(static_cast<void*>(&alloc_)) allocator_type(that.alloc());
+    node_ = that.release();
   }
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::rebalance(node_type* p)
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::node_handle::release() const
 {
-  while (!is_balanced(p))
+  node_type* p = node_;
+  if (p != 0)
   {
-    if (p->right_->size_ < p->left_->size_)
-    {
-      if (p->right_->size_ + p->left_->right_->size_ <= 2*p->left_->left_->size_)
-      {
-        ll_rotation(p);
-        return;
-      }
-      node_type* pp = p;
-      if (p->left_->right_->left_->size_ < p->left_->right_->right_->size_)
-      {
-        pp = p->left_;
-      }
-      lr_rotation(p);
-      p = pp;
-    }
-    else
-    {
-      if (p->left_->size_ + p->right_->left_->size_ <= 2*p->right_->right_->size_)
-      {
-        rr_rotation(p);
-        return;
-      }
-      node_type* pp = p;
-      if (p->right_->left_->right_->size_ < p->right_->left_->left_->size_)
-      {
-        pp = p->right_;
-      }
-      rl_rotation(p);
-      p = pp;
-    }
+    alloc().~allocator_type();
+    node_ = 0;
   }
+  return p;
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::ll_rotation(node_type* p)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::node_handle::reset()
 {
-  node_type *q = p->left_;
-  q->size_ = p->size_;
-  p->size_ -= (q->left_->size_ + 1);
-  if (p->parent_->left_ == p)
+  if (node_ != 0)
   {
-    p->parent_->left_ = q;
+    indexing_tree::destroy_value(alloc(), &(node_->value_));
+    node_allocator_type nodealloc(alloc());
+    nodealloc.deallocate(node_,1);
+    release();
   }
-  else
+}
+
+//////////////////
+// cursor
+//////////////////
+template<class T, class A, class B>
+indexing_tree<T,A,B>::cursor::cursor(indexing_tree& tree, iterator position)
+  : tree_(&tree),position_(position.node_),first_(0),last_(0),pending_(0)
+{
+  extension* e = tree.extend();
+  if (e->cursor_ != 0)
   {
-    p->parent_->right_ = q;
+    e->cursor_->flush();
+    e->cursor_->detach();
   }
-  q->parent_ = p->parent_;
-  p->left_ = q->right_;
-  if (!is_sentinel(p->left_))
+  e->cursor_ = this;
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::cursor::~cursor()
+{
+  if (tree_ != 0)
   {
-    p->left_->parent_ = p;
+    flush();
+    tree_->extension_->cursor_ = 0;
   }
-  q->right_ = p;
-  p->parent_ = q;
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::rr_rotation(node_type* p)
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::cursor::position() const
 {
-  node_type *q = p->right_;
-  q->size_ = p->size_;
-  p->size_ -= (q->right_->size_ + 1);
-  if (p->parent_->left_ == p)
+  return iterator(position_);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::cursor::pending() const
+{
+  return pending_;
+}
+
+// Inserts x in front of position().
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::cursor::insert(const T& x)
+{
+  node_type* p = tree_->newitem(x);
+  p->parent_ = 0;
+  p->prev_ = last_;
+  if (last_ == 0)
   {
-    p->parent_->left_ = q;
+    first_ = p;
   }
   else
   {
-    p->parent_->right_ = q;
-  }
-  q->parent_ = p->parent_;
-  p->right_ = q->left_;
-  if (!is_sentinel(p->right_))
-  {
-    p->right_->parent_ = p;
+    last_->next_ = p;
   }
-  q->left_ = p;
-  p->parent_ = q;
+  last_ = p;
+  ++pending_;
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::lr_rotation(node_type* p)
+// Erases the element at position() and moves to the next one.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::cursor::erase()
 {
-  node_type *q = p->left_;
-  node_type *r = q->right_;
-  r->size_ = p->size_;
-  p->size_ -= (q->size_ - r->right_->size_);
-  q->size_ -= (r->right_->size_ + 1);
-  if (p->parent_->left_ == p)
-  {
-    p->parent_->left_ = r;
-  }
-  else
+  node_type* p = position_;
+  if (is_sentinel(p))
   {
-    p->parent_->right_ = r;
+    return;
   }
-  r->parent_ = p->parent_;
-  p->left_ = r->right_;
-  if (!is_sentinel(p->left_))
+  position_ = tree_->unlink(p);
+  tree_->deleteitem(p);
+}
+
+// Erases the element in front of position(), if any.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::cursor::erase_before()
+{
+  if (pending_ != 0)
   {
-    p->left_->parent_ = p;
+    node_type* p = last_;
+    last_ = p->prev_;
+    if (--pending_ == 0)
+    {
+      first_ = 0;
+    }
+    tree_->deleteitem(p);
+    return;
   }
-  q->right_ = r->left_;
-  if (!is_sentinel(q->right_))
+  node_type* p = position_->prev_;
+  if (is_sentinel(p))
   {
-    q->right_->parent_ = q;
+    return;
   }
-  p->parent_ = r;
-  q->parent_ = r;
-  r->left_ = q;
-  r->right_ = p;
+  tree_->unlink(p);
+  tree_->deleteitem(p);
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::rl_rotation(node_type* p)
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::cursor::move_to(iterator position)
 {
-  node_type *q = p->right_;
-  node_type *r = q->left_;
-  r->size_ = p->size_;
-  p->size_ -= (q->size_ - r->left_->size_);
-  q->size_ -= (r->left_->size_ + 1);
-  if (p->parent_->left_ == p)
+  flush();
+  position_ = position.node_;
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::cursor::flush()
+{
+  if (pending_ == 0)
   {
-    p->parent_->left_ = r;
+    return;
   }
-  else
+  tree_->splice_before(position_, first_, last_, pending_, typename B::category());
+  first_ = 0;
+  last_ = 0;
+  pending_ = 0;
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::cursor::detach()
+{
+  tree_ = 0;
+}
+
+//////////////////
+// indexing_tree
+//////////////////
+// private member functions
+template<class T, class A, class B>
+indexing_tree<T,A,B>::sentinel_storage::sentinel_storage()
+{
+  node_type* p = address();
+  init(p);
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::sentinel_storage::sentinel_storage(node_type* nil)
+{
+  init(nil);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::sentinel_storage::address() const
+{
+  return static_cast<node_type*>(const_cast<void*>(static_cast<const void*>(&storage_)));
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::sentinel_storage::init(node_type* nil)
+{
+  node_type* p = address();
+  p->left_ = nil;
+  p->next_ = p;
+  p->parent_ = p;
+  p->prev_ = p;
+  p->right_ = nil;
+  p->size_ = 0;
+  init_sentinel_node(p);
+}
+
+// Every tree keeps its sentinel inside the object, so that constructing,
+// moving and destroying an empty tree does not allocate and end() stays
+// end() for the whole life of the tree. The empty subtrees below the leaves
+// all point at this one read-only node instead, which leaves moves and
+// swaps O(1); nothing ever writes to it.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::nil()
+{
+  static const sentinel_storage storage;
+  return storage.address();
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::sentinel() const
+{
+  return header_.address();
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::select(size_type n) const
+{
+  return select(sentinel(), n);
+}
+
+// Returns the node at index n of the tree with sentinel s, or s for n ==
+// size(); the end buffers are walked along the chain.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::select(node_type* s, size_type n)
+{
+  size_type head = head_buffered(s);
+  if (n < head)
   {
-    p->parent_->right_ = r;
+    node_type* p = s->next_;
+    for (; n != 0; --n)
+    {
+      p = p->next_;
+    }
+    return p;
   }
-  r->parent_ = p->parent_;
-  p->right_ = r->left_;
-  if (!is_sentinel(p->right_))
+  size_type i = n - head;
+  node_type *p = s->left_;
+  if (p->size_ <= i)
   {
-    p->right_->parent_ = p;
+    i -= p->size_;
+    size_type tail = tail_buffered(s);
+    if (tail < i)
+    {
+      throw std::out_of_range("indexing_tree::out_of_range");
+    }
+    p = s;
+    for (i = tail - i; i != 0; --i)
+    {
+      p = p->prev_;
+    }
+    return p;
   }
-  q->left_ = r->right_;
-  if (!is_sentinel(q->left_))
+  while ( !is_sentinel(p) && (i != p->left_->size_))
   {
-    q->left_->parent_ = q;
+    if ( i < p->left_->size_ )
+    {
+      p = p->left_;
+    }
+    else
+    {
+      i -= p->left_->size_ + 1;
+      p = p->right_;
+    }
   }
-  p->parent_ = r;
-  q->parent_ = r;
-  r->right_ = q;
-  r->left_ = p;
+  return p;
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::node_type* indexing_tree<T,A>::newitem(const T& x)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::range_check_lt(size_type n) const
 {
-  node_type* item = nodealloc_.allocate(1);
-  try
-  {
-    alloc_.construct(&(item->value_), x);
-    return item;
-  }
-  catch (...)
+  if ( size() < n )
   {
-    nodealloc_.deallocate(item,1);
-    throw;
+    throw std::out_of_range("indexing_tree::out_of_range");
   }
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::put_first_element(node_type* p)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::range_check_leq(size_type n) const
 {
-  sentinel_->left_ = p;
-  sentinel_->next_ = p;
-  sentinel_->prev_ = p;
-  sentinel_->right_ = p;
-  p->parent_ = sentinel_;
-  p->left_ = sentinel_;
-  p->right_ = sentinel_;
-  p->next_ = sentinel_;
-  p->prev_ = sentinel_;
-  p->size_ = 1;
+  if ( size() <= n )
+  {
+    throw std::out_of_range("indexing_tree::out_of_range");
+  }
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::deleteitem(node_type* p)
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::is_balanced(node_type* p) const
 {
-  alloc_.destroy(get_allocator().address(p->value_));
-  nodealloc_.deallocate(p,1);
+  if (p->left_->size_ < p->right_->size_)
+  {
+    return B::is_balanced(p->right_->size_, p->left_->size_);
+  }
+  return B::is_balanced(p->left_->size_, p->right_->size_);
 }
 
-template<class T, class A>
-inline bool indexing_tree<T,A>::is_sentinel(node_type* p)
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up(node_type* p)
 {
-  return p->parent_ == p;
+  while (!is_sentinel(p))
+  {
+    node_type *parent = p->parent_;
+    rebalance(p);
+    p = parent;
+  }
 }
 
-template<class T, class A>
-template<bool Is_integral, class InIter>
-indexing_tree<T,A>::private_insert<Is_integral,InIter>::private_insert(indexing_tree<T,A>& that, iterator position, InIter first, InIter last)
+// A rotation keeps the size of the rotated subtree, so above the first
+// level the only input to the balance test is the size of the child we came
+// from: with L+R+1 == size, only the grown side can become too heavy after an
+// insertion, and only the other side after an erasure. The walk therefore
+// never loads the sibling, and rebalance() is only entered where a rotation
+// is actually due.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_incr(node_type* p)
 {
-  InIter it(first);
-  indexing_tree<T,A>::iterator prev = position;
-  indexing_tree<T,A>::iterator p = prev--;
-  try
+  if (is_sentinel(p))
+  {
+    return;
+  }
+  node_type *parent = p->parent_;
+  size_type grown = ++p->size_;
+  pull(p);
+  rebalance(p);
+  p = parent;
+  while (!is_sentinel(p))
   {
-    for (;it != last;++it)
+    parent = p->parent_;
+    size_type sz = ++p->size_;
+    pull(p);
+    if (!B::is_balanced(grown, sz - 1 - grown))
     {
-      p = that.insert(position, *it);
+      rebalance(p);
     }
+    grown = sz;
+    p = parent;
   }
-  catch (...)
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_decr(node_type* p)
+{
+  if (is_sentinel(p))
+  {
+    return;
+  }
+  node_type *parent = p->parent_;
+  size_type shrunk = --p->size_;
+  pull(p);
+  rebalance(p);
+  p = parent;
+  while (!is_sentinel(p))
   {
-    while (p != prev)
+    parent = p->parent_;
+    size_type sz = --p->size_;
+    pull(p);
+    if (!B::is_balanced(sz - 1 - shrunk, shrunk))
     {
-      p = that.erase(p);
+      rebalance(p);
     }
-    throw;
+    shrunk = sz;
+    p = parent;
   }
 }
 
-template<class T, class A>
-template<class InIter>
-indexing_tree<T,A>::private_insert<true,InIter>::private_insert(indexing_tree<T,A>& that, iterator position, InIter first, InIter last)
+// Restructuring hooks, dispatched on the category of the balance policy.
+// fix_up_insert() takes a freshly linked leaf whose ancestors do not count it
+// yet; fix_up_erase() takes the lowest node whose subtree lost an element.
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::fix_up_insert(node_type* n)
 {
-  that.insert(position, static_cast<size_type>(first), static_cast<T>(last));
+  pull(n);
+  fix_up_insert(n, typename B::category());
 }
 
-// public member functions
-template<class T, class A>
-indexing_tree<T,A>::indexing_tree(const A& alloc)
-  : alloc_(alloc),sentinel_(0),nodealloc_(node_allocator_type())
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::fix_up_insert(node_type* n, weight_balanced_tag)
 {
-  init_sentinel_();
+  fix_up_incr(n->parent_);
 }
 
-template<class T, class A>
-indexing_tree<T,A>::indexing_tree(size_type n,const T& x, const A& alloc)
-  : alloc_(alloc),sentinel_(0),nodealloc_(node_allocator_type())
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_insert(node_type* n, treap_tag)
 {
-  init_sentinel_();
-  insert(begin(), n, x);
+  increment_sizes(n->parent_);
+  while (!is_sentinel(n->parent_) && n->parent_->priority_ < n->priority_)
+  {
+    rotate_up(n);
+  }
 }
 
-template<class T, class A>
-template<class InIter>
-indexing_tree<T,A>::indexing_tree(InIter first, InIter last, const A& alloc)
-  : alloc_(alloc),sentinel_(0),nodealloc_(node_allocator_type())
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_insert(node_type* n, splay_tag)
 {
-  init_sentinel_();
-  insert(begin(), first, last);
+  increment_sizes(n->parent_);
+  splay(n);
 }
 
-template<class T, class A>
-indexing_tree<T,A>::indexing_tree(const indexing_tree& that)
-  : alloc_(that.get_allocator()),sentinel_(0),nodealloc_(node_allocator_type())
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::fix_up_erase(node_type* p)
 {
-  init_sentinel_();
-  insert(that.begin(), that.end());
+  fix_up_erase(p, typename B::category());
 }
 
-template<class T, class A>
-indexing_tree<T,A>::~indexing_tree()
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::fix_up_erase(node_type* p, weight_balanced_tag)
 {
-  clear();
-  nodealloc_.deallocate(sentinel_,1);
+  fix_up_decr(p);
 }
 
-template<class T, class A>
-indexing_tree<T,A>& indexing_tree<T,A>::operator=(const indexing_tree& that)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::fix_up_erase(node_type* p, treap_tag)
 {
-  if (this == &that)
+  decrement_sizes(p);
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_erase(node_type* p, splay_tag)
+{
+  decrement_sizes(p);
+  if (!is_sentinel(p))
   {
-    return *this;
+    splay(p);
   }
-  assign(that.begin(), that.end());
-  return *this;
 }
 
-template<class T, class A>
-template<class InIter>
-void indexing_tree<T,A>::assign(InIter first, InIter last)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::prepare_erase(node_type*, weight_balanced_tag)
 {
-  indexing_tree tmp(first,last);
-  swap(tmp);
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::assign(size_type n, const T& x)
+// Rotates p down, always lifting the child with the higher priority, until
+// it has at most one child; erase() then only has to splice it out.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::prepare_erase(node_type* p, treap_tag)
 {
-  indexing_tree tmp(n,x);
-  swap(tmp);
+  while (!is_sentinel(p->left_) && !is_sentinel(p->right_))
+  {
+    rotate_up(p->left_->priority_ < p->right_->priority_ ? p->right_ : p->left_);
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::allocator_type indexing_tree<T,A>::get_allocator() const
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::prepare_erase(node_type*, splay_tag)
 {
-  return alloc_;
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::begin()
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_node(node_type*, weight_balanced_tag)
+{
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_node(node_type* p, treap_tag)
+{
+  p->priority_ = balance_.next_priority();
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_node(node_type*, splay_tag)
 {
-  return iterator(sentinel_->next_);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::begin() const
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::touch(node_type*, weight_balanced_tag)
 {
-  return const_iterator(sentinel_->next_);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::iterator indexing_tree<T,A>::end()
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::touch(node_type*, treap_tag)
 {
-  return iterator(sentinel_);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_iterator indexing_tree<T,A>::end() const
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::touch(node_type* p, splay_tag)
 {
-  return const_iterator(sentinel_);
+  splay(p);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::rbegin()
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::increment_sizes(node_type* p)
 {
-  return reverse_iterator(sentinel_->prev_);
+  while (!is_sentinel(p))
+  {
+    ++p->size_;
+    pull(p);
+    p = p->parent_;
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::rbegin() const
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::decrement_sizes(node_type* p)
 {
-  return const_reverse_iterator(sentinel_->prev_);
+  while (!is_sentinel(p))
+  {
+    --p->size_;
+    pull(p);
+    p = p->parent_;
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::reverse_iterator indexing_tree<T,A>::rend()
+// Exchanges p with its parent by a single rotation.
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::rotate_up(node_type* p)
 {
-  return reverse_iterator(sentinel_);
+  node_type* q = p->parent_;
+  if (q->left_ == p)
+  {
+    ll_rotation(q);
+  }
+  else
+  {
+    rr_rotation(q);
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reverse_iterator indexing_tree<T,A>::rend() const
+// Bottom-up splay of p to the root.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::splay(node_type* p)
 {
-  return const_reverse_iterator(sentinel_);
+  while (!is_sentinel(p->parent_))
+  {
+    node_type* q = p->parent_;
+    node_type* g = q->parent_;
+    if (is_sentinel(g))
+    {
+      rotate_up(p);
+    }
+    else if ((g->left_ == q) == (q->left_ == p))
+    {
+      rotate_up(q);
+      rotate_up(p);
+    }
+    else
+    {
+      rotate_up(p);
+      rotate_up(p);
+    }
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::size_type indexing_tree<T,A>::size() const
+// Rotates at p until it is balanced. The nodes a rotation moves down are
+// rebalanced in turn, which keeps every balance policy, not only the default
+// one, from leaving an unbalanced node behind.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::rebalance(node_type* p)
 {
-  return sentinel_->left_->size_;
+  while (!is_balanced(p))
+  {
+    node_type* top;
+    if (p->right_->size_ < p->left_->size_)
+    {
+      node_type* q = p->left_;
+      if (B::is_single_rotation(q->left_->size_, q->right_->size_, p->right_->size_))
+      {
+        top = q;
+        ll_rotation(p);
+        rebalance(p);
+      }
+      else
+      {
+        top = q->right_;
+        lr_rotation(p);
+        rebalance(q);
+        rebalance(p);
+      }
+    }
+    else
+    {
+      node_type* q = p->right_;
+      if (B::is_single_rotation(q->right_->size_, q->left_->size_, p->left_->size_))
+      {
+        top = q;
+        rr_rotation(p);
+        rebalance(p);
+      }
+      else
+      {
+        top = q->left_;
+        rl_rotation(p);
+        rebalance(q);
+        rebalance(p);
+      }
+    }
+    p = top;
+  }
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::ll_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  q->size_ = p->size_;
+  p->size_ -= (q->left_->size_ + 1);
+  if (p->parent_->left_ == p)
+  {
+    p->parent_->left_ = q;
+  }
+  else
+  {
+    p->parent_->right_ = q;
+  }
+  q->parent_ = p->parent_;
+  p->left_ = q->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = p;
+  p->parent_ = q;
+  pull(p);
+  pull(q);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::rr_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  q->size_ = p->size_;
+  p->size_ -= (q->right_->size_ + 1);
+  if (p->parent_->left_ == p)
+  {
+    p->parent_->left_ = q;
+  }
+  else
+  {
+    p->parent_->right_ = q;
+  }
+  q->parent_ = p->parent_;
+  p->right_ = q->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = p;
+  p->parent_ = q;
+  pull(p);
+  pull(q);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::lr_rotation(node_type* p)
+{
+  node_type *q = p->left_;
+  node_type *r = q->right_;
+  r->size_ = p->size_;
+  p->size_ -= (q->size_ - r->right_->size_);
+  q->size_ -= (r->right_->size_ + 1);
+  if (p->parent_->left_ == p)
+  {
+    p->parent_->left_ = r;
+  }
+  else
+  {
+    p->parent_->right_ = r;
+  }
+  r->parent_ = p->parent_;
+  p->left_ = r->right_;
+  if (!is_sentinel(p->left_))
+  {
+    p->left_->parent_ = p;
+  }
+  q->right_ = r->left_;
+  if (!is_sentinel(q->right_))
+  {
+    q->right_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->left_ = q;
+  r->right_ = p;
+  pull(p);
+  pull(q);
+  pull(r);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::rl_rotation(node_type* p)
+{
+  node_type *q = p->right_;
+  node_type *r = q->left_;
+  r->size_ = p->size_;
+  p->size_ -= (q->size_ - r->left_->size_);
+  q->size_ -= (r->left_->size_ + 1);
+  if (p->parent_->left_ == p)
+  {
+    p->parent_->left_ = r;
+  }
+  else
+  {
+    p->parent_->right_ = r;
+  }
+  r->parent_ = p->parent_;
+  p->right_ = r->left_;
+  if (!is_sentinel(p->right_))
+  {
+    p->right_->parent_ = p;
+  }
+  q->left_ = r->right_;
+  if (!is_sentinel(q->left_))
+  {
+    q->left_->parent_ = q;
+  }
+  p->parent_ = r;
+  q->parent_ = r;
+  r->right_ = q;
+  r->left_ = p;
+  pull(p);
+  pull(q);
+  pull(r);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::newitem(const T& x)
+{
+  node_type* item = nodealloc_.allocate(1);
+  try
+  {
+    construct_value(alloc_, &(item->value_), x);
+    init_node(item, typename B::category());
+    init_item(item, typename augmentation_of<B>::type());
+    return item;
+  }
+  catch (...)
+  {
+    nodealloc_.deallocate(item,1);
+    throw;
+  }
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::put_first_element(node_type* p)
+{
+  sentinel()->left_ = p;
+  sentinel()->next_ = p;
+  sentinel()->prev_ = p;
+  sentinel()->right_ = p;
+  p->parent_ = sentinel();
+  p->left_ = nil();
+  p->right_ = nil();
+  p->next_ = sentinel();
+  p->prev_ = sentinel();
+  p->size_ = 1;
+  pull(p);
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::deleteitem(node_type* p)
+{
+  destroy_value(alloc_, &(p->value_));
+  nodealloc_.deallocate(p,1);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::allocator_type indexing_tree<T,A,B>::select_allocator(const allocator_type& alloc)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  return std::allocator_traits<A>::select_on_container_copy_construction(alloc);
+#else
+  return alloc;
+#endif
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::construct_value(allocator_type& alloc, T* p, const T& x)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::construct(alloc, p, x);
+#else
+  alloc.construct(p, x);
+#endif
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::destroy_value(allocator_type& alloc, T* p)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::destroy(alloc, p);
+#else
+  alloc.destroy(p);
+#endif
+}
+
+// constructs *p from x, which is about to be destroyed
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::relocate_value(allocator_type& alloc, T* p, T& x)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::construct(alloc, p, std::move(x));
+#else
+  alloc.construct(p, x);
+#endif
+}
+
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::is_sentinel(node_type* p)
+{
+  return p->parent_ == p;
+}
+
+template<class T, class A, class B>
+template<bool Is_integral, class InIter>
+indexing_tree<T,A,B>::private_insert<Is_integral,InIter>::private_insert(indexing_tree<T,A,B>& that, iterator position, InIter first, InIter last)
+{
+  if (first == last)
+  {
+    return;
+  }
+  InIter it(first);
+  indexing_tree<T,A,B>::iterator p = position;
+  try
+  {
+    p = that.insert(position, *it);
+    for (++it;it != last;++it)
+    {
+      that.insert(position, *it);
+    }
+  }
+  catch (...)
+  {
+    while (p != position)
+    {
+      p = that.erase(p);
+    }
+    throw;
+  }
+}
+
+template<class T, class A, class B>
+template<class InIter>
+indexing_tree<T,A,B>::private_insert<true,InIter>::private_insert(indexing_tree<T,A,B>& that, iterator position, InIter first, InIter last)
+{
+  that.insert(position, static_cast<size_type>(first), static_cast<T>(last));
+}
+
+// public member functions
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(const A& alloc)
+  : header_(nil()),alloc_(alloc),nodealloc_(alloc),extension_(0)
+{
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(size_type n,const T& x, const A& alloc)
+  : header_(nil()),alloc_(alloc),nodealloc_(alloc),extension_(0)
+{
+  insert(begin(), n, x);
+}
+
+template<class T, class A, class B>
+template<class InIter>
+indexing_tree<T,A,B>::indexing_tree(InIter first, InIter last, const A& alloc)
+  : header_(nil()),alloc_(alloc),nodealloc_(alloc),extension_(0)
+{
+  insert(begin(), first, last);
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(const indexing_tree& that)
+  : header_(nil()),alloc_(select_allocator(that.alloc_)),nodealloc_(alloc_),extension_(0)
+{
+  copy_construct(that);
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(const indexing_tree& that, const A& alloc)
+  : header_(nil()),alloc_(alloc),nodealloc_(alloc_),extension_(0)
+{
+  copy_construct(that);
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+// Takes the nodes over together with the allocator that made them; that is
+// left empty.
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(indexing_tree&& that) throw()
+  : header_(nil()),alloc_(std::move(that.alloc_)),nodealloc_(std::move(that.nodealloc_)),extension_(0)
+{
+  swap_elements(that);
+}
+
+// Takes the nodes over when alloc can release them; otherwise the elements
+// are copied into nodes from alloc, as in move assignment.
+template<class T, class A, class B>
+indexing_tree<T,A,B>::indexing_tree(indexing_tree&& that, const A& alloc)
+  : header_(nil()),alloc_(alloc),nodealloc_(alloc_),extension_(0)
+{
+  if (alloc_ == that.alloc_)
+  {
+    swap_elements(that);
+    return;
+  }
+  copy_construct(that);
+  that.clear();
+}
+#endif
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>::~indexing_tree()
+{
+  clear();
+  if (extension_ != 0)
+  {
+    if (extension_->cursor_ != 0)
+    {
+      extension_->cursor_->detach();
+    }
+    extension_allocator_type alloc(alloc_);
+    alloc.deallocate(extension_, 1);
+  }
+}
+
+template<class T, class A, class B>
+indexing_tree<T,A,B>& indexing_tree<T,A,B>::operator=(const indexing_tree& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  copy_assign(that, typename allocator_propagation<A>::copy_assignment());
+  return *this;
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+template<class T, class A, class B>
+indexing_tree<T,A,B>& indexing_tree<T,A,B>::operator=(indexing_tree&& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  move_assign(that, typename allocator_propagation<A>::move_assignment());
+  return *this;
+}
+#endif
+
+template<class T, class A, class B>
+template<class InIter>
+void indexing_tree<T,A,B>::assign(InIter first, InIter last)
+{
+  indexing_tree tmp(first,last,alloc_);
+  tmp.set_end_buffer(end_buffer());
+  swap_elements(tmp);
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::assign(size_type n, const T& x)
+{
+  indexing_tree tmp(n,x,alloc_);
+  tmp.set_end_buffer(end_buffer());
+  swap_elements(tmp);
+}
+
+// Replaces the contents by the n elements at first. With the weight
+// balanced policy the nodes are chained in order and the tree is built
+// over them in one linear pass, without any rebalancing.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::assign_from(const T* first, size_type n)
+{
+  indexing_tree tmp(alloc_);
+  tmp.set_end_buffer(end_buffer());
+  tmp.build_from(first, n, typename B::category());
+  swap_elements(tmp);
+}
+
+// Walks the in-order chain, asking for the next node while the current
+// element is being copied; the elements a cursor holds back are copied
+// where they belong.
+template<class T, class A, class B>
+template<class OutIter>
+OutIter indexing_tree<T,A,B>::copy_to(OutIter out) const
+{
+  node_type* stop = (cursor_pending() != 0) ? cursor_node() : 0;
+  for (node_type* p = sentinel()->next_; ; p = p->next_)
+  {
+    if (p == stop)
+    {
+      node_type* q = attached_cursor()->first_;
+      for (size_type i = attached_cursor()->pending_; ; q = q->next_)
+      {
+        *out = q->value_;
+        ++out;
+        if (--i == 0)
+        {
+          break;
+        }
+      }
+    }
+    if (p == sentinel())
+    {
+      break;
+    }
+    INDEXING_TREE_PREFETCH(p->next_);
+    *out = p->value_;
+    ++out;
+  }
+  return out;
+}
+
+// With threads > 1 the subtrees of large trees are copied in parallel into
+// their own slices of the vector. This needs the vector sized up front, so
+// trivial elements are zeroed before they are copied; other elements are
+// copied in one pass.
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::vector_type indexing_tree<T,A,B>::to_vector(unsigned threads) const
+{
+  return copy_to_vector<vector_type>(threads);
+}
+
+// As to_vector(), but the vector's allocator leaves trivial elements
+// unwritten when it is sized, so each element is written once. The vector
+// type differs from std::vector<T, Alloc>.
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::uninitialized_vector_type indexing_tree<T,A,B>::to_uninitialized_vector(unsigned threads) const
+{
+  return copy_to_vector<uninitialized_vector_type>(threads);
+}
+
+template<class T, class A, class B>
+template<class Vector>
+Vector indexing_tree<T,A,B>::copy_to_vector(unsigned threads) const
+{
+  Vector v(alloc_);
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  if (1 < threads && cursor_pending() == 0 && copy_parallel(v, threads, typename std::is_trivial<T>::type()))
+  {
+    return v;
+  }
+#endif
+  v.reserve(size());
+  copy_to(std::back_inserter(v));
+  return v;
+}
+
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+template<class T, class A, class B>
+template<class Vector>
+bool indexing_tree<T,A,B>::copy_parallel(Vector& v, unsigned threads, std::true_type) const
+{
+  size_type n = size();
+  v.resize(n);
+  if (n == 0)
+  {
+    return true;
+  }
+  T* out = &v[0];
+  node_type* p = sentinel()->next_;
+  for (size_type h = head_buffered(sentinel()); h != 0; --h, p = p->next_)
+  {
+    *out++ = p->value_;
+  }
+  if (!is_sentinel(sentinel()->left_))
+  {
+    copy_subtree(sentinel()->left_, out, threads);
+  }
+  p = sentinel()->prev_;
+  out = &v[0] + n;
+  for (size_type t = tail_buffered(sentinel()); t != 0; --t, p = p->prev_)
+  {
+    *--out = p->value_;
+  }
+  return true;
+}
+
+template<class T, class A, class B>
+template<class Vector>
+inline bool indexing_tree<T,A,B>::copy_parallel(Vector&, unsigned, std::false_type) const
+{
+  return false;
+}
+#endif
+
+// Copies the elements of that into a tree under construction, releasing
+// what was copied if an element throws.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::copy_construct(const indexing_tree& that)
+{
+  try
+  {
+    that.copy_to(std::back_inserter(*this));
+    set_end_buffer(that.end_buffer());
+  }
+  catch (...)
+  {
+    clear();
+    throw;
+  }
+}
+
+// The copy is built with the allocator the tree ends up with; the old
+// elements leave with tmp and are released by the allocator that made them.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::copy_assign(const indexing_tree& that, propagate_allocator_tag)
+{
+  indexing_tree tmp(that.alloc_);
+  that.copy_to(std::back_inserter(tmp));
+  tmp.set_end_buffer(end_buffer());
+  swap_elements(tmp);
+  swap_allocators(tmp, propagate_allocator_tag());
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::copy_assign(const indexing_tree& that, keep_allocator_tag)
+{
+  indexing_tree tmp(alloc_);
+  that.copy_to(std::back_inserter(tmp));
+  tmp.set_end_buffer(end_buffer());
+  swap_elements(tmp);
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::move_assign(indexing_tree& that, propagate_allocator_tag)
+{
+  indexing_tree tmp(std::move(that));
+  swap_elements(tmp);
+  swap_allocators(tmp, propagate_allocator_tag());
+}
+
+// Nodes can only change hands between equal allocators; otherwise the
+// elements are copied into storage from this tree's own allocator.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::move_assign(indexing_tree& that, keep_allocator_tag)
+{
+  if (alloc_ == that.alloc_)
+  {
+    indexing_tree tmp(std::move(that));
+    swap_elements(tmp);
+  }
+  else
+  {
+    assign(that.begin(), that.end());
+    that.clear();
+  }
+}
+#endif
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::allocator_type indexing_tree<T,A,B>::get_allocator() const
+{
+  return alloc_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::begin()
+{
+  flush_cursor();
+  return iterator(sentinel()->next_);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::begin() const
+{
+  flush_cursor();
+  return const_iterator(sentinel()->next_);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::end()
+{
+  flush_cursor();
+  return iterator(sentinel());
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::end() const
+{
+  flush_cursor();
+  return const_iterator(sentinel());
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::rbegin()
+{
+  flush_cursor();
+  return reverse_iterator(sentinel()->prev_);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::rbegin() const
+{
+  flush_cursor();
+  return const_reverse_iterator(sentinel()->prev_);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::reverse_iterator indexing_tree<T,A,B>::rend()
+{
+  flush_cursor();
+  return reverse_iterator(sentinel());
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reverse_iterator indexing_tree<T,A,B>::rend() const
+{
+  flush_cursor();
+  return const_reverse_iterator(sentinel());
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::size() const
+{
+  return head_buffered(sentinel()) + sentinel()->left_->size_ + tail_buffered(sentinel()) + cursor_pending();
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::max_size() const
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  return std::allocator_traits<node_allocator_type>::max_size(nodealloc_);
+#else
+  return alloc_.max_size();
+#endif
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::resize(size_type sz, const T& x)
+{
+  if (size() < sz)
+  {
+    insert(end(),sz-size(),x);
+    return;
+  }
+  while (sz < size())
+  {
+    pop_back();
+  }
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::capacity() const
+{
+  return 0;
+}
+
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::empty() const
+{
+  return (sentinel()->left_->size_ == 0 && cursor_pending() == 0);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::reserve(size_type n)
+{
+}
+
+// End buffers. With a non-zero end_buffer(), push_back/push_front link new
+// elements only into the in-order chain, ahead of or behind the tree, and
+// pops take them off there; a run is merged into the tree as one balanced
+// subtree once it reaches end_buffer() elements, and pops that reach the
+// tree first move a whole subtree of about end_buffer() elements back out.
+// A buffered node has a null parent_, and the outermost one of a run keeps
+// the length of the run in size_. Positions inside the runs are found by
+// walking the chain, so end_buffer() should stay small; anything above
+// log2(size()) makes the end operations amortized O(1). The tree part is
+// never left empty while a run exists, and every other modifier merges
+// the runs before it starts.
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::end_buffer() const
+{
+  return (extension_ != 0) ? extension_->end_buffer_ : 0;
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::set_end_buffer(size_type n)
+{
+  flush_cursor();
+  if (n != 0 || extension_ != 0)
+  {
+    extend()->end_buffer_ = n;
+  }
+  flush_ends();
+}
+
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::is_buffered(node_type* p)
+{
+  return p->parent_ == 0;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::head_buffered(node_type* s)
+{
+  return is_buffered(s->next_) ? s->next_->size_ : 0;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::tail_buffered(node_type* s)
+{
+  return is_buffered(s->prev_) ? s->prev_->size_ : 0;
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::sentinel_of(node_type* p)
+{
+  while (is_buffered(p))
+  {
+    p = p->next_;
+  }
+  while (!is_sentinel(p))
+  {
+    p = p->parent_;
+  }
+  return p;
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::flush_ends()
+{
+  if (!is_sentinel(sentinel()->left_))
+  {
+    if (is_buffered(sentinel()->next_))
+    {
+      flush_head();
+    }
+    if (is_buffered(sentinel()->prev_))
+    {
+      flush_tail();
+    }
+    return;
+  }
+  node_type* p = sentinel()->next_;
+  if (is_sentinel(p))
+  {
+    return;
+  }
+  // the tree part ran empty; the runs are all that is left
+  size_type n = 0;
+  for (node_type* q = p->next_; !is_sentinel(q); q = q->next_)
+  {
+    ++n;
+  }
+  sentinel()->left_ = p;
+  p->parent_ = sentinel();
+  p->left_ = nil();
+  p->right_ = nil();
+  p->size_ = 1;
+  pull(p);
+  if (n != 0)
+  {
+    attach_back(p->next_, n, typename B::category());
+  }
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::flush_head()
+{
+  node_type* first = sentinel()->next_;
+  size_type n = first->size_;
+  node_type* last = first;
+  for (size_type i = 1; i < n; ++i)
+  {
+    last = last->next_;
+  }
+  attach_front(first, last, n, typename B::category());
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::flush_tail()
+{
+  node_type* last = sentinel()->prev_;
+  size_type n = last->size_;
+  node_type* first = last;
+  for (size_type i = 1; i < n; ++i)
+  {
+    first = first->prev_;
+  }
+  attach_back(first, n, typename B::category());
+}
+
+// Makes the n chained nodes from first to last the left subtree of the node
+// that follows them, whose left subtree must be empty.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::attach_front(node_type* first, node_type* last, size_type n, weight_balanced_tag)
+{
+  node_type* f = last->next_;
+  node_type* sub = build_balanced(first, n);
+  f->left_ = sub;
+  sub->parent_ = f;
+  fix_up_grow(f, n);
+}
+
+template<class T, class A, class B>
+template<class Category>
+void indexing_tree<T,A,B>::attach_front(node_type*, node_type* last, size_type n, Category)
+{
+  node_type* f = last->next_;
+  for (; n != 0; --n)
+  {
+    node_type* p = f->prev_;
+    p->size_ = 1;
+    p->left_ = nil();
+    p->right_ = nil();
+    p->parent_ = f;
+    f->left_ = p;
+    fix_up_insert(p);
+    f = p;
+  }
+}
+
+// Makes the n chained nodes starting at first the right subtree of the node
+// that precedes them, whose right subtree must be empty.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::attach_back(node_type* first, size_type n, weight_balanced_tag)
+{
+  node_type* l = first->prev_;
+  node_type* p = first;
+  node_type* sub = build_balanced(p, n);
+  l->right_ = sub;
+  sub->parent_ = l;
+  fix_up_grow(l, n);
+}
+
+template<class T, class A, class B>
+template<class Category>
+void indexing_tree<T,A,B>::attach_back(node_type* first, size_type n, Category)
+{
+  node_type* l = first->prev_;
+  for (; n != 0; --n)
+  {
+    node_type* p = l->next_;
+    p->size_ = 1;
+    p->left_ = nil();
+    p->right_ = nil();
+    p->parent_ = l;
+    l->right_ = p;
+    fix_up_insert(p);
+    l = p;
+  }
+}
+
+// Moves the smallest subtree on the left spine that holds end_buffer()
+// elements out to the head buffer, unless that would empty the tree part.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::refill_front(weight_balanced_tag)
+{
+  node_type* v = sentinel()->next_;
+  while (v->size_ < end_buffer() && !is_sentinel(v->parent_))
+  {
+    v = v->parent_;
+  }
+  if (is_sentinel(v->parent_))
+  {
+    return;
+  }
+  node_type* p = v->parent_;
+  size_type n = v->size_;
+  p->left_ = nil();
+  fix_up_shrink(p, n);
+  node_type* q = sentinel()->next_;
+  q->size_ = n;
+  for (size_type i = 0; i < n; ++i, q = q->next_)
+  {
+    q->parent_ = 0;
+  }
+}
+
+template<class T, class A, class B>
+template<class Category>
+inline void indexing_tree<T,A,B>::refill_front(Category)
+{
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::refill_back(weight_balanced_tag)
+{
+  node_type* v = sentinel()->prev_;
+  while (v->size_ < end_buffer() && !is_sentinel(v->parent_))
+  {
+    v = v->parent_;
+  }
+  if (is_sentinel(v->parent_))
+  {
+    return;
+  }
+  node_type* p = v->parent_;
+  size_type n = v->size_;
+  p->right_ = nil();
+  fix_up_shrink(p, n);
+  node_type* q = sentinel()->prev_;
+  q->size_ = n;
+  for (size_type i = 0; i < n; ++i, q = q->prev_)
+  {
+    q->parent_ = 0;
+  }
+}
+
+template<class T, class A, class B>
+template<class Category>
+inline void indexing_tree<T,A,B>::refill_back(Category)
+{
+}
+
+// Augmentation hooks. pull() recomputes what a node keeps about its subtree
+// from its children and its own value, so it runs bottom-up wherever size_
+// is updated.
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::pull(node_type* p)
+{
+  pull(p, typename augmentation_of<B>::type());
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::pull(node_type*, no_augmentation_tag)
+{
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::pull(node_type* p, hash_augmentation_tag)
+{
+  node_type* l = p->left_;
+  node_type* r = p->right_;
+  hash_type h = B::add(B::multiply(l->hash_, B::base), B::element(p->value_));
+  p->hash_ = B::add(B::multiply(h, r->power_), r->hash_);
+  p->power_ = B::multiply(B::multiply(l->power_, B::base), r->power_);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_sentinel_node(node_type* s)
+{
+  init_sentinel_node(s, typename augmentation_of<B>::type());
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_sentinel_node(node_type*, no_augmentation_tag)
+{
+}
+
+// the sentinel stands for the empty sequence
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_sentinel_node(node_type* s, hash_augmentation_tag)
+{
+  s->hash_ = 0;
+  s->power_ = 1;
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::pull(node_type* p, live_count_augmentation_tag)
+{
+  p->live_ = p->left_->live_ + p->right_->live_ + (p->dead_ ? 0 : 1);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_sentinel_node(node_type* s, live_count_augmentation_tag)
+{
+  s->live_ = 0;
+  s->dead_ = true;
+}
+
+// initializes what a new node keeps beyond its links and value
+template<class T, class A, class B>
+template<class Augmentation>
+inline void indexing_tree<T,A,B>::init_item(node_type*, Augmentation)
+{
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::init_item(node_type* p, live_count_augmentation_tag)
+{
+  p->live_ = 1;
+  p->dead_ = false;
+}
+
+// Returns the hash of the first n elements, n <= size().
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::hash_type indexing_tree<T,A,B>::prefix_hash(size_type n) const
+{
+  flush_cursor();
+  hash_type h = 0;
+  node_type* p = sentinel()->next_;
+  for (; n != 0 && is_buffered(p); --n, p = p->next_)
+  {
+    h = B::add(B::multiply(h, B::base), B::element(p->value_));
+  }
+  p = sentinel()->left_;
+  while (n != 0 && !is_sentinel(p))
+  {
+    node_type* l = p->left_;
+    if (n < l->size_)
+    {
+      p = l;
+      continue;
+    }
+    h = B::add(B::multiply(h, l->power_), l->hash_);
+    n -= l->size_;
+    if (n == 0)
+    {
+      break;
+    }
+    h = B::add(B::multiply(h, B::base), B::element(p->value_));
+    --n;
+    p = p->right_;
+  }
+  if (n != 0)
+  {
+    // the rest lies in the tail buffer
+    p = sentinel()->prev_;
+    for (size_type i = p->size_; i != 1; --i)
+    {
+      p = p->prev_;
+    }
+    for (; n != 0; --n, p = p->next_)
+    {
+      h = B::add(B::multiply(h, B::base), B::element(p->value_));
+    }
+  }
+  return h;
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_grow(node_type* p, size_type n)
+{
+  while (!is_sentinel(p))
+  {
+    node_type* parent = p->parent_;
+    p->size_ += n;
+    pull(p);
+    if (!is_balanced(p))
+    {
+      rebalance(p);
+    }
+    p = parent;
+  }
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::fix_up_shrink(node_type* p, size_type n)
+{
+  while (!is_sentinel(p))
+  {
+    node_type* parent = p->parent_;
+    p->size_ -= n;
+    pull(p);
+    if (!is_balanced(p))
+    {
+      rebalance(p);
+    }
+    p = parent;
+  }
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::flush_cursor()
+{
+  cursor* c = attached_cursor();
+  if (c != 0)
+  {
+    c->flush();
+  }
+}
+
+// Const member functions that hand out positions splice the elements of a
+// cursor as well; a tree a cursor is attached to is never a const object.
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::flush_cursor() const
+{
+  if (cursor_pending() != 0)
+  {
+    attached_cursor()->flush();
+  }
+}
+
+// Flushes the cursor if its elements wait in front of position, where an
+// edit would otherwise end up on the wrong side of them.
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::flush_cursor_at(node_type* position)
+{
+  if (cursor_pending() != 0 && attached_cursor()->position_ == position)
+  {
+    attached_cursor()->flush();
+  }
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::cursor_pending() const
+{
+  cursor* c = attached_cursor();
+  return (c != 0) ? c->pending_ : 0;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::cursor* indexing_tree<T,A,B>::attached_cursor() const
+{
+  return (extension_ != 0) ? extension_->cursor_ : 0;
+}
+
+// The node the elements of the cursor go in front of.
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::cursor_node() const
+{
+  return attached_cursor()->position_;
+}
+
+// Returns the node of element n of the sequence, reading through the
+// elements a cursor holds back instead of splicing them in.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::element(size_type n) const
+{
+  size_type m = cursor_pending();
+  if (m == 0)
+  {
+    return select(n);
+  }
+  size_type k = const_iterator(cursor_node()).index_of();
+  if (n < k)
+  {
+    return select(n);
+  }
+  if (m <= n - k)
+  {
+    return select(n - m);
+  }
+  node_type* p;
+  if (n - k < m / 2)
+  {
+    p = attached_cursor()->first_;
+    for (n -= k; n != 0; --n)
+    {
+      p = p->next_;
+    }
+  }
+  else
+  {
+    p = attached_cursor()->last_;
+    for (n = k + m - 1 - n; n != 0; --n)
+    {
+      p = p->prev_;
+    }
+  }
+  return p;
+}
+
+// Links the n unlinked nodes chained from first to last in front of
+// position, in one piece.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::splice_before(node_type* position, node_type* first, node_type* last, size_type n, weight_balanced_tag)
+{
+  flush_ends();
+  if (is_sentinel(sentinel()->left_))
+  {
+    node_type* next = first->next_;
+    put_first_element(first);
+    if (--n == 0)
+    {
+      return;
+    }
+    first = next;
+    position = sentinel();
+  }
+  node_type* pred = position->prev_;
+  pred->next_ = first;
+  first->prev_ = pred;
+  last->next_ = position;
+  position->prev_ = last;
+  if (is_sentinel(position->left_))
+  {
+    attach_front(first, last, n, weight_balanced_tag());
+  }
+  else
+  {
+    attach_back(first, n, weight_balanced_tag());
+  }
+}
+
+// Rotations may hang other nodes below a node just linked in the middle of
+// the tree, so the self-adjusting policies link one node at a time.
+template<class T, class A, class B>
+template<class Category>
+void indexing_tree<T,A,B>::splice_before(node_type* position, node_type* first, node_type*, size_type n, Category)
+{
+  for (; n != 0; --n)
+  {
+    node_type* next = first->next_;
+    link_before(position, first);
+    first = next;
+  }
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::operator[](size_type n)
+{
+  range_check_leq(n);
+  node_type* p = element(n);
+  if (!is_buffered(p))
+  {
+    touch(p, typename B::category());
+  }
+  return p->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::operator[](size_type n) const
+{
+  range_check_leq(n);
+  return element(n)->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::at(size_type n)
+{
+  range_check_leq(n);
+  node_type* p = element(n);
+  if (!is_buffered(p))
+  {
+    touch(p, typename B::category());
+  }
+  return p->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::at(size_type n) const
+{
+  range_check_leq(n);
+  return element(n)->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::front()
+{
+  if (cursor_pending() != 0 && cursor_node() == sentinel()->next_)
+  {
+    return attached_cursor()->first_->value_;
+  }
+  return sentinel()->next_->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::front() const
+{
+  if (cursor_pending() != 0 && cursor_node() == sentinel()->next_)
+  {
+    return attached_cursor()->first_->value_;
+  }
+  return sentinel()->next_->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::reference indexing_tree<T,A,B>::back()
+{
+  if (cursor_pending() != 0 && cursor_node() == sentinel())
+  {
+    return attached_cursor()->last_->value_;
+  }
+  return sentinel()->prev_->value_;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_reference indexing_tree<T,A,B>::back() const
+{
+  if (cursor_pending() != 0 && cursor_node() == sentinel())
+  {
+    return attached_cursor()->last_->value_;
+  }
+  return sentinel()->prev_->value_;
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::push_back(const T& x)
+{
+  flush_cursor_at(sentinel());
+  node_type* n = newitem(x);
+  node_type* p = sentinel()->prev_;
+  if (end_buffer() == 0 || is_sentinel(p))
+  {
+    link_back(n);
+    return;
+  }
+  // the last node of the tail buffer keeps its length
+  n->size_ = is_buffered(p) ? p->size_ + 1 : 1;
+  n->parent_ = 0;
+  n->prev_ = p;
+  n->next_ = sentinel();
+  p->next_ = n;
+  sentinel()->prev_ = n;
+  if (end_buffer() <= n->size_)
+  {
+    flush_tail();
+  }
+}
+
+// Links n as the last element.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::link_back(node_type* n)
+{
+  node_type* p = sentinel()->prev_;
+  if (is_sentinel(p))
+  {
+    put_first_element(n);
+    return;
+  }
+  n->size_ = 1;
+  n->next_ = sentinel();
+  n->prev_ = p;
+  n->parent_ = p;
+  n->left_ = nil();
+  n->right_ = nil();
+  p->next_ = n;
+  p->right_ = n;
+  sentinel()->prev_ = n;
+  fix_up_insert(n);
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::pop_back()
+{
+  flush_cursor_at(sentinel());
+  node_type* p = sentinel()->prev_;
+  if (is_sentinel(p))
+  {
+    return;
+  }
+  if (end_buffer() != 0 && !is_buffered(p))
+  {
+    refill_back(typename B::category());
+    p = sentinel()->prev_;
+  }
+  if (is_buffered(p))
+  {
+    sentinel()->prev_ = p->prev_;
+    p->prev_->next_ = sentinel();
+    if (1 < p->size_)
+    {
+      p->prev_->size_ = p->size_ - 1;
+    }
+    deleteitem(p);
+    return;
+  }
+  sentinel()->prev_ = p->prev_;
+  p->prev_->next_ = sentinel();
+  node_type* pp = p->parent_;
+  node_type* l = p->left_;
+  if (l != nil())
+  {
+    l->parent_ = pp;
+  }
+  pp->right_ = l;
+  if (pp == sentinel())
+  {
+    pp->left_ = l;
+  }
+  deleteitem(p);
+  fix_up_erase(pp);
+  flush_ends();
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::push_front(const T& x)
+{
+  node_type* p = sentinel()->next_;
+  if (is_sentinel(p))
+  {
+    put_first_element(newitem(x));
+    return;
+  }
+  node_type* n = newitem(x);
+  if (end_buffer() != 0)
+  {
+    // the first node of the head buffer keeps its length
+    n->size_ = is_buffered(p) ? p->size_ + 1 : 1;
+    n->parent_ = 0;
+    n->prev_ = sentinel();
+    n->next_ = p;
+    p->prev_ = n;
+    sentinel()->next_ = n;
+    if (end_buffer() <= n->size_)
+    {
+      flush_head();
+    }
+    return;
+  }
+  n->size_ = 1;
+  n->prev_ = sentinel();
+  n->next_ = p;
+  n->parent_ = p;
+  n->left_ = nil();
+  n->right_ = nil();
+  p->prev_ = n;
+  p->left_ = n;
+  sentinel()->next_ = n;
+  fix_up_insert(n);
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::pop_front()
+{
+  flush_cursor_at(sentinel()->next_);
+  node_type* p = sentinel()->next_;
+  if (is_sentinel(p))
+  {
+    return;
+  }
+  if (end_buffer() != 0 && !is_buffered(p))
+  {
+    refill_front(typename B::category());
+    p = sentinel()->next_;
+  }
+  if (is_buffered(p))
+  {
+    sentinel()->next_ = p->next_;
+    p->next_->prev_ = sentinel();
+    if (1 < p->size_)
+    {
+      p->next_->size_ = p->size_ - 1;
+    }
+    deleteitem(p);
+    return;
+  }
+  sentinel()->next_ = p->next_;
+  p->next_->prev_ = sentinel();
+  node_type* pp = p->parent_;
+  node_type* r = p->right_;
+  if (r != nil())
+  {
+    r->parent_ = pp;
+  }
+  pp->left_ = r;
+  if (pp == sentinel())
+  {
+    pp->right_ = r;
+  }
+  deleteitem(p);
+  fix_up_erase(pp);
+  flush_ends();
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::clear()
+{
+  flush_cursor();
+  if (is_sentinel(sentinel()->left_))
+  {
+    return;
+  }
+  node_type* p = sentinel()->next_;
+  while (p != sentinel())
+  {
+    node_type* next = p->next_;
+    deleteitem(p);
+    p = next;
+  }
+  sentinel()->left_ = nil();
+  sentinel()->right_ = nil();
+  sentinel()->next_ = sentinel();
+  sentinel()->prev_ = sentinel();
+}
+
+template<class T, class A, class B>
+template<class Pred>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::erase_if(Pred pred)
+{
+  element_filter<Pred> filter(pred);
+  return erase_where(filter);
+}
+
+// x is copied first, since it may refer to an element that goes.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::remove(const T& x)
+{
+  equal_to_value pred(x);
+  element_filter<equal_to_value> filter(pred);
+  return erase_where(filter);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::unique()
+{
+  return unique(equal_values());
+}
+
+// Keeps the first element of every run of consecutive elements equal by
+// pred.
+template<class T, class A, class B>
+template<class BinaryPred>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::unique(BinaryPred pred)
+{
+  duplicate_filter<BinaryPred> filter(pred, sentinel());
+  return erase_where(filter);
+}
+
+template<class T, class A, class B>
+template<class Pred>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::partition_point(Pred pred, size_type* index)
+{
+  flush_cursor();
+  return iterator(partition_node(pred, index));
+}
+
+template<class T, class A, class B>
+template<class Pred>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::partition_point(Pred pred, size_type* index) const
+{
+  return const_iterator(partition_node(pred, index));
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::lower_bound(const T& x, size_type* index)
+{
+  return lower_bound(x, std::less<T>(), index);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::lower_bound(const T& x, size_type* index) const
+{
+  return lower_bound(x, std::less<T>(), index);
+}
+
+template<class T, class A, class B>
+template<class Compare>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::lower_bound(const T& x, Compare comp, size_type* index)
+{
+  less_than<Compare> pred(x, comp);
+  flush_cursor();
+  return iterator(partition_node(pred, index));
+}
+
+template<class T, class A, class B>
+template<class Compare>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::lower_bound(const T& x, Compare comp, size_type* index) const
+{
+  less_than<Compare> pred(x, comp);
+  return const_iterator(partition_node(pred, index));
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::upper_bound(const T& x, size_type* index)
+{
+  return upper_bound(x, std::less<T>(), index);
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::upper_bound(const T& x, size_type* index) const
+{
+  return upper_bound(x, std::less<T>(), index);
+}
+
+template<class T, class A, class B>
+template<class Compare>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::upper_bound(const T& x, Compare comp, size_type* index)
+{
+  not_greater_than<Compare> pred(x, comp);
+  flush_cursor();
+  return iterator(partition_node(pred, index));
+}
+
+template<class T, class A, class B>
+template<class Compare>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::upper_bound(const T& x, Compare comp, size_type* index) const
+{
+  not_greater_than<Compare> pred(x, comp);
+  return const_iterator(partition_node(pred, index));
+}
+
+// The end buffers hold a few elements outside the tree and are searched
+// one by one, the head before and the tail after the descent; the position
+// of a node in the tree is counted as in select().
+template<class T, class A, class B>
+template<class Pred>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::partition_node(Pred& pred, size_type* index) const
+{
+  flush_cursor();
+  size_type i = 0;
+  node_type* p = sentinel()->next_;
+  for (size_type h = head_buffered(sentinel()); h != 0; --h, ++i, p = p->next_)
+  {
+    if (!pred(p->value_))
+    {
+      break;
+    }
+  }
+  if (i == head_buffered(sentinel()))
+  {
+    node_type* found = 0;
+    size_type found_index = 0;
+    for (node_type* t = sentinel()->left_; !is_sentinel(t); )
+    {
+      if (pred(t->value_))
+      {
+        i += t->left_->size_ + 1;
+        t = t->right_;
+      }
+      else
+      {
+        found = t;
+        found_index = i + t->left_->size_;
+        t = t->left_;
+      }
+    }
+    if (found != 0)
+    {
+      p = found;
+      i = found_index;
+    }
+    else
+    {
+      p = sentinel();
+      for (size_type n = tail_buffered(sentinel()); n != 0; --n)
+      {
+        p = p->prev_;
+      }
+      for (; p != sentinel() && pred(p->value_); p = p->next_)
+      {
+        ++i;
+      }
+    }
+  }
+  if (index != 0)
+  {
+    *index = i;
+  }
+  return p;
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::hash_type indexing_tree<T,A,B>::hash() const
+{
+  return prefix_hash(size());
+}
+
+// Hash of [first, last) in O(log n), from the hashes of two prefixes.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::hash_type indexing_tree<T,A,B>::hash(const_iterator first, const_iterator last) const
+{
+  size_type i = first - begin();
+  size_type j = last - begin();
+  return B::subtract(prefix_hash(j), B::multiply(prefix_hash(i), B::power(j - i)));
+}
+
+// Compares [first, last) with the range of the same length at that_first in
+// that, by hash: unequal ranges compare equal with a probability of about
+// size / 2^61.
+template<class T, class A, class B>
+bool indexing_tree<T,A,B>::equal(const_iterator first, const_iterator last, const indexing_tree& that, const_iterator that_first) const
+{
+  difference_type n = last - first;
+  if (that.end() - that_first < n)
+  {
+    return false;
+  }
+  return hash(first, last) == that.hash(that_first, that_first + n);
+}
+
+// Returns the length of the longest common prefix of [first, end()) and
+// [that_first, that.end()), by binary search on range hashes: O(log^2 n).
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::common_prefix(const_iterator first, const indexing_tree& that, const_iterator that_first) const
+{
+  size_type i = first - begin();
+  size_type j = that_first - that.begin();
+  size_type lo = 0;
+  size_type hi = size() - i;
+  if (that.size() - j < hi)
+  {
+    hi = that.size() - j;
+  }
+  hash_type this_prefix = prefix_hash(i);
+  hash_type that_prefix = that.prefix_hash(j);
+  while (lo < hi)
+  {
+    size_type mid = hi - (hi - lo) / 2;
+    hash_type pw = B::power(mid);
+    hash_type a = B::subtract(prefix_hash(i + mid), B::multiply(this_prefix, pw));
+    hash_type b = B::subtract(that.prefix_hash(j + mid), B::multiply(that_prefix, pw));
+    if (a == b)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+// Brings the hashes up to date after the element at position was modified
+// in place through a reference.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::rehash(iterator position)
+{
+  for (node_type* p = position.node_; !is_sentinel(p) && !is_buffered(p); p = p->parent_)
+  {
+    pull(p);
+  }
+}
+
+// Flags the element at position as dead; it stays in place until
+// compact(). Only the live counts on its path are updated.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::mark_dead(iterator position)
+{
+  node_type* p = position.node_;
+  if (is_sentinel(p) || p->dead_)
+  {
+    return;
+  }
+  p->dead_ = true;
+  for (; !is_sentinel(p) && !is_buffered(p); p = p->parent_)
+  {
+    --p->live_;
+  }
+}
+
+template<class T, class A, class B>
+inline bool indexing_tree<T,A,B>::is_dead(const_iterator position) const
+{
+  return position.node_->dead_;
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::live_size() const
+{
+  size_type n = cursor_pending() + sentinel()->left_->live_;
+  for (node_type* p = sentinel()->next_; is_buffered(p); p = p->next_)
+  {
+    n += p->dead_ ? 0 : 1;
+  }
+  for (node_type* p = sentinel()->prev_; is_buffered(p); p = p->prev_)
+  {
+    n += p->dead_ ? 0 : 1;
+  }
+  return n;
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::nth_live(size_type n)
+{
+  flush_cursor();
+  return iterator(live_node(n));
+}
+
+template<class T, class A, class B>
+inline typename indexing_tree<T,A,B>::const_iterator indexing_tree<T,A,B>::nth_live(size_type n) const
+{
+  return const_iterator(live_node(n));
+}
+
+// Removes the dead elements; returns their number.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::compact()
+{
+  dead_filter filter;
+  return erase_where(filter);
+}
+
+// Returns the node of the live element n, or the sentinel for n ==
+// live_size(); the end buffers are walked along the chain.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::live_node(size_type n) const
+{
+  flush_cursor();
+  node_type* p = sentinel()->next_;
+  for (; is_buffered(p); p = p->next_)
+  {
+    if (!p->dead_)
+    {
+      if (n == 0)
+      {
+        return p;
+      }
+      --n;
+    }
+  }
+  p = sentinel()->left_;
+  if (n < p->live_)
+  {
+    for (;;)
+    {
+      node_type* l = p->left_;
+      if (n < l->live_)
+      {
+        p = l;
+        continue;
+      }
+      n -= l->live_;
+      if (!p->dead_)
+      {
+        if (n == 0)
+        {
+          return p;
+        }
+        --n;
+      }
+      p = p->right_;
+    }
+  }
+  n -= p->live_;
+  p = sentinel();
+  for (size_type k = tail_buffered(sentinel()); k != 0; --k)
+  {
+    p = p->prev_;
+  }
+  for (; p != sentinel(); p = p->next_)
+  {
+    if (!p->dead_)
+    {
+      if (n == 0)
+      {
+        return p;
+      }
+      --n;
+    }
+  }
+  if (n != 0)
+  {
+    throw std::out_of_range("indexing_tree::out_of_range");
+  }
+  return sentinel();
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::insert(iterator position, const T& x)
+{
+  flush_cursor_at(position.node_);
+  return iterator(link_before(position.node_, newitem(x)));
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::insert(iterator position, node_handle&& nh)
+#else
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::insert(iterator position, const node_handle& nh)
+#endif
+{
+  flush_cursor_at(position.node_);
+  if (nh.empty())
+  {
+    return end();
+  }
+  if (!(nh.alloc() == alloc_))
+  {
+    throw std::invalid_argument("indexing_tree::insert: node handle allocator differs from the tree's");
+  }
+  return iterator(link_before(position.node_, nh.release()));
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_handle indexing_tree<T,A,B>::extract(iterator position)
+{
+  flush_cursor_at(position.node_);
+  if (is_sentinel(position.node_))
+  {
+    return node_handle();
+  }
+  unlink(position.node_);
+  return node_handle(position.node_, alloc_);
+}
+
+// Applies a batch of edits whose positions refer to the sequence before the
+// batch and are sorted in ascending order. Insertions at the same position
+// keep their order in the batch and go in front of the element there, even
+// when that element is erased by the same batch. All new elements are
+// constructed before the tree is touched, so a throwing copy leaves it
+// unchanged.
+//
+// With the weight-balanced policy the batch is split along the tree in one
+// top-down pass and every touched subtree is rebalanced once on the way
+// back, which is O(k log(n/k + 1)) for k edits; disjoint subtrees are
+// processed by up to `threads` threads. The self-adjusting policies apply
+// the edits one by one.
+template<class T, class A, class B>
+template<class InIter>
+void indexing_tree<T,A,B>::apply_batch(InIter first, InIter last, unsigned threads)
+{
+  flush_cursor();
+  size_type n = size();
+  batch_type batch;
+  try
+  {
+    for (; first != last; ++first)
+    {
+      const edit& e = *first;
+      batch_record r;
+      r.position_ = e.position_;
+      r.node_ = 0;
+      r.anchor_ = 0;
+      r.erase_ = (e.kind_ == edit::erase_kind);
+      if (!batch.empty() && r.position_ < batch.back().position_)
+      {
+        throw std::invalid_argument("indexing_tree::apply_batch: edits are not sorted");
+      }
+      if (r.erase_ ? (n <= r.position_) : (n < r.position_))
+      {
+        throw std::out_of_range("indexing_tree::out_of_range");
+      }
+      batch.push_back(r);
+      if (!r.erase_)
+      {
+        batch.back().node_ = newitem(e.value_);
+      }
+    }
+    // move the erasure at a position behind the insertions there
+    for (size_type i = 0; i < batch.size(); )
+    {
+      size_type j = i;
+      size_type erased = batch.size();
+      while (j < batch.size() && batch[j].position_ == batch[i].position_)
+      {
+        if (batch[j].erase_)
+        {
+          if (erased != batch.size())
+          {
+            throw std::invalid_argument("indexing_tree::apply_batch: element erased twice");
+          }
+          erased = j;
+        }
+        ++j;
+      }
+      if (erased != batch.size())
+      {
+        batch_record r = batch[erased];
+        for (size_type k = erased; k + 1 < j; ++k)
+        {
+          batch[k] = batch[k + 1];
+        }
+        batch[j - 1] = r;
+      }
+      i = j;
+    }
+  }
+  catch (...)
+  {
+    for (size_type i = 0; i < batch.size(); ++i)
+    {
+      if (!batch[i].erase_ && batch[i].node_ != 0)
+      {
+        deleteitem(batch[i].node_);
+      }
+    }
+    throw;
+  }
+  if (batch.empty())
+  {
+    return;
+  }
+  flush_ends();
+  apply_batch(batch, threads, typename B::category());
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::apply_batch(batch_type& batch, unsigned threads, weight_balanced_tag)
+{
+  batch_record* first = &batch[0];
+  batch_record* last = first + batch.size();
+  batch_locate(sentinel()->left_, first, last, 0, sentinel());
+  // the in-order chain is fixed up front, so that the structural pass only
+  // touches the links inside the subtree it works on
+  for (batch_record* r = first; r != last; ++r)
+  {
+    node_type* p = r->node_;
+    if (r->erase_)
+    {
+      p->prev_->next_ = p->next_;
+      p->next_->prev_ = p->prev_;
+    }
+    else
+    {
+      node_type* n = r->anchor_;
+      node_type* m = n->prev_;
+      m->next_ = p;
+      p->prev_ = m;
+      p->next_ = n;
+      n->prev_ = p;
+    }
+  }
+  node_type* root = batch_subtree(sentinel()->left_, first, last, 0, threads);
+  sentinel()->left_ = root;
+  if (root != nil())
+  {
+    root->parent_ = sentinel();
+  }
+  for (batch_record* r = first; r != last; ++r)
+  {
+    if (r->erase_)
+    {
+      deleteitem(r->node_);
+    }
+  }
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::apply_batch(batch_type& batch, unsigned, treap_tag)
+{
+  apply_batch_one_by_one(batch);
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::apply_batch(batch_type& batch, unsigned, splay_tag)
+{
+  apply_batch_one_by_one(batch);
+}
+
+// Going from the back keeps the positions of the remaining edits valid.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::apply_batch_one_by_one(batch_type& batch)
+{
+  for (size_type i = batch.size(); i-- != 0; )
+  {
+    batch_record& r = batch[i];
+    if (r.erase_)
+    {
+      node_type* p = select(r.position_);
+      unlink(p);
+      deleteitem(p);
+    }
+    else
+    {
+      link_before(select(r.position_), r.node_);
+    }
+  }
+}
+
+// Returns the first record that does not go into the left subtree of the
+// element at position.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::batch_record* indexing_tree<T,A,B>::batch_split(batch_record* first, batch_record* last, size_type position)
+{
+  while (first != last)
+  {
+    batch_record* mid = first + (last - first) / 2;
+    if (mid->position_ < position || (mid->position_ == position && !mid->erase_))
+    {
+      first = mid + 1;
+    }
+    else
+    {
+      last = mid;
+    }
+  }
+  return first;
+}
+
+// Finds the nodes to erase and the anchors of the insertions; succ is the
+// element following the subtree t, which covers the positions from offset.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::batch_locate(node_type* t, batch_record* first, batch_record* last, size_type offset, node_type* succ)
+{
+  if (first == last)
+  {
+    return;
+  }
+  if (t == nil())
+  {
+    for (; first != last; ++first)
+    {
+      first->anchor_ = succ;
+    }
+    return;
+  }
+  size_type position = offset + t->left_->size_;
+  batch_record* mid = batch_split(first, last, position);
+  batch_locate(t->left_, first, mid, offset, t);
+  if (mid != last && mid->position_ == position)
+  {
+    mid->node_ = t;
+    ++mid;
+  }
+  batch_locate(t->right_, mid, last, position + 1, succ);
+}
+
+// Rebuilds the links of the subtree t and returns its new root; the parent
+// link of the root is left to the caller. New nodes get their parent link
+// only once they are placed, so this pass tells the sentinel apart by
+// address rather than by is_sentinel().
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::batch_subtree(node_type* t, batch_record* first, batch_record* last, size_type offset, unsigned threads)
+{
+  if (first == last)
+  {
+    return t;
+  }
+  if (t == nil())
+  {
+    return build_balanced(first, last);
+  }
+  size_type position = offset + t->left_->size_;
+  batch_record* mid = batch_split(first, last, position);
+  batch_record* rfirst = mid;
+  bool erased = (mid != last && mid->position_ == position);
+  if (erased)
+  {
+    ++rfirst;
+  }
+  node_type* l = t->left_;
+  node_type* r = t->right_;
+#if INDEXING_TREE_HAS_THREADS
+  if (1 < threads && first != mid && rfirst != last)
+  {
+    bool spawned = false;
+    std::thread worker;
+    try
+    {
+      worker = std::thread([&]() { l = batch_subtree(t->left_, first, mid, offset, threads / 2); });
+      spawned = true;
+    }
+    catch (...)
+    {
+    }
+    if (spawned)
+    {
+      r = batch_subtree(t->right_, rfirst, last, position + 1, threads - threads / 2);
+      worker.join();
+    }
+    else
+    {
+      l = batch_subtree(t->left_, first, mid, offset, 1);
+      r = batch_subtree(t->right_, rfirst, last, position + 1, 1);
+    }
+  }
+  else
+#endif
+  {
+    l = batch_subtree(l, first, mid, offset, threads);
+    r = batch_subtree(r, rfirst, last, position + 1, threads);
+  }
+  if (erased)
+  {
+    return batch_join(l, r);
+  }
+  t->left_ = l;
+  t->right_ = r;
+  if (l != nil())
+  {
+    l->parent_ = t;
+  }
+  if (r != nil())
+  {
+    r->parent_ = t;
+  }
+  t->size_ = l->size_ + r->size_ + 1;
+  pull(t);
+  if (is_balanced(t))
+  {
+    return t;
+  }
+  // rotations for small changes; a subtree that took edits of a fair share
+  // of its size is cheaper to rebuild
+  if (t->size_ <= 4 * static_cast<size_type>(last - first))
+  {
+    node_type* p = t;
+    while (p->left_ != nil())
+    {
+      p = p->left_;
+    }
+    return build_balanced(p, t->size_);
+  }
+  return rebalance_detached(t);
+}
+
+// Joins the subtrees around an erased node, moving the nearest element of
+// the larger one up in its place.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::batch_join(node_type* l, node_type* r)
+{
+  if (l == nil())
+  {
+    return r;
+  }
+  if (r == nil())
+  {
+    return l;
+  }
+  sentinel_storage holder;
+  node_type* h = holder.address();
+  node_type* m;
+  node_type* q;
+  bool from_right = l->size_ < r->size_;
+  if (from_right)
+  {
+    h->left_ = r;
+    r->parent_ = h;
+    m = r;
+    while (m->left_ != nil())
+    {
+      m = m->left_;
+    }
+    q = m->parent_;
+    if (q->left_ == m)
+    {
+      q->left_ = m->right_;
+    }
+    else
+    {
+      q->right_ = m->right_;
+    }
+    if (m->right_ != nil())
+    {
+      m->right_->parent_ = q;
+    }
+  }
+  else
+  {
+    h->left_ = l;
+    l->parent_ = h;
+    m = l;
+    while (m->right_ != nil())
+    {
+      m = m->right_;
+    }
+    q = m->parent_;
+    if (q->left_ == m)
+    {
+      q->left_ = m->left_;
+    }
+    else
+    {
+      q->right_ = m->left_;
+    }
+    if (m->left_ != nil())
+    {
+      m->left_->parent_ = q;
+    }
+  }
+  while (q != h)
+  {
+    node_type* parent = q->parent_;
+    --q->size_;
+    pull(q);
+    if (!is_balanced(q))
+    {
+      rebalance(q);
+    }
+    q = parent;
+  }
+  if (from_right)
+  {
+    r = h->left_;
+  }
+  else
+  {
+    l = h->left_;
+  }
+  m->left_ = l;
+  m->right_ = r;
+  if (l != nil())
+  {
+    l->parent_ = m;
+  }
+  if (r != nil())
+  {
+    r->parent_ = m;
+  }
+  m->size_ = l->size_ + r->size_ + 1;
+  pull(m);
+  if (is_balanced(m))
+  {
+    return m;
+  }
+  return rebalance_detached(m);
+}
+
+// Rebalances a subtree whose root is not linked to a parent yet.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::rebalance_detached(node_type* t)
+{
+  sentinel_storage holder;
+  node_type* h = holder.address();
+  h->left_ = t;
+  t->parent_ = h;
+  rebalance(t);
+  return h->left_;
+}
+
+// Builds a perfectly balanced subtree from the n nodes chained from first,
+// and leaves first at the node after them.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::build_balanced(node_type*& first, size_type n)
+{
+  if (n == 0)
+  {
+    return nil();
+  }
+  node_type* l = build_balanced(first, n / 2);
+  node_type* p = first;
+  first = first->next_;
+  node_type* r = build_balanced(first, n - n / 2 - 1);
+  p->left_ = l;
+  p->right_ = r;
+  if (l != nil())
+  {
+    l->parent_ = p;
+  }
+  if (r != nil())
+  {
+    r->parent_ = p;
+  }
+  p->size_ = n;
+  pull(p);
+  return p;
+}
+
+// Builds the contents of an empty tree from n elements; a failure leaves
+// the tree empty.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::build_from(const T* first, size_type n, weight_balanced_tag)
+{
+  if (n == 0)
+  {
+    return;
+  }
+  node_type* last = sentinel();
+  try
+  {
+    for (size_type i = 0; i < n; ++i)
+    {
+      node_type* p = newitem(first[i]);
+      last->next_ = p;
+      p->prev_ = last;
+      last = p;
+    }
+  }
+  catch (...)
+  {
+    for (node_type* p = last; p != sentinel(); )
+    {
+      node_type* prev = p->prev_;
+      deleteitem(p);
+      p = prev;
+    }
+    sentinel()->next_ = sentinel();
+    throw;
+  }
+  last->next_ = sentinel();
+  sentinel()->prev_ = last;
+  node_type* p = sentinel()->next_;
+  node_type* root = build_balanced(p, n);
+  sentinel()->left_ = root;
+  root->parent_ = sentinel();
+}
+
+template<class T, class A, class B>
+template<class Category>
+void indexing_tree<T,A,B>::build_from(const T* first, size_type n, Category)
+{
+  insert(end(), first, first + n);
+}
+
+// All new nodes of the slice are allocated before any old one is freed,
+// so that they do not land in the holes the old ones leave, and are then
+// handed out in address order; the slice thus briefly needs twice its
+// memory. How close together the new nodes end up is up to the allocator.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::relayout(size_type position, size_type n)
+{
+  flush_cursor();
+  range_check_lt(position);
+  if (size() - position < n)
+  {
+    n = size() - position;
+  }
+  std::vector<node_type*> nodes;
+  nodes.reserve(n);
+  size_type i = 0;
+  try
+  {
+    for (; i < n; ++i)
+    {
+      nodes.push_back(nodealloc_.allocate(1));
+    }
+    std::sort(nodes.begin(), nodes.end(), std::less<node_type*>());
+    node_type* p = select(position);
+    for (i = 0; i < n; ++i)
+    {
+      node_type* next = p->next_;
+      relocate(p, nodes[i]);
+      p = next;
+    }
+  }
+  catch (...)
+  {
+    for (; i < nodes.size(); ++i)
+    {
+      nodealloc_.deallocate(nodes[i], 1);
+    }
+    throw;
+  }
+  return position + n;
+}
+
+template<class T, class A, class B>
+template<class Function>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::visit_top(unsigned levels, Function f) const
+{
+  std::vector<node_type*> level;
+  std::vector<node_type*> below;
+  if (!is_sentinel(sentinel()->left_))
+  {
+    level.push_back(sentinel()->left_);
+  }
+  size_type count = 0;
+  for (; levels != 0 && !level.empty(); --levels)
+  {
+    for (std::size_t i = 0; i < level.size(); ++i)
+    {
+      node_type* p = level[i];
+      if (!f(static_cast<const void*>(p), sizeof(node_type)))
+      {
+        return count;
+      }
+      ++count;
+      if (!is_sentinel(p->left_))
+      {
+        below.push_back(p->left_);
+      }
+      if (!is_sentinel(p->right_))
+      {
+        below.push_back(p->right_);
+      }
+    }
+    level.swap(below);
+    below.clear();
+  }
+  return count;
+}
+
+// Moves the element of p into the raw node q, puts q in the place of p and
+// frees p.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::relocate(node_type* p, node_type* q)
+{
+  relocate_value(alloc_, &q->value_, p->value_);
+  static_cast<typename B::node_base&>(*q) = static_cast<const typename B::node_base&>(*p);
+  q->next_ = p->next_;
+  q->prev_ = p->prev_;
+  q->left_ = p->left_;
+  q->right_ = p->right_;
+  q->parent_ = p->parent_;
+  q->size_ = p->size_;
+  q->prev_->next_ = q;
+  q->next_->prev_ = q;
+  if (!is_buffered(q))
+  {
+    if (q->parent_->left_ == p)
+    {
+      q->parent_->left_ = q;
+    }
+    if (q->parent_->right_ == p)
+    {
+      q->parent_->right_ = q;
+    }
+    if (!is_sentinel(q->left_))
+    {
+      q->left_->parent_ = q;
+    }
+    if (!is_sentinel(q->right_))
+    {
+      q->right_->parent_ = q;
+    }
+  }
+  if (attached_cursor() != 0 && attached_cursor()->position_ == p)
+  {
+    attached_cursor()->position_ = q;
+  }
+  deleteitem(p);
+}
+
+// Unlinks and destroys the elements the filter rejects while walking the
+// chain, then rebuilds the tree over the kept nodes. If the filter throws,
+// the rest of the chain is kept and the tree rebuilt all the same.
+template<class T, class A, class B>
+template<class Filter>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::erase_where(Filter& filter)
+{
+  flush_cursor();
+  flush_ends();
+  size_type n = sentinel()->left_->size_;
+  size_type erased = 0;
+  node_type* last = sentinel();
+  node_type* p = sentinel()->next_;
+  try
+  {
+    while (p != sentinel())
+    {
+      node_type* next = p->next_;
+      if (filter(last, p))
+      {
+        deleteitem(p);
+        ++erased;
+      }
+      else
+      {
+        last->next_ = p;
+        p->prev_ = last;
+        last = p;
+      }
+      p = next;
+    }
+  }
+  catch (...)
+  {
+    last->next_ = p;
+    p->prev_ = last;
+    if (erased != 0)
+    {
+      rebuild(n - erased);
+    }
+    throw;
+  }
+  last->next_ = sentinel();
+  sentinel()->prev_ = last;
+  if (erased != 0)
+  {
+    rebuild(n - erased);
+  }
+  return erased;
+}
+
+// Rebuilds the tree over the n nodes of the chain.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::rebuild(size_type n)
+{
+  if (n == 0)
+  {
+    sentinel()->left_ = nil();
+    sentinel()->right_ = nil();
+    sentinel()->next_ = sentinel();
+    sentinel()->prev_ = sentinel();
+    return;
+  }
+  node_type* root = build_shape(sentinel()->next_, n, typename B::category());
+  sentinel()->left_ = root;
+  root->parent_ = sentinel();
+}
+
+// A perfectly balanced shape suits the weight balanced and the splay tree.
+template<class T, class A, class B>
+template<class Category>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::build_shape(node_type* first, size_type n, Category)
+{
+  return build_balanced(first, n);
+}
+
+// A treap must keep its heap order of priorities: the Cartesian tree of
+// the chain is built with a stack holding its right spine.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::build_shape(node_type* first, size_type n, treap_tag)
+{
+  std::vector<node_type*> spine;
+  node_type* p = first;
+  for (; n != 0; --n, p = p->next_)
+  {
+    node_type* l = nil();
+    while (!spine.empty() && spine.back()->priority_ < p->priority_)
+    {
+      l = spine.back();
+      spine.pop_back();
+    }
+    p->left_ = l;
+    p->right_ = nil();
+    if (l != nil())
+    {
+      l->parent_ = p;
+    }
+    if (!spine.empty())
+    {
+      spine.back()->right_ = p;
+      p->parent_ = spine.back();
+    }
+    spine.push_back(p);
+  }
+  fix_sizes(spine.front());
+  return spine.front();
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::size_type indexing_tree<T,A>::max_size() const
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::size_type indexing_tree<T,A,B>::fix_sizes(node_type* t)
 {
-  return alloc_.max_size();
+  if (t == nil())
+  {
+    return 0;
+  }
+  t->size_ = fix_sizes(t->left_) + fix_sizes(t->right_) + 1;
+  pull(t);
+  return t->size_;
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::resize(size_type sz, const T& x)
+// Copies the subtree t to out in order. Above a few thousand elements the
+// left subtree goes to a thread of its own while this one takes the root
+// and the right subtree.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::copy_subtree(node_type* t, T* out, unsigned threads)
 {
-  if (size() < sz)
+#if INDEXING_TREE_HAS_THREADS
+  if (1 < threads && 16384 <= t->size_ && !is_sentinel(t->left_) && !is_sentinel(t->right_))
   {
-    insert(end(),sz-size(),x);
-    return;
+    bool spawned = false;
+    std::thread worker;
+    try
+    {
+      worker = std::thread([=]() { copy_subtree(t->left_, out, threads / 2); });
+      spawned = true;
+    }
+    catch (...)
+    {
+    }
+    if (spawned)
+    {
+      T* root = out + t->left_->size_;
+      *root = t->value_;
+      copy_subtree(t->right_, root + 1, threads - threads / 2);
+      worker.join();
+      return;
+    }
   }
-  while (sz < size())
+#endif
+  node_type* p = t;
+  while (!is_sentinel(p->left_))
   {
-    pop_back();
+    p = p->left_;
+  }
+  for (size_type n = t->size_; n != 0; --n, p = p->next_)
+  {
+    INDEXING_TREE_PREFETCH(p->next_);
+    *out++ = p->value_;
   }
 }
 
-template<class T, class A>
-typename indexing_tree<T,A>::size_type indexing_tree<T,A>::capacity() const
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::build_balanced(batch_record* first, batch_record* last)
 {
-  return 0;
+  if (first == last)
+  {
+    return nil();
+  }
+  batch_record* mid = first + (last - first) / 2;
+  node_type* p = mid->node_;
+  node_type* l = build_balanced(first, mid);
+  node_type* r = build_balanced(mid + 1, last);
+  p->left_ = l;
+  p->right_ = r;
+  if (l != nil())
+  {
+    l->parent_ = p;
+  }
+  if (r != nil())
+  {
+    r->parent_ = p;
+  }
+  p->size_ = l->size_ + r->size_ + 1;
+  pull(p);
+  return p;
 }
 
-template<class T, class A>
-inline bool indexing_tree<T,A>::empty() const
+// Links p in front of position, which is the sentinel when p goes last.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::link_before(node_type* position, node_type* p)
 {
-  return (sentinel_->left_->size_ == 0);
+  flush_ends();
+  if (is_sentinel(position))
+  {
+    link_back(p);
+    return p;
+  }
+  node_type* n = position;
+  node_type* m = n->prev_;
+  p->size_ = 1;
+  p->next_ = n;
+  p->prev_ = m;
+  p->left_ = nil();
+  p->right_ = nil();
+  n->prev_ = p;
+  m->next_ = p;
+  if (is_sentinel(n->left_))
+  {
+    n->left_ = p;
+    p->parent_ = n;
+    fix_up_insert(p);
+  }
+  else
+  {
+    m->right_ = p;
+    p->parent_ = m;
+    fix_up_insert(p);
+  }
+  return p;
 }
 
-template<class T, class A>
-inline void indexing_tree<T,A>::reserve(size_type n)
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::insert(iterator position, size_type n, const T& x)
 {
+  insert_copies(position.node_, n, x);
 }
 
-template<class T, class A>
-typename indexing_tree<T,A>::reference indexing_tree<T,A>::operator[](size_type n)
+// Index based insertion finds its place in the same descent that counts
+// the new element in the sizes; see insert_at().
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::insert(size_type position, const T& x)
 {
-  range_check_leq(n);
-  return select(n)->value_;
+  flush_cursor();
+  range_check_lt(position);
+  size_type n = size();
+  if (end_buffer() != 0 && position == 0)
+  {
+    push_front(x);
+    return iterator(sentinel()->next_);
+  }
+  if (end_buffer() != 0 && position == n)
+  {
+    push_back(x);
+    return iterator(sentinel()->prev_);
+  }
+  node_type* p = newitem(x);
+  insert_at(position, p, typename B::category());
+  return iterator(p);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::operator[](size_type n) const
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::insert(size_type position, size_type n, const T& x)
 {
-  range_check_leq(n);
-  return select(n)->value_;
+  flush_cursor();
+  range_check_lt(position);
+  return iterator(insert_copies(select(position), n, x));
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::at(size_type n)
+// Creates n copies of x chained together and splices them in front of
+// position at once; returns the first of them, or position for n == 0.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::insert_copies(node_type* position, size_type n, const T& x)
 {
-  range_check_leq(n);
-  return select(n)->value_;
+  flush_cursor_at(position);
+  if (n == 0)
+  {
+    return position;
+  }
+  node_type* first = newitem(x);
+  node_type* last = first;
+  try
+  {
+    for (size_type i = 1; i < n; ++i)
+    {
+      node_type* p = newitem(x);
+      last->next_ = p;
+      p->prev_ = last;
+      last = p;
+    }
+  }
+  catch (...)
+  {
+    while (last != first)
+    {
+      node_type* prev = last->prev_;
+      deleteitem(last);
+      last = prev;
+    }
+    deleteitem(first);
+    throw;
+  }
+  splice_before(position, first, last, n, typename B::category());
+  return first;
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::at(size_type n) const
+// Counts p in the sizes on the way down to the empty subtree where it
+// belongs, and restores the balance on the way back, rotating only at the
+// nodes that the descent found to be too heavy on the grown side.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::insert_at(size_type position, node_type* p, weight_balanced_tag)
 {
-  range_check_leq(n);
-  return select(n)->value_;
+  flush_ends();
+  if (is_sentinel(sentinel()->left_))
+  {
+    link_back(p);
+    return;
+  }
+  p->size_ = 1;
+  p->left_ = nil();
+  p->right_ = nil();
+  pull(p);
+  insert_below(sentinel()->left_, position, p);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::front()
+template<class T, class A, class B>
+template<class Category>
+inline void indexing_tree<T,A,B>::insert_at(size_type position, node_type* p, Category)
 {
-  return sentinel_->next_->value_;
+  link_before(select(position), p);
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::front() const
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::insert_below(node_type* t, size_type i, node_type* p)
 {
-  return sentinel_->next_->value_;
+  size_type sz = ++t->size_;
+  size_type grown;
+  if (i <= t->left_->size_)
+  {
+    if (is_sentinel(t->left_))
+    {
+      p->prev_ = t->prev_;
+      p->next_ = t;
+      t->prev_->next_ = p;
+      t->prev_ = p;
+      t->left_ = p;
+      p->parent_ = t;
+    }
+    else
+    {
+      insert_below(t->left_, i, p);
+    }
+    grown = t->left_->size_;
+  }
+  else
+  {
+    if (is_sentinel(t->right_))
+    {
+      p->prev_ = t;
+      p->next_ = t->next_;
+      t->next_->prev_ = p;
+      t->next_ = p;
+      t->right_ = p;
+      p->parent_ = t;
+    }
+    else
+    {
+      insert_below(t->right_, i - t->left_->size_ - 1, p);
+    }
+    grown = t->right_->size_;
+  }
+  pull(t);
+  if (!B::is_balanced(grown, sz - 1 - grown))
+  {
+    rebalance(t);
+  }
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::reference indexing_tree<T,A>::back()
+// Removes the element at position from the tree and the chain without
+// destroying it. The sizes shrink on the way down; rotations follow on the
+// way back where the shrunk side became too light.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::erase_at(size_type position, weight_balanced_tag)
 {
-  return sentinel_->prev_->value_;
+  flush_ends();
+  node_type* p = erase_below(sentinel()->left_, position);
+  p->prev_->next_ = p->next_;
+  p->next_->prev_ = p->prev_;
+  return p;
 }
 
-template<class T, class A>
-inline typename indexing_tree<T,A>::const_reference indexing_tree<T,A>::back() const
+template<class T, class A, class B>
+template<class Category>
+inline typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::erase_at(size_type position, Category)
 {
-  return sentinel_->prev_->value_;
+  node_type* p = select(position);
+  unlink(p);
+  return p;
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::push_back(const T& x)
+// The element of a node with two children is replaced by its neighbour in
+// the larger subtree.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::erase_below(node_type* t, size_type i)
 {
-  node_type* n = newitem(x);
-  node_type* p = sentinel_->prev_;
-  if (is_sentinel(p))
+  size_type sz = --t->size_;
+  size_type shrunk;
+  node_type* p;
+  if (i < t->left_->size_)
   {
-    put_first_element(n);
-    return;
+    p = erase_below(t->left_, i);
+    shrunk = t->left_->size_;
   }
-  n->size_ = 1;
-  n->next_ = sentinel_;
-  n->prev_ = p;
-  n->parent_ = p;
-  n->left_ = sentinel_;
-  n->right_ = sentinel_;
-  p->next_ = n;
-  p->right_ = n;
-  sentinel_->prev_ = n;
-  fix_up_incr(p);
-}
-
-template<class T, class A>
-void indexing_tree<T,A>::pop_back()
-{
-  node_type* p = sentinel_->prev_;
-  if (is_sentinel(p))
+  else if (t->left_->size_ < i)
   {
-    return;
+    p = erase_below(t->right_, i - t->left_->size_ - 1);
+    shrunk = t->right_->size_;
   }
-  sentinel_->prev_ = p->prev_;
-  p->prev_->next_ = sentinel_;
-  node_type* pp = p->parent_;
-  node_type* l = p->left_;
-  if (l != sentinel_)
+  else
   {
-    l->parent_ = pp;
+    node_type* l = t->left_;
+    node_type* r = t->right_;
+    if (is_sentinel(l) || is_sentinel(r))
+    {
+      node_type* q = is_sentinel(l) ? r : l;
+      replace_child(t->parent_, t, q);
+      if (!is_sentinel(q))
+      {
+        q->parent_ = t->parent_;
+      }
+      return t;
+    }
+    node_type* q;
+    if (r->size_ < l->size_)
+    {
+      q = erase_last_below(l);
+      l = t->left_;
+    }
+    else
+    {
+      q = erase_first_below(r);
+      r = t->right_;
+    }
+    q->left_ = l;
+    q->right_ = r;
+    if (!is_sentinel(l))
+    {
+      l->parent_ = q;
+    }
+    if (!is_sentinel(r))
+    {
+      r->parent_ = q;
+    }
+    q->size_ = sz;
+    q->parent_ = t->parent_;
+    replace_child(t->parent_, t, q);
+    pull(q);
+    rebalance(q);
+    return t;
   }
-  pp->right_ = l;
-  if (pp == sentinel_)
+  pull(t);
+  if (!B::is_balanced(sz - 1 - shrunk, shrunk))
   {
-    pp->left_ = l;
+    rebalance(t);
   }
-  deleteitem(p);
-  fix_up_decr(pp);
+  return p;
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::push_front(const T& x)
+// Detach the first or the last node of the subtree t from the tree.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::erase_first_below(node_type* t)
 {
-  node_type* n = newitem(x);
-  node_type* p = sentinel_->next_;
-  if (is_sentinel(p))
+  if (is_sentinel(t->left_))
   {
-    put_first_element(n);
-    return;
+    replace_child(t->parent_, t, t->right_);
+    if (!is_sentinel(t->right_))
+    {
+      t->right_->parent_ = t->parent_;
+    }
+    return t;
   }
-  n->size_ = 1;
-  n->prev_ = sentinel_;
-  n->next_ = p;
-  n->parent_ = p;
-  n->left_ = sentinel_;
-  n->right_ = sentinel_;
-  p->prev_ = n;
-  p->left_ = n;
-  sentinel_->next_ = n;
-  fix_up_incr(p);
+  size_type sz = --t->size_;
+  node_type* p = erase_first_below(t->left_);
+  size_type shrunk = t->left_->size_;
+  pull(t);
+  if (!B::is_balanced(sz - 1 - shrunk, shrunk))
+  {
+    rebalance(t);
+  }
+  return p;
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::pop_front()
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::erase_last_below(node_type* t)
 {
-  node_type* p = sentinel_->next_;
-  if (is_sentinel(p))
+  if (is_sentinel(t->right_))
   {
-    return;
+    replace_child(t->parent_, t, t->left_);
+    if (!is_sentinel(t->left_))
+    {
+      t->left_->parent_ = t->parent_;
+    }
+    return t;
   }
-  sentinel_->next_ = p->next_;
-  p->next_->prev_ = sentinel_;
-  node_type* pp = p->parent_;
-  node_type* r = p->right_;
-  if (r != sentinel_)
+  size_type sz = --t->size_;
+  node_type* p = erase_last_below(t->right_);
+  size_type shrunk = t->right_->size_;
+  pull(t);
+  if (!B::is_balanced(sz - 1 - shrunk, shrunk))
   {
-    r->parent_ = pp;
+    rebalance(t);
   }
-  pp->left_ = r;
-  if (pp == sentinel_)
+  return p;
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::replace_child(node_type* parent, node_type* child, node_type* p)
+{
+  if (parent->left_ == child)
   {
-    pp->right_ = r;
+    parent->left_ = p;
   }
-  deleteitem(p);
-  fix_up_decr(pp);
+  else
+  {
+    parent->right_ = p;
+  }
+}
+
+template<class T, class A, class B>
+template<class InIter>
+void indexing_tree<T,A,B>::insert(iterator position, InIter first, InIter last)
+{
+  private_insert<integral_trait_name_space::is_integral<InIter>::value_,InIter> temp(*this, position,first,last);
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::clear()
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::erase(iterator position)
 {
-  node_type* p = sentinel_->next_;
-  while (p != sentinel_)
+  flush_cursor_at(position.node_);
+  if (is_sentinel(position.node_))
   {
-    node_type* next = p->next_;
-    deleteitem(p);
-    p = next;
+    return position;
   }
-  sentinel_->left_ = sentinel_;
-  sentinel_->right_ = sentinel_;
-  sentinel_->next_ = sentinel_;
-  sentinel_->prev_ = sentinel_;
+  node_type* n = unlink(position.node_);
+  deleteitem(position.node_);
+  return iterator(n);
 }
 
-template<class T, class A>
-typename indexing_tree<T,A>::iterator indexing_tree<T,A>::insert(iterator position, const T& x)
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::erase(iterator first, iterator last)
 {
-  if (is_sentinel(position.node_))
+  flush_cursor();
+  if (first == last)
   {
-    push_back(x);
-    return end().node_->prev_;
+    return last;
   }
-  node_type* p = newitem(x);
-  node_type* n = position.node_;
-  node_type* m = n->prev_;
-  p->size_ = 1;
-  p->next_ = n;
-  p->prev_ = m;
-  p->left_ = sentinel_;
-  p->right_ = sentinel_;
-  n->prev_ = p;
-  m->next_ = p;
-  if (is_sentinel(n->left_))
+  return erase(first.index_of(), static_cast<size_type>(last - first));
+}
+
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::erase(size_type position)
+{
+  flush_cursor();
+  range_check_leq(position);
+  if (end_buffer() != 0 && position == 0)
   {
-    n->left_ = p;
-    p->parent_ = n;
-    fix_up_incr(n);
+    pop_front();
+    return iterator(sentinel()->next_);
   }
-  else
+  if (end_buffer() != 0 && position + 1 == size())
   {
-    m->right_ = p;
-    p->parent_ = m;
-    fix_up_incr(m);
+    pop_back();
+    return iterator(sentinel());
   }
-  return iterator(p);
+  node_type* p = erase_at(position, typename B::category());
+  node_type* n = p->next_;
+  deleteitem(p);
+  return iterator(n);
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::insert(iterator position, size_type n, const T& x)
+// A range of a fair share of the sequence is cut out of the chain in one
+// walk and the tree rebuilt over the rest; shorter ones are erased one
+// element at a time.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::iterator indexing_tree<T,A,B>::erase(size_type position, size_type n)
 {
-  size_type i;
-  iterator p = position;
-  try
+  flush_cursor();
+  size_type sz = size();
+  if (sz < n || sz - n < position)
   {
-    for (i=0;i<n;++i)
-    {
-      p = insert(p,x);
-    }
+    throw std::out_of_range("indexing_tree::out_of_range");
   }
-  catch (...)
+  if (n == 0)
+  {
+    return iterator(select(position));
+  }
+  if (n < sz / 4 + 1)
   {
-    while (i-- != 0)
+    for (; n != 1; --n)
     {
-      p = erase(p);
+      erase(position);
     }
-    throw;
+    return erase(position);
   }
+  flush_ends();
+  node_type* p = select(position);
+  node_type* before = p->prev_;
+  for (size_type i = 0; i != n; ++i)
+  {
+    node_type* next = p->next_;
+    deleteitem(p);
+    p = next;
+  }
+  before->next_ = p;
+  p->prev_ = before;
+  rebuild(sz - n);
+  return iterator(p);
 }
 
-template<class T, class A>
-template<class InIter>
-void indexing_tree<T,A>::insert(iterator position, InIter first, InIter last)
-{
-  private_insert<integral_trait_name_space::is_integral<InIter>::value_,InIter> temp(*this, position,first,last);
-}
-
-template<class T, class A>
-typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator position)
+// Detaches del from the tree and the in-order chain without destroying it,
+// and returns its successor.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::node_type* indexing_tree<T,A,B>::unlink(node_type* del)
 {
-  if (is_sentinel(position.node_))
-  {
-    return position;
-  }
-  node_type* del = position.node_;
+  flush_ends();
+  prepare_erase(del, typename B::category());
   node_type* pp = del->parent_;
   bool leftchild = del->parent_->left_==del;
   node_type* l = del->left_;
@@ -1715,7 +5580,6 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
   node_type* p = del->prev_;
   node_type* n = del->next_;
   size_type sz = del->size_;
-  deleteitem(del);
   p->next_ = n;
   n->prev_ = p;
   if (is_sentinel(l))
@@ -1732,8 +5596,8 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
     {
       r->parent_ = pp;
     }
-    fix_up_decr(pp);
-    return iterator(n);
+    fix_up_erase(pp);
+    return n;
   }
   if (is_sentinel(r))
   {
@@ -1749,12 +5613,12 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
     {
       l->parent_ = pp;
     }
-    fix_up_decr(pp);
-    return iterator(n);
+    fix_up_erase(pp);
+    return n;
   }
   if (p == l)
   {
-    p->size_ = sz-1;
+    p->size_ = sz;
     p->right_ = r;
     r->parent_ = p;
     p->parent_ = pp;
@@ -1766,8 +5630,8 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
     {
       pp->right_ = p;
     }
-    fix_up_decr(pp);
-    return iterator(n);
+    fix_up_erase(p);
+    return n;
   }
   if (is_sentinel(p->right_))
   {
@@ -1798,8 +5662,8 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
     {
       pp->right_ = p;
     }
-    fix_up_decr(ppp);
-    return iterator(n);
+    fix_up_erase(ppp);
+    return n;
   }
   node_type* ppp = n->parent_;
   if (ppp->left_ == n)
@@ -1828,17 +5692,116 @@ typename indexing_tree<T,A>::iterator indexing_tree<T,A>::erase(iterator positio
   {
     pp->right_ = n;
   }
-  fix_up_decr(ppp);
-  return iterator(n);
+  fix_up_erase(ppp);
+  return n;
+}
+
+// Allocators are exchanged only if they propagate on swap; otherwise they
+// must compare equal.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::swap(indexing_tree& that) throw()
+{
+  swap_elements(that);
+  swap_allocators(that, typename allocator_propagation<A>::swap());
+}
+
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::swap_allocators(indexing_tree& that, propagate_allocator_tag)
+{
+  allocator_type a = alloc_;
+  alloc_ = that.alloc_;
+  that.alloc_ = a;
+  node_allocator_type na = nodealloc_;
+  nodealloc_ = that.nodealloc_;
+  that.nodealloc_ = na;
+}
+
+template<class T, class A, class B>
+inline void indexing_tree<T,A,B>::swap_allocators(indexing_tree&, keep_allocator_tag)
+{
+}
+
+// The sentinels stay in their trees; only their links are exchanged and
+// the root and the ends of the chain pointed back at them.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::swap_elements(indexing_tree& that)
+{
+  node_type* s = sentinel();
+  node_type* t = that.sentinel();
+  std::swap(s->left_, t->left_);
+  std::swap(s->right_, t->right_);
+  std::swap(s->next_, t->next_);
+  std::swap(s->prev_, t->prev_);
+  take_links(s, t);
+  take_links(t, s);
+  // the end buffer setting and a cursor stay with the elements
+  extension* e = extension_;
+  extension_ = that.extension_;
+  that.extension_ = e;
+  cursor* c = attached_cursor();
+  if (c != 0)
+  {
+    c->tree_ = this;
+    if (c->position_ == t)
+    {
+      c->position_ = s;
+    }
+  }
+  c = that.attached_cursor();
+  if (c != 0)
+  {
+    c->tree_ = &that;
+    if (c->position_ == s)
+    {
+      c->position_ = t;
+    }
+  }
+}
+
+// Trees that use neither an end buffer nor a cursor do without the memory
+// for them.
+template<class T, class A, class B>
+typename indexing_tree<T,A,B>::extension* indexing_tree<T,A,B>::extend()
+{
+  if (extension_ == 0)
+  {
+    extension_allocator_type alloc(alloc_);
+    extension* e = alloc.allocate(1);
+    e->end_buffer_ = 0;
+    e->cursor_ = 0;
+    extension_ = e;
+  }
+  return extension_;
+}
+
+// Points the nodes next to the sentinel s, whose links came from the
+// sentinel other, back at s.
+template<class T, class A, class B>
+void indexing_tree<T,A,B>::take_links(node_type* s, node_type* other)
+{
+  if (s->next_ == other)
+  {
+    s->next_ = s;
+    s->prev_ = s;
+    return;
+  }
+  s->next_->prev_ = s;
+  s->prev_->next_ = s;
+  if (!is_sentinel(s->left_))
+  {
+    s->left_->parent_ = s;
+  }
 }
 
-template<class T, class A>
-void indexing_tree<T,A>::swap(indexing_tree& that) throw()
+#if INDEXING_TREE_HAS_MEMORY_RESOURCE
+namespace pmr
 {
-  node_type* p = sentinel_;
-  sentinel_ = that.sentinel_;
-  that.sentinel_ = p;
+  // indexing_tree drawing its nodes from a std::pmr::memory_resource; with
+  // a monotonic_buffer_resource the whole tree is released at once.
+  template<class T, class Balance = weight_balance<> >
+  using indexing_tree = osoken::indexing_tree<T, std::pmr::polymorphic_allocator<T>, Balance>;
 }
+#endif
 
 } // end of namespace osoken
 
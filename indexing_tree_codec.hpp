@@ -0,0 +1,81 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef INDEXING_TREE_CODEC_HPP_
+#define INDEXING_TREE_CODEC_HPP_
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace osoken
+{
+
+// Encoding helpers shared by the wrappers that write indexing_tree
+// operations to files (journaled_indexing_tree, traced_indexing_tree).
+// Numbers are little-endian base-128 varints.
+struct indexing_tree_codec
+{
+  static void put_number(std::vector<char>& out, unsigned long long n);
+  static bool get_number(const char*& p, const char* end, unsigned long long& n);
+  static void fail(const char* who, const char* what);
+};
+
+inline void indexing_tree_codec::put_number(std::vector<char>& out, unsigned long long n)
+{
+  while (0x80 <= n)
+  {
+    out.push_back(static_cast<char>((n & 0x7F) | 0x80));
+    n >>= 7;
+  }
+  out.push_back(static_cast<char>(n));
+}
+
+// Reads a number at p and advances p past it; false if the input ends
+// inside the number or it is longer than 64 bits allow.
+inline bool indexing_tree_codec::get_number(const char*& p, const char* end, unsigned long long& n)
+{
+  n = 0;
+  for (unsigned shift = 0; p != end && shift < 64; shift += 7)
+  {
+    unsigned char c = static_cast<unsigned char>(*p++);
+    n |= static_cast<unsigned long long>(c & 0x7F) << shift;
+    if (c < 0x80)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Throws std::runtime_error for the failed system call what, with errno.
+inline void indexing_tree_codec::fail(const char* who, const char* what)
+{
+  throw std::runtime_error(std::string(who) + ": " + what + ": " + std::strerror(errno));
+}
+
+} // end of namespace osoken
+
+#endif // INDEXING_TREE_CODEC_HPP_
@@ -0,0 +1,829 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+#ifndef JOURNALED_INDEXING_TREE_HPP_
+#define JOURNALED_INDEXING_TREE_HPP_
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "indexing_tree.hpp"
+#include "indexing_tree_codec.hpp"
+
+namespace osoken
+{
+
+// indexing_tree with a write-ahead operation log (POSIX only).
+// Every modification is appended as a compact binary record to <path>.log
+// before it is applied. Records are written and fsync'ed in groups of
+// group_size, or by commit(); an operation is durable once the commit that
+// covers it has returned. checkpoint() writes the whole sequence to
+// <path>.snap and starts an empty log. Each commit appends its records as
+// one group framed by its length and a CRC-32, so a group torn by a crash
+// or by a failed write is recognised and dropped as a whole. The
+// constructor recovers the state from the snapshot and the log, replaying
+// runs of edits at ascending positions through apply_batch().
+// Elements are stored as their object representation, so T must be
+// trivially copyable. Modifications go through this class only; the tree
+// itself is exposed read-only.
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
+class journaled_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc,Balance> tree_type;
+  typedef typename tree_type::const_reference const_reference;
+  typedef typename tree_type::const_iterator const_iterator;
+  typedef typename tree_type::size_type size_type;
+  typedef typename tree_type::difference_type difference_type;
+  typedef T value_type;
+
+  explicit journaled_indexing_tree(const std::string& path, size_type group_size = 64);
+  ~journaled_indexing_tree();
+
+  const tree_type& tree() const;
+  const_iterator begin() const;
+  const_iterator end() const;
+  size_type size() const;
+  bool empty() const;
+  const_reference operator [] (size_type n) const;
+  const_reference at(size_type n) const;
+
+  void push_back(const T& x);
+  void pop_back();
+  void push_front(const T& x);
+  void pop_front();
+  void insert(size_type position, const T& x);
+  void erase(size_type position);
+  void erase(size_type position, size_type n);
+  void clear();
+
+  void commit();
+  void checkpoint();
+  size_type pending() const;
+private:
+  journaled_indexing_tree(const journaled_indexing_tree&);
+  journaled_indexing_tree& operator = (const journaled_indexing_tree&);
+
+  enum opcode
+  {
+    insert_op = 1,
+    erase_op,
+    push_back_op,
+    pop_back_op,
+    push_front_op,
+    pop_front_op,
+    clear_op
+  };
+
+  // Collects replayed edits as long as they can be expressed as one batch
+  // in the coordinates of the sequence before it.
+  class replayer
+  {
+  public:
+    explicit replayer(tree_type& tree);
+    void insert(size_type position, const T& x);
+    void erase(size_type position);
+    void flush();
+  private:
+    tree_type& tree_;
+    std::vector<typename tree_type::edit> batch_;
+    difference_type shift_;
+    size_type next_;
+  };
+
+  static const char log_magic_[8];
+  static const char snapshot_magic_[8];
+
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  static_assert(std::is_trivially_copyable<T>::value, "journaled_indexing_tree requires a trivially copyable T");
+#endif
+
+  tree_type tree_;
+  std::string log_path_;
+  std::string snapshot_path_;
+  int fd_;
+  off_t durable_;
+  unsigned long long generation_;
+  size_type group_size_;
+  size_type records_;
+  std::vector<char> buffer_;
+
+  void end_record();
+  void load_snapshot();
+  void open_log();
+  std::size_t replay(const std::vector<char>& log);
+  bool replay_group(const char* p, const char* end, size_type& size, replayer& r);
+  void write_header();
+  static void put_value(std::vector<char>& out, const T& x);
+  static bool get_value(const char*& p, const char* end, T& x);
+  static void put_generation(std::vector<char>& out, unsigned long long generation);
+  static unsigned long long get_generation(const char* p);
+  static unsigned long crc32(const char* p, std::size_t n);
+  static unsigned long get_checksum(const char* p);
+  static bool read_file(const std::string& path, std::vector<char>& out);
+  static void write_all(int fd, const char* p, std::size_t n);
+  static void write_all_at(int fd, const char* p, std::size_t n, off_t offset);
+  static void sync_directory(const std::string& path);
+  static void fail(const char* what);
+};
+
+template<class T, class A, class B>
+const char journaled_indexing_tree<T,A,B>::log_magic_[8] = { 'i', 't', 'r', 'e', 'e', 'l', 'o', 'g' };
+
+template<class T, class A, class B>
+const char journaled_indexing_tree<T,A,B>::snapshot_magic_[8] = { 'i', 't', 'r', 'e', 'e', 's', 'n', 'p' };
+
+//////////////////
+// replayer
+//////////////////
+template<class T, class A, class B>
+journaled_indexing_tree<T,A,B>::replayer::replayer(tree_type& tree)
+  : tree_(tree),shift_(0),next_(0)
+{
+}
+
+// An edit joins the batch when it lies at or behind the end of the last
+// one, counted in the current sequence; its position in the sequence before
+// the batch is then that minus the net number of elements added so far.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::replayer::insert(size_type position, const T& x)
+{
+  if (position < next_)
+  {
+    flush();
+  }
+  batch_.push_back(tree_type::edit::insertion(static_cast<size_type>(position - shift_), x));
+  ++shift_;
+  next_ = position + 1;
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::replayer::erase(size_type position)
+{
+  if (position < next_)
+  {
+    flush();
+  }
+  batch_.push_back(tree_type::edit::erasure(static_cast<size_type>(position - shift_)));
+  --shift_;
+  next_ = position;
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::replayer::flush()
+{
+  tree_.apply_batch(batch_.begin(), batch_.end());
+  batch_.clear();
+  shift_ = 0;
+  next_ = 0;
+}
+
+//////////////////
+// journaled_indexing_tree
+//////////////////
+// private member functions
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::fail(const char* what)
+{
+  indexing_tree_codec::fail("journaled_indexing_tree", what);
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::write_all(int fd, const char* p, std::size_t n)
+{
+  while (n != 0)
+  {
+    ssize_t written = ::write(fd, p, n);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      fail("write");
+    }
+    p += written;
+    n -= static_cast<std::size_t>(written);
+  }
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::write_all_at(int fd, const char* p, std::size_t n, off_t offset)
+{
+  while (n != 0)
+  {
+    ssize_t written = ::pwrite(fd, p, n, offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      fail("pwrite");
+    }
+    p += written;
+    n -= static_cast<std::size_t>(written);
+    offset += written;
+  }
+}
+
+// Makes a rename in the directory of path durable.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::sync_directory(const std::string& path)
+{
+  std::string::size_type slash = path.rfind('/');
+  std::string dir = (slash == std::string::npos) ? std::string(".") : path.substr(0, slash + 1);
+  int fd = ::open(dir.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    fail("open");
+  }
+  int r = ::fsync(fd);
+  ::close(fd);
+  if (r != 0)
+  {
+    fail("fsync");
+  }
+}
+
+template<class T, class A, class B>
+bool journaled_indexing_tree<T,A,B>::read_file(const std::string& path, std::vector<char>& out)
+{
+  out.clear();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    if (errno == ENOENT)
+    {
+      return false;
+    }
+    fail("open");
+  }
+  char chunk[65536];
+  for (;;)
+  {
+    ssize_t n = ::read(fd, chunk, sizeof(chunk));
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      ::close(fd);
+      fail("read");
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    out.insert(out.end(), chunk, chunk + n);
+  }
+  ::close(fd);
+  return true;
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::put_value(std::vector<char>& out, const T& x)
+{
+  const char* p = reinterpret_cast<const char*>(&x);
+  out.insert(out.end(), p, p + sizeof(T));
+}
+
+template<class T, class A, class B>
+bool journaled_indexing_tree<T,A,B>::get_value(const char*& p, const char* end, T& x)
+{
+  if (static_cast<std::size_t>(end - p) < sizeof(T))
+  {
+    return false;
+  }
+  std::memcpy(&x, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::put_generation(std::vector<char>& out, unsigned long long generation)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    out.push_back(static_cast<char>(generation >> (8 * i)));
+  }
+}
+
+template<class T, class A, class B>
+unsigned long long journaled_indexing_tree<T,A,B>::get_generation(const char* p)
+{
+  unsigned long long generation = 0;
+  for (int i = 0; i < 8; ++i)
+  {
+    generation |= static_cast<unsigned long long>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return generation;
+}
+
+// CRC-32 (IEEE 802.3, reflected), a nibble at a time.
+template<class T, class A, class B>
+unsigned long journaled_indexing_tree<T,A,B>::crc32(const char* p, std::size_t n)
+{
+  static const unsigned long table[16] =
+  {
+    0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+    0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+    0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+    0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+  };
+  unsigned long crc = 0xFFFFFFFFUL;
+  for (; n != 0; --n)
+  {
+    crc ^= static_cast<unsigned char>(*p++);
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return crc ^ 0xFFFFFFFFUL;
+}
+
+template<class T, class A, class B>
+unsigned long journaled_indexing_tree<T,A,B>::get_checksum(const char* p)
+{
+  unsigned long crc = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    crc |= static_cast<unsigned long>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return crc;
+}
+
+// Counts a record whose operation has been applied, and commits the group
+// once it is full. A failed commit leaves the records pending.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::end_record()
+{
+  ++records_;
+  if (group_size_ <= records_)
+  {
+    commit();
+  }
+}
+
+// Snapshot: magic, generation, element count, elements.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::load_snapshot()
+{
+  std::vector<char> data;
+  if (!read_file(snapshot_path_, data))
+  {
+    return;
+  }
+  const char* p = data.empty() ? 0 : &data[0];
+  const char* end = p + data.size();
+  unsigned long long n;
+  if (data.size() < 16 || std::memcmp(p, snapshot_magic_, 8) != 0)
+  {
+    throw std::runtime_error("journaled_indexing_tree: bad snapshot");
+  }
+  generation_ = get_generation(p + 8);
+  p += 16;
+  if (!indexing_tree_codec::get_number(p, end, n) || static_cast<unsigned long long>(end - p) != n * sizeof(T))
+  {
+    throw std::runtime_error("journaled_indexing_tree: bad snapshot");
+  }
+  // one batch of insertions builds the tree in O(n)
+  std::vector<typename tree_type::edit> batch;
+  batch.reserve(static_cast<std::size_t>(n));
+  T x;
+  while (get_value(p, end, x))
+  {
+    batch.push_back(tree_type::edit::insertion(0, x));
+  }
+  tree_.apply_batch(batch.begin(), batch.end());
+}
+
+// Log: magic, generation of the snapshot it applies to, groups. A group is
+// the length of its records, their CRC-32 in four little-endian bytes, and
+// the records.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::open_log()
+{
+  std::vector<char> log;
+  bool exists = read_file(log_path_, log);
+  fd_ = ::open(log_path_.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (fd_ < 0)
+  {
+    fail("open");
+  }
+  if (!exists || log.size() < 16 || std::memcmp(&log[0], log_magic_, 8) != 0 || get_generation(&log[8]) != generation_)
+  {
+    // missing, or left behind by a checkpoint that was cut short
+    write_header();
+    return;
+  }
+  std::size_t valid = replay(log);
+  if (valid != log.size() && ::ftruncate(fd_, static_cast<off_t>(valid)) != 0)
+  {
+    fail("ftruncate");
+  }
+  durable_ = static_cast<off_t>(valid);
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::write_header()
+{
+  std::vector<char> header(log_magic_, log_magic_ + 8);
+  put_generation(header, generation_);
+  if (::ftruncate(fd_, 0) != 0)
+  {
+    fail("ftruncate");
+  }
+  write_all_at(fd_, &header[0], header.size(), 0);
+  if (::fsync(fd_) != 0)
+  {
+    fail("fsync");
+  }
+  durable_ = static_cast<off_t>(header.size());
+}
+
+// Applies the intact groups of the log and returns the length of the
+// prefix they occupy.
+template<class T, class A, class B>
+std::size_t journaled_indexing_tree<T,A,B>::replay(const std::vector<char>& log)
+{
+  const char* first = &log[0];
+  const char* end = first + log.size();
+  const char* p = first + 16;
+  size_type size = tree_.size();
+  replayer r(tree_);
+  while (p != end)
+  {
+    const char* q = p;
+    unsigned long long n;
+    if (!indexing_tree_codec::get_number(q, end, n) || static_cast<unsigned long long>(end - q) < 4 || static_cast<unsigned long long>(end - q) - 4 < n)
+    {
+      break;
+    }
+    const char* records = q + 4;
+    if (get_checksum(q) != crc32(records, static_cast<std::size_t>(n)))
+    {
+      break;
+    }
+    if (!replay_group(records, records + n, size, r))
+    {
+      throw std::runtime_error("journaled_indexing_tree: bad log");
+    }
+    p = records + n;
+  }
+  r.flush();
+  return static_cast<std::size_t>(p - first);
+}
+
+// Replays the records of one group whose checksum matched; false means the
+// records do not describe valid operations.
+template<class T, class A, class B>
+bool journaled_indexing_tree<T,A,B>::replay_group(const char* p, const char* end, size_type& size, replayer& r)
+{
+  while (p != end)
+  {
+    opcode op = static_cast<opcode>(static_cast<unsigned char>(*p++));
+    unsigned long long position = 0;
+    unsigned long long n = 1;
+    T x;
+    switch (op)
+    {
+    case insert_op:
+      if (!indexing_tree_codec::get_number(p, end, position) || !get_value(p, end, x) || size < position)
+      {
+        return false;
+      }
+      r.insert(static_cast<size_type>(position), x);
+      ++size;
+      break;
+    case erase_op:
+      if (!indexing_tree_codec::get_number(p, end, position) || !indexing_tree_codec::get_number(p, end, n) || size < n || size - n < position)
+      {
+        return false;
+      }
+      for (; n != 0; --n)
+      {
+        r.erase(static_cast<size_type>(position));
+        --size;
+      }
+      break;
+    case push_back_op:
+    case push_front_op:
+      if (!get_value(p, end, x))
+      {
+        return false;
+      }
+      r.insert((op == push_back_op) ? size : 0, x);
+      ++size;
+      break;
+    case pop_back_op:
+    case pop_front_op:
+      if (size == 0)
+      {
+        return false;
+      }
+      r.erase((op == pop_back_op) ? size - 1 : 0);
+      --size;
+      break;
+    case clear_op:
+      r.flush();
+      tree_.clear();
+      size = 0;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+// member functions
+template<class T, class A, class B>
+journaled_indexing_tree<T,A,B>::journaled_indexing_tree(const std::string& path, size_type group_size)
+  : tree_(),log_path_(path + ".log"),snapshot_path_(path + ".snap"),fd_(-1),durable_(0),generation_(0),group_size_(group_size),records_(0)
+{
+  load_snapshot();
+  open_log();
+}
+
+template<class T, class A, class B>
+journaled_indexing_tree<T,A,B>::~journaled_indexing_tree()
+{
+  try
+  {
+    commit();
+  }
+  catch (...)
+  {
+  }
+  ::close(fd_);
+}
+
+template<class T, class A, class B>
+inline const typename journaled_indexing_tree<T,A,B>::tree_type& journaled_indexing_tree<T,A,B>::tree() const
+{
+  return tree_;
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::const_iterator journaled_indexing_tree<T,A,B>::begin() const
+{
+  return tree_.begin();
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::const_iterator journaled_indexing_tree<T,A,B>::end() const
+{
+  return tree_.end();
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::size_type journaled_indexing_tree<T,A,B>::size() const
+{
+  return tree_.size();
+}
+
+template<class T, class A, class B>
+inline bool journaled_indexing_tree<T,A,B>::empty() const
+{
+  return tree_.empty();
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::const_reference journaled_indexing_tree<T,A,B>::operator[](size_type n) const
+{
+  return tree_[n];
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::const_reference journaled_indexing_tree<T,A,B>::at(size_type n) const
+{
+  return tree_.at(n);
+}
+
+// Each modifier validates its arguments, appends its record and applies
+// itself to the tree; if the tree throws, the record is taken back.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::push_back(const T& x)
+{
+  std::size_t mark = buffer_.size();
+  buffer_.push_back(static_cast<char>(push_back_op));
+  put_value(buffer_, x);
+  try
+  {
+    tree_.push_back(x);
+  }
+  catch (...)
+  {
+    buffer_.resize(mark);
+    throw;
+  }
+  end_record();
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::pop_back()
+{
+  if (tree_.empty())
+  {
+    return;
+  }
+  buffer_.push_back(static_cast<char>(pop_back_op));
+  tree_.pop_back();
+  end_record();
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::push_front(const T& x)
+{
+  std::size_t mark = buffer_.size();
+  buffer_.push_back(static_cast<char>(push_front_op));
+  put_value(buffer_, x);
+  try
+  {
+    tree_.push_front(x);
+  }
+  catch (...)
+  {
+    buffer_.resize(mark);
+    throw;
+  }
+  end_record();
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::pop_front()
+{
+  if (tree_.empty())
+  {
+    return;
+  }
+  buffer_.push_back(static_cast<char>(pop_front_op));
+  tree_.pop_front();
+  end_record();
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::insert(size_type position, const T& x)
+{
+  if (tree_.size() < position)
+  {
+    throw std::out_of_range("journaled_indexing_tree::out_of_range");
+  }
+  std::size_t mark = buffer_.size();
+  buffer_.push_back(static_cast<char>(insert_op));
+  indexing_tree_codec::put_number(buffer_, position);
+  put_value(buffer_, x);
+  try
+  {
+    tree_.insert(tree_.begin() + position, x);
+  }
+  catch (...)
+  {
+    buffer_.resize(mark);
+    throw;
+  }
+  end_record();
+}
+
+template<class T, class A, class B>
+inline void journaled_indexing_tree<T,A,B>::erase(size_type position)
+{
+  erase(position, 1);
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::erase(size_type position, size_type n)
+{
+  if (tree_.size() < n || tree_.size() - n < position)
+  {
+    throw std::out_of_range("journaled_indexing_tree::out_of_range");
+  }
+  if (n == 0)
+  {
+    return;
+  }
+  buffer_.push_back(static_cast<char>(erase_op));
+  indexing_tree_codec::put_number(buffer_, position);
+  indexing_tree_codec::put_number(buffer_, n);
+  typename tree_type::iterator first = tree_.begin() + position;
+  tree_.erase(first, first + n);
+  end_record();
+}
+
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::clear()
+{
+  buffer_.push_back(static_cast<char>(clear_op));
+  tree_.clear();
+  end_record();
+}
+
+// Writes the pending records as one group at the end of the durable part
+// of the log and waits for them to reach the disk. A failed attempt may
+// leave part of the group behind; the next attempt writes at the same
+// offset and its group, which only gains records meanwhile, covers it.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::commit()
+{
+  if (buffer_.empty())
+  {
+    return;
+  }
+  std::vector<char> frame;
+  indexing_tree_codec::put_number(frame, buffer_.size());
+  unsigned long crc = crc32(&buffer_[0], buffer_.size());
+  for (int i = 0; i < 4; ++i)
+  {
+    frame.push_back(static_cast<char>(crc >> (8 * i)));
+  }
+  off_t end = durable_ + static_cast<off_t>(frame.size() + buffer_.size());
+  write_all_at(fd_, &frame[0], frame.size(), durable_);
+  write_all_at(fd_, &buffer_[0], buffer_.size(), durable_ + static_cast<off_t>(frame.size()));
+  if (::fsync(fd_) != 0)
+  {
+    fail("fsync");
+  }
+  durable_ = end;
+  buffer_.clear();
+  records_ = 0;
+}
+
+// Replaces the snapshot by the current sequence and empties the log. The
+// new snapshot carries the next generation, so a log that a crash leaves
+// behind between the two steps is recognised as stale and discarded.
+template<class T, class A, class B>
+void journaled_indexing_tree<T,A,B>::checkpoint()
+{
+  commit();
+  std::vector<char> data(snapshot_magic_, snapshot_magic_ + 8);
+  put_generation(data, generation_ + 1);
+  indexing_tree_codec::put_number(data, tree_.size());
+  for (const_iterator it = tree_.begin(); it != tree_.end(); ++it)
+  {
+    put_value(data, *it);
+  }
+  std::string tmp = snapshot_path_ + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    fail("open");
+  }
+  try
+  {
+    write_all(fd, &data[0], data.size());
+    if (::fsync(fd) != 0)
+    {
+      fail("fsync");
+    }
+  }
+  catch (...)
+  {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+  if (std::rename(tmp.c_str(), snapshot_path_.c_str()) != 0)
+  {
+    fail("rename");
+  }
+  sync_directory(snapshot_path_);
+  ++generation_;
+  write_header();
+}
+
+template<class T, class A, class B>
+inline typename journaled_indexing_tree<T,A,B>::size_type journaled_indexing_tree<T,A,B>::pending() const
+{
+  return records_;
+}
+
+} // end of namespace osoken
+
+#endif // JOURNALED_INDEXING_TREE_HPP_
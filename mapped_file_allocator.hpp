@@ -0,0 +1,457 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef MAPPED_FILE_ALLOCATOR_HPP_
+#define MAPPED_FILE_ALLOCATOR_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena_allocator.hpp"
+#include "indexing_tree.hpp"
+
+#if INDEXING_TREE_HAS_THREADS
+#  include <mutex>
+#endif
+
+namespace osoken
+{
+
+// Storage for tree nodes in a scratch file, for sequences larger than
+// memory (POSIX only). The arena reserves a large range of address space
+// and maps the file into it window by window as it grows, so nodes keep
+// fixed addresses and the tree runs unchanged on top; the page cache is
+// the buffer pool that pages them in and out in LRU order. All blocks come
+// from a block_pool, as in hugepage_arena, including those larger than a
+// node, so max_block admits any size and a vector over the arena lives in
+// the file too. Memory the elements allocate themselves is not covered.
+//
+// release() gives the resident pages back, except for the ranges passed
+// to pin() and not yet to unpin(); pin_top() pins the nodes of the upper
+// levels of a tree, which every descent passes. Rebalancing moves other
+// nodes up, so after much churn unpin() and pin the top again.
+// set_budget() bounds the resident part of the file: whenever the file
+// grows while more than the budget is resident, release() runs. Between
+// growths reads and read-ahead may page in more, so a smaller window keeps
+// closer to the budget; the kernel still reclaims such pages under memory
+// pressure. Without a budget nothing but the kernel bounds residency.
+//
+// set_access() tells the kernel whether to read ahead: after relayout()
+// the in-order chain runs through the file in address order, so
+// sequential access lets iteration read ahead along it. The file is
+// unlinked once opened and vanishes with the arena, which must outlive
+// everything allocated from it.
+class mapped_file_arena
+{
+public:
+  enum access_pattern { normal_access, sequential_access, random_access };
+
+  struct statistics
+  {
+    std::size_t file_bytes_;
+    std::size_t used_bytes_;
+    std::size_t resident_bytes_;
+    std::size_t pinned_bytes_;
+  };
+
+  static const std::size_t max_block = static_cast<std::size_t>(-1);
+
+  explicit mapped_file_arena(const std::string& path, std::size_t window_size = 64 << 20, std::size_t reserve = std::size_t(1) << 40);
+  ~mapped_file_arena();
+
+  void* allocate(std::size_t size);
+  void deallocate(void* p, std::size_t size);
+
+  void set_access(access_pattern pattern);
+  bool pin(const void* p, std::size_t size);
+  void unpin(const void* p, std::size_t size);
+  void unpin();
+  template<class Tree>
+  std::size_t pin_top(const Tree& tree, unsigned levels);
+  void release();
+  void set_budget(std::size_t bytes);
+  statistics stats() const;
+private:
+  mapped_file_arena(const mapped_file_arena&);
+  mapped_file_arena& operator = (const mapped_file_arena&);
+
+  struct pinner
+  {
+    mapped_file_arena* arena_;
+    bool operator () (const void* p, std::size_t size) const;
+  };
+
+  int fd_;
+  char* base_;
+  std::size_t reserve_;
+  std::size_t window_size_;
+  std::size_t mapped_;
+  std::size_t budget_;
+  block_pool pool_;
+  access_pattern pattern_;
+  std::vector<std::pair<char*, std::size_t> > pinned_;
+#if INDEXING_TREE_HAS_THREADS
+  mutable std::mutex lock_;
+#endif
+
+  void grow(std::size_t size);
+  void drop_pages();
+  std::size_t resident_bytes() const;
+  std::pair<char*, std::size_t> pages(const void* p, std::size_t size) const;
+  static std::size_t page_size();
+  static void fail(const char* what);
+};
+
+// arena_allocator over a mapped_file_arena. There is no default arena, so
+// the tree has to be constructed with an allocator.
+template<class T>
+class mapped_file_allocator : public arena_allocator<T, mapped_file_arena>
+{
+public:
+  template<class U>
+  struct rebind
+  {
+    typedef mapped_file_allocator<U> other;
+  };
+
+  explicit mapped_file_allocator(mapped_file_arena& arena) throw();
+  template<class U>
+  mapped_file_allocator(const mapped_file_allocator<U>& that) throw();
+};
+
+//////////////////
+// mapped_file_arena
+//////////////////
+// private member functions
+inline void mapped_file_arena::fail(const char* what)
+{
+  throw std::runtime_error(std::string("mapped_file_arena: ") + what + ": " + std::strerror(errno));
+}
+
+inline std::size_t mapped_file_arena::page_size()
+{
+  return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// the whole pages covering [p, p + size)
+inline std::pair<char*, std::size_t> mapped_file_arena::pages(const void* p, std::size_t size) const
+{
+  std::size_t page = page_size();
+  char* first = base_ + (static_cast<const char*>(p) - base_) / page * page;
+  std::size_t length = (static_cast<const char*>(p) + size - first + page - 1) / page * page;
+  return std::make_pair(first, length);
+}
+
+inline bool mapped_file_arena::pinner::operator()(const void* p, std::size_t size) const
+{
+  return arena_->pin(p, size);
+}
+
+// Writes the pages outside the pinned ranges back and drops them; the
+// caller holds the lock.
+inline void mapped_file_arena::drop_pages()
+{
+  std::vector<std::pair<char*, std::size_t> > pinned(pinned_);
+  std::sort(pinned.begin(), pinned.end());
+  if (::fdatasync(fd_) != 0)
+  {
+    fail("fdatasync");
+  }
+  char* p = base_;
+  char* end = base_ + mapped_;
+  for (std::size_t i = 0; i <= pinned.size(); ++i)
+  {
+    char* stop = (i < pinned.size()) ? pinned[i].first : end;
+    if (p < stop)
+    {
+      ::madvise(p, stop - p, MADV_DONTNEED);
+      ::posix_fadvise(fd_, p - base_, stop - p, POSIX_FADV_DONTNEED);
+    }
+    if (i < pinned.size() && p < pinned[i].first + pinned[i].second)
+    {
+      p = pinned[i].first + pinned[i].second;
+    }
+  }
+}
+
+// the caller holds the lock
+inline std::size_t mapped_file_arena::resident_bytes() const
+{
+  std::size_t bytes = 0;
+  std::size_t page = page_size();
+  std::vector<unsigned char> resident(window_size_ / page);
+  for (std::size_t offset = 0; offset < mapped_; offset += window_size_)
+  {
+    if (::mincore(base_ + offset, window_size_, &resident[0]) != 0)
+    {
+      continue;
+    }
+    for (std::size_t i = 0; i < resident.size(); ++i)
+    {
+      bytes += (resident[i] & 1) ? page : 0;
+    }
+  }
+  return bytes;
+}
+
+// Extends the file by as many windows as a block of size bytes needs and
+// maps them right behind the previous ones, so the pool's chunk continues
+// into them. Over budget, the resident pages are dropped first.
+inline void mapped_file_arena::grow(std::size_t size)
+{
+  std::size_t windows = std::max<std::size_t>(1, size / window_size_ + (size % window_size_ != 0));
+  if ((reserve_ - mapped_) / window_size_ < windows)
+  {
+    throw std::bad_alloc();
+  }
+  std::size_t length = windows * window_size_;
+  if (budget_ != 0 && budget_ < resident_bytes())
+  {
+    drop_pages();
+  }
+  if (::ftruncate(fd_, static_cast<off_t>(mapped_ + length)) != 0)
+  {
+    throw std::bad_alloc();
+  }
+  void* m = ::mmap(base_ + mapped_, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, static_cast<off_t>(mapped_));
+  if (m == MAP_FAILED)
+  {
+    throw std::bad_alloc();
+  }
+  pool_.refill(base_ + mapped_, base_ + mapped_ + length);
+  mapped_ += length;
+  set_access(pattern_);
+}
+
+// public member functions
+inline mapped_file_arena::mapped_file_arena(const std::string& path, std::size_t window_size, std::size_t reserve)
+  : fd_(-1),base_(0),reserve_(0),window_size_(0),mapped_(0),budget_(0),pool_(),pattern_(normal_access),pinned_()
+{
+  std::size_t page = page_size();
+  window_size_ = (window_size + page - 1) / page * page;
+  reserve_ = (reserve + window_size_ - 1) / window_size_ * window_size_;
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd_ < 0)
+  {
+    fail("open");
+  }
+  ::unlink(path.c_str());
+  void* m = ::mmap(0, reserve_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (m == MAP_FAILED)
+  {
+    int error = errno;
+    ::close(fd_);
+    errno = error;
+    fail("mmap");
+  }
+  base_ = static_cast<char*>(m);
+}
+
+inline mapped_file_arena::~mapped_file_arena()
+{
+  ::munmap(base_, reserve_);
+  ::close(fd_);
+}
+
+inline void* mapped_file_arena::allocate(std::size_t size)
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  void* p = pool_.allocate(size);
+  if (p == 0)
+  {
+    grow(size);
+    p = pool_.allocate(size);
+  }
+  return p;
+}
+
+inline void mapped_file_arena::deallocate(void* p, std::size_t size)
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  pool_.deallocate(p, size);
+}
+
+inline void mapped_file_arena::set_access(access_pattern pattern)
+{
+  pattern_ = pattern;
+  if (mapped_ == 0)
+  {
+    return;
+  }
+  int advice = MADV_NORMAL;
+  if (pattern == sequential_access)
+  {
+    advice = MADV_SEQUENTIAL;
+  }
+  else if (pattern == random_access)
+  {
+    advice = MADV_RANDOM;
+  }
+  ::madvise(base_, mapped_, advice);
+}
+
+// Locks the pages holding [p, p + size) in memory; fails, returning false,
+// beyond RLIMIT_MEMLOCK. Pins do not nest: a page stays locked while any
+// pinned range covers it.
+inline bool mapped_file_arena::pin(const void* p, std::size_t size)
+{
+  std::pair<char*, std::size_t> range = pages(p, size);
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  if (::mlock(range.first, range.second) != 0)
+  {
+    return false;
+  }
+  pinned_.push_back(range);
+  return true;
+}
+
+// Drops one range pinned with the same arguments, unlocking the pages that
+// no other pinned range covers.
+inline void mapped_file_arena::unpin(const void* p, std::size_t size)
+{
+  std::pair<char*, std::size_t> range = pages(p, size);
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  std::vector<std::pair<char*, std::size_t> >::iterator it = std::find(pinned_.begin(), pinned_.end(), range);
+  if (it == pinned_.end())
+  {
+    return;
+  }
+  pinned_.erase(it);
+  ::munlock(range.first, range.second);
+  char* end = range.first + range.second;
+  for (std::size_t i = 0; i < pinned_.size(); ++i)
+  {
+    char* first = std::max(pinned_[i].first, range.first);
+    char* last = std::min(pinned_[i].first + pinned_[i].second, end);
+    if (first < last)
+    {
+      ::mlock(first, last - first);
+    }
+  }
+}
+
+inline void mapped_file_arena::unpin()
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  for (std::size_t i = 0; i < pinned_.size(); ++i)
+  {
+    ::munlock(pinned_[i].first, pinned_[i].second);
+  }
+  pinned_.clear();
+}
+
+// Pins the nodes within levels of the root of tree, through
+// indexing_tree::visit_top(); returns how many were pinned.
+template<class Tree>
+std::size_t mapped_file_arena::pin_top(const Tree& tree, unsigned levels)
+{
+  pinner f = { this };
+  return tree.visit_top(levels, f);
+}
+
+// Writes the pages of the file mapping outside the pinned ranges back and
+// drops them from memory. Their contents come back on the next access.
+inline void mapped_file_arena::release()
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  drop_pages();
+}
+
+// Sets the number of resident bytes beyond which growing the file releases
+// the resident pages first; 0 turns the budget off.
+inline void mapped_file_arena::set_budget(std::size_t bytes)
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  budget_ = bytes;
+}
+
+inline mapped_file_arena::statistics mapped_file_arena::stats() const
+{
+#if INDEXING_TREE_HAS_THREADS
+  std::lock_guard<std::mutex> guard(lock_);
+#endif
+  statistics s;
+  s.file_bytes_ = mapped_;
+  s.used_bytes_ = pool_.used();
+  s.pinned_bytes_ = 0;
+  std::vector<std::pair<char*, std::size_t> > pinned(pinned_);
+  std::sort(pinned.begin(), pinned.end());
+  char* covered = base_;
+  for (std::size_t i = 0; i < pinned.size(); ++i)
+  {
+    char* first = std::max(pinned[i].first, covered);
+    char* last = pinned[i].first + pinned[i].second;
+    if (first < last)
+    {
+      s.pinned_bytes_ += last - first;
+      covered = last;
+    }
+  }
+  s.resident_bytes_ = resident_bytes();
+  return s;
+}
+
+//////////////////
+// mapped_file_allocator
+//////////////////
+template<class T>
+inline mapped_file_allocator<T>::mapped_file_allocator(mapped_file_arena& arena) throw()
+  : arena_allocator<T, mapped_file_arena>(arena)
+{
+}
+
+template<class T>
+template<class U>
+inline mapped_file_allocator<T>::mapped_file_allocator(const mapped_file_allocator<U>& that) throw()
+  : arena_allocator<T, mapped_file_arena>(that)
+{
+}
+
+} // end of namespace osoken
+
+#endif // MAPPED_FILE_ALLOCATOR_HPP_
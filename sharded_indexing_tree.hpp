@@ -0,0 +1,629 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef SHARDED_INDEXING_TREE_HPP_
+#define SHARDED_INDEXING_TREE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "indexing_tree.hpp"
+
+#if !INDEXING_TREE_HAS_THREADS
+#  error "sharded_indexing_tree needs C++11 threads"
+#endif
+
+namespace osoken
+{
+
+// A sequence split over a fixed number of indexing_trees (shards), each
+// with its own lock, so that threads editing far apart do not wait for
+// each other. A Fenwick tree of atomic counters over the shard sizes maps
+// a position to its shard in O(log shards) without any lock; the call
+// then locks that shard and checks the mapping again, retrying when a
+// concurrent call has moved it. A call is therefore atomic with respect
+// to its shard, and its position is exact whenever no other thread edits
+// an earlier shard at the same time.
+//
+// After an edit the shard compares its size with its neighbours and moves
+// elements over when one of them has more than twice the other's, or a
+// quarter of the average shard more (both plus slack_), continuing along
+// the shards the elements went to; shards thus split their load with
+// neighbours as they grow and take it back as they shrink. Locks are
+// taken in ascending shard order, and a lower neighbour only when it is
+// free. Elements are moved as nodes, without copying. Two more Fenwick
+// trees count the moves started and finished per pair of neighbours, so
+// a call only retries for a move between two shards in front of its own.
+//
+// Reads return copies. A locked_view locks all shards and iterates over
+// one consistent sequence; for_each() and copy_to() use one.
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
+class sharded_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc,Balance> tree_type;
+  typedef typename tree_type::size_type size_type;
+  typedef typename tree_type::difference_type difference_type;
+  typedef T value_type;
+
+  explicit sharded_indexing_tree(size_type shards = 0, const Alloc& alloc = Alloc());
+
+  size_type size() const;
+  bool empty() const;
+  size_type shards() const;
+  size_type shard_size(size_type i) const;
+  T operator [] (size_type n) const;
+  T at(size_type n) const;
+
+  void insert(size_type position, const T& x);
+  void erase(size_type position);
+  void push_back(const T& x);
+  void push_front(const T& x);
+
+  template<class F>
+  void for_each(F f) const;
+  template<class OutIter>
+  OutIter copy_to(OutIter out) const;
+
+  class const_iterator;
+
+  // Holds every shard locked while it lives, so the sequence stands still;
+  // the thread that owns it must not edit the tree meanwhile.
+  class locked_view
+  {
+  public:
+    explicit locked_view(const sharded_indexing_tree& tree);
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_type size() const;
+  private:
+    locked_view(const locked_view&);
+    locked_view& operator = (const locked_view&);
+
+    const sharded_indexing_tree* tree_;
+    std::vector<std::unique_lock<std::mutex> > guards_;
+  };
+
+  // Walks the shards of a locked_view in order; valid while the view is.
+  class const_iterator : public std::iterator<std::bidirectional_iterator_tag, T, difference_type, const T*, const T&>
+  {
+  public:
+    const_iterator();
+    const_iterator& operator++();
+    const_iterator operator++(int);
+    const_iterator& operator--();
+    const_iterator operator--(int);
+    bool operator == (const const_iterator& i) const;
+    bool operator != (const const_iterator& i) const;
+    const T& operator*() const;
+    const T* operator->() const;
+  private:
+    const_iterator(const sharded_indexing_tree* tree, size_type shard, typename tree_type::const_iterator it);
+    void skip_empty();
+
+    const sharded_indexing_tree* tree_;
+    size_type shard_;
+    typename tree_type::const_iterator it_;
+
+    friend class locked_view;
+  };
+private:
+  sharded_indexing_tree(const sharded_indexing_tree&);
+  sharded_indexing_tree& operator = (const sharded_indexing_tree&);
+
+  // padded so that the locks of neighbouring shards do not share a line
+  struct shard
+  {
+    explicit shard(const Alloc& alloc);
+    mutable std::mutex lock_;
+    std::atomic<size_type> size_;
+    tree_type tree_;
+    char padding_[64];
+  };
+
+  static const size_type slack_ = 64;
+
+  std::vector<std::unique_ptr<shard> > shards_;
+  std::unique_ptr<std::atomic<size_type>[]> index_;
+  std::unique_ptr<std::atomic<size_type>[]> started_;
+  std::unique_ptr<std::atomic<size_type>[]> finished_;
+  size_type count_;
+  size_type top_;
+
+  static std::unique_ptr<std::atomic<size_type>[]> make_index(size_type count);
+  static size_type sum(const std::unique_ptr<std::atomic<size_type>[]>& index, size_type i);
+  void add(std::unique_ptr<std::atomic<size_type>[]>& index, size_type i, size_type delta);
+  size_type prefix(size_type i) const;
+  size_type locate(size_type position) const;
+  size_type lock(size_type position, bool insertion, std::unique_lock<std::mutex>& guard, size_type& offset) const;
+  void resized(size_type i);
+  void rebalance(size_type i, std::unique_lock<std::mutex>& guard);
+  static void move_back(tree_type& from, tree_type& to, size_type n);
+  static void move_front(tree_type& from, tree_type& to, size_type n);
+};
+
+//////////////////
+// sharded_indexing_tree::shard
+//////////////////
+template<class T, class A, class B>
+inline sharded_indexing_tree<T,A,B>::shard::shard(const A& alloc)
+  : lock_(),size_(0),tree_(alloc)
+{
+}
+
+//////////////////
+// sharded_indexing_tree
+//////////////////
+// private member functions
+
+// a Fenwick tree of count zeroed counters, indexed from 1
+template<class T, class A, class B>
+std::unique_ptr<std::atomic<typename sharded_indexing_tree<T,A,B>::size_type>[]> sharded_indexing_tree<T,A,B>::make_index(size_type count)
+{
+  std::unique_ptr<std::atomic<size_type>[]> index(new std::atomic<size_type>[count + 1]);
+  for (size_type i = 0; i <= count; ++i)
+  {
+    index[i].store(0, std::memory_order_relaxed);
+  }
+  return index;
+}
+
+// Sum of the first i entries of index.
+template<class T, class A, class B>
+typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::sum(const std::unique_ptr<std::atomic<size_type>[]>& index, size_type i)
+{
+  size_type total = 0;
+  for (; i != 0; i &= i - 1)
+  {
+    total += index[i].load(std::memory_order_acquire);
+  }
+  return total;
+}
+
+// Adds delta to entry i of index; delta wraps around for decrements.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::add(std::unique_ptr<std::atomic<size_type>[]>& index, size_type i, size_type delta)
+{
+  for (++i; i <= count_; i += i & (0 - i))
+  {
+    index[i].fetch_add(delta, std::memory_order_acq_rel);
+  }
+}
+
+// Total size of the shards in front of shard i. Every shard counts in one
+// counter of the sum, so a concurrent edit is seen entirely or not at all.
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::prefix(size_type i) const
+{
+  return sum(index_, i);
+}
+
+// The shard holding position: the last one whose prefix is not greater.
+// Returns count_ when position is not below the total size.
+template<class T, class A, class B>
+typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::locate(size_type position) const
+{
+  size_type i = 0;
+  for (size_type step = top_; step != 0; step >>= 1)
+  {
+    if (i + step <= count_)
+    {
+      size_type n = index_[i + step].load(std::memory_order_acquire);
+      if (n <= position)
+      {
+        i += step;
+        position -= n;
+      }
+    }
+  }
+  return i;
+}
+
+// Locks the shard holding position, or, for an insertion, the one to
+// insert into, and sets offset to the position within it. A move between
+// two earlier shards updates their counters one after the other, so the
+// prefix is only trusted when no move between shards j and j + 1 < i
+// overlapped reading it; entry j of started_ and finished_ counts those.
+// A move between shard i and a neighbour holds the lock of shard i. The
+// mover may be waiting for that lock, so a failed attempt lets go of it
+// and yields before it tries again.
+template<class T, class A, class B>
+typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::lock(size_type position, bool insertion, std::unique_lock<std::mutex>& guard, size_type& offset) const
+{
+  for (;;)
+  {
+    size_type i = locate(position);
+    if (i == count_)
+    {
+      if (!insertion || prefix(count_) < position)
+      {
+        throw std::out_of_range("indexing_tree::out_of_range");
+      }
+      i = count_ - 1;
+    }
+    std::unique_lock<std::mutex> g(shards_[i]->lock_);
+    size_type pairs = (i == 0) ? 0 : i - 1;
+    size_type finished = sum(finished_, pairs);
+    size_type first = prefix(i);
+    size_type n = shards_[i]->tree_.size();
+    if (sum(started_, pairs) == finished && first <= position && (position - first < n || (insertion && position - first == n)))
+    {
+      offset = position - first;
+      guard.swap(g);
+      return i;
+    }
+    g.unlock();
+    std::this_thread::yield();
+  }
+}
+
+// Publishes the size of shard i, which the caller has locked.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::resized(size_type i)
+{
+  size_type n = shards_[i]->tree_.size();
+  size_type old = shards_[i]->size_.exchange(n, std::memory_order_acq_rel);
+  add(index_, i, n - old);
+}
+
+// Evens out shard i, locked by guard, with a neighbour and goes on with
+// the neighbour that received elements, as long as a pair is off by more
+// than a factor of two. guard holds the last shard visited on return.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::rebalance(size_type i, std::unique_lock<std::mutex>& guard)
+{
+  size_type limit = slack_ + size() / count_ / 4;
+  for (size_type steps = 0; steps < count_; ++steps)
+  {
+    size_type n = shards_[i]->size_.load(std::memory_order_relaxed);
+    size_type j = count_;
+    size_type best = 0;
+    for (size_type k = (i == 0 ? 1 : i - 1); k <= i + 1 && k < count_; k += 2)
+    {
+      size_type m = shards_[k]->size_.load(std::memory_order_relaxed);
+      size_type big = std::max(n, m);
+      size_type small = std::min(n, m);
+      if ((2 * small + slack_ < big || limit < big - small) && best < big - small)
+      {
+        j = k;
+        best = big - small;
+      }
+    }
+    if (j == count_)
+    {
+      return;
+    }
+    std::unique_lock<std::mutex> other(shards_[j]->lock_, std::defer_lock);
+    if (i < j)
+    {
+      other.lock();
+    }
+    else if (!other.try_lock())
+    {
+      return;
+    }
+    tree_type& a = shards_[std::min(i, j)]->tree_;
+    tree_type& b = shards_[std::max(i, j)]->tree_;
+    size_type receiver;
+    add(started_, std::min(i, j), 1);
+    if (b.size() < a.size())
+    {
+      move_back(a, b, (a.size() - b.size()) / 2);
+      receiver = std::max(i, j);
+    }
+    else
+    {
+      move_front(b, a, (b.size() - a.size()) / 2);
+      receiver = std::min(i, j);
+    }
+    resized(i);
+    resized(j);
+    add(finished_, std::min(i, j), 1);
+    if (receiver == i)
+    {
+      return;
+    }
+    guard.swap(other);
+    i = j;
+  }
+}
+
+// Moves the last n elements of from to the front of to.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::move_back(tree_type& from, tree_type& to, size_type n)
+{
+  for (; n != 0; --n)
+  {
+    typename tree_type::iterator last = from.end();
+    --last;
+    to.insert(to.begin(), from.extract(last));
+  }
+}
+
+// Moves the first n elements of from to the back of to.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::move_front(tree_type& from, tree_type& to, size_type n)
+{
+  for (; n != 0; --n)
+  {
+    to.insert(to.end(), from.extract(from.begin()));
+  }
+}
+
+// public member functions
+template<class T, class A, class B>
+sharded_indexing_tree<T,A,B>::sharded_indexing_tree(size_type shards, const A& alloc)
+  : shards_(),index_(),started_(),finished_(),count_(shards),top_(1)
+{
+  if (count_ == 0)
+  {
+    count_ = std::max<size_type>(4, 4 * std::thread::hardware_concurrency());
+  }
+  for (size_type i = 0; i < count_; ++i)
+  {
+    shards_.push_back(std::unique_ptr<shard>(new shard(alloc)));
+  }
+  index_ = make_index(count_);
+  started_ = make_index(count_);
+  finished_ = make_index(count_);
+  while (top_ * 2 <= count_)
+  {
+    top_ *= 2;
+  }
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::size() const
+{
+  return prefix(count_);
+}
+
+template<class T, class A, class B>
+inline bool sharded_indexing_tree<T,A,B>::empty() const
+{
+  return size() == 0;
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::shards() const
+{
+  return count_;
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::shard_size(size_type i) const
+{
+  return shards_[i]->size_.load(std::memory_order_acquire);
+}
+
+template<class T, class A, class B>
+T sharded_indexing_tree<T,A,B>::operator [] (size_type n) const
+{
+  return at(n);
+}
+
+template<class T, class A, class B>
+T sharded_indexing_tree<T,A,B>::at(size_type n) const
+{
+  std::unique_lock<std::mutex> guard;
+  size_type offset;
+  size_type i = lock(n, false, guard, offset);
+  return shards_[i]->tree_[offset];
+}
+
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::insert(size_type position, const T& x)
+{
+  std::unique_lock<std::mutex> guard;
+  size_type offset;
+  size_type i = lock(position, true, guard, offset);
+  shards_[i]->tree_.insert(offset, x);
+  resized(i);
+  rebalance(i, guard);
+}
+
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::erase(size_type position)
+{
+  std::unique_lock<std::mutex> guard;
+  size_type offset;
+  size_type i = lock(position, false, guard, offset);
+  shards_[i]->tree_.erase(offset);
+  resized(i);
+  rebalance(i, guard);
+}
+
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::push_back(const T& x)
+{
+  std::unique_lock<std::mutex> guard(shards_[count_ - 1]->lock_);
+  shards_[count_ - 1]->tree_.push_back(x);
+  resized(count_ - 1);
+  rebalance(count_ - 1, guard);
+}
+
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::push_front(const T& x)
+{
+  std::unique_lock<std::mutex> guard(shards_[0]->lock_);
+  shards_[0]->tree_.push_front(x);
+  resized(0);
+  rebalance(0, guard);
+}
+
+// Calls f with every element in order while all shards are locked.
+template<class T, class A, class B>
+template<class F>
+void sharded_indexing_tree<T,A,B>::for_each(F f) const
+{
+  locked_view view(*this);
+  for (size_type i = 0; i < count_; ++i)
+  {
+    std::for_each(shards_[i]->tree_.begin(), shards_[i]->tree_.end(), f);
+  }
+}
+
+template<class T, class A, class B>
+template<class OutIter>
+OutIter sharded_indexing_tree<T,A,B>::copy_to(OutIter out) const
+{
+  locked_view view(*this);
+  for (size_type i = 0; i < count_; ++i)
+  {
+    out = shards_[i]->tree_.copy_to(out);
+  }
+  return out;
+}
+
+//////////////////
+// sharded_indexing_tree::locked_view
+//////////////////
+template<class T, class A, class B>
+sharded_indexing_tree<T,A,B>::locked_view::locked_view(const sharded_indexing_tree& tree)
+  : tree_(&tree),guards_()
+{
+  guards_.reserve(tree.count_);
+  for (size_type i = 0; i < tree.count_; ++i)
+  {
+    guards_.push_back(std::unique_lock<std::mutex>(tree.shards_[i]->lock_));
+  }
+}
+
+template<class T, class A, class B>
+typename sharded_indexing_tree<T,A,B>::const_iterator sharded_indexing_tree<T,A,B>::locked_view::begin() const
+{
+  const_iterator it(tree_, 0, tree_->shards_[0]->tree_.begin());
+  it.skip_empty();
+  return it;
+}
+
+template<class T, class A, class B>
+typename sharded_indexing_tree<T,A,B>::const_iterator sharded_indexing_tree<T,A,B>::locked_view::end() const
+{
+  size_type last = tree_->count_ - 1;
+  return const_iterator(tree_, last, tree_->shards_[last]->tree_.end());
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::size_type sharded_indexing_tree<T,A,B>::locked_view::size() const
+{
+  return tree_->size();
+}
+
+//////////////////
+// sharded_indexing_tree::const_iterator
+//////////////////
+template<class T, class A, class B>
+inline sharded_indexing_tree<T,A,B>::const_iterator::const_iterator()
+  : tree_(0),shard_(0),it_()
+{
+}
+
+template<class T, class A, class B>
+inline sharded_indexing_tree<T,A,B>::const_iterator::const_iterator(const sharded_indexing_tree* tree, size_type shard, typename tree_type::const_iterator it)
+  : tree_(tree),shard_(shard),it_(it)
+{
+}
+
+// Steps from the end of a shard to the first element of the next
+// non-empty one; the end of the last shard is the end of the sequence.
+template<class T, class A, class B>
+void sharded_indexing_tree<T,A,B>::const_iterator::skip_empty()
+{
+  while (shard_ + 1 < tree_->count_ && it_ == tree_->shards_[shard_]->tree_.end())
+  {
+    ++shard_;
+    it_ = tree_->shards_[shard_]->tree_.begin();
+  }
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::const_iterator& sharded_indexing_tree<T,A,B>::const_iterator::operator++()
+{
+  ++it_;
+  skip_empty();
+  return *this;
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::const_iterator sharded_indexing_tree<T,A,B>::const_iterator::operator++(int)
+{
+  const_iterator it(*this);
+  ++*this;
+  return it;
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::const_iterator& sharded_indexing_tree<T,A,B>::const_iterator::operator--()
+{
+  while (shard_ != 0 && it_ == tree_->shards_[shard_]->tree_.begin())
+  {
+    --shard_;
+    it_ = tree_->shards_[shard_]->tree_.end();
+  }
+  --it_;
+  return *this;
+}
+
+template<class T, class A, class B>
+inline typename sharded_indexing_tree<T,A,B>::const_iterator sharded_indexing_tree<T,A,B>::const_iterator::operator--(int)
+{
+  const_iterator it(*this);
+  --*this;
+  return it;
+}
+
+template<class T, class A, class B>
+inline bool sharded_indexing_tree<T,A,B>::const_iterator::operator==(const const_iterator& i) const
+{
+  return shard_ == i.shard_ && it_ == i.it_;
+}
+
+template<class T, class A, class B>
+inline bool sharded_indexing_tree<T,A,B>::const_iterator::operator!=(const const_iterator& i) const
+{
+  return !(*this == i);
+}
+
+template<class T, class A, class B>
+inline const T& sharded_indexing_tree<T,A,B>::const_iterator::operator*() const
+{
+  return *it_;
+}
+
+template<class T, class A, class B>
+inline const T* sharded_indexing_tree<T,A,B>::const_iterator::operator->() const
+{
+  return &*it_;
+}
+
+} // end of namespace osoken
+
+#endif // SHARDED_INDEXING_TREE_HPP_
@@ -0,0 +1,1141 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+#ifndef SMALL_INDEXING_TREE_HPP_
+#define SMALL_INDEXING_TREE_HPP_
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include "indexing_tree.hpp"
+
+namespace osoken
+{
+
+// indexing_tree with small-size optimisation.
+// Up to N elements are kept in a flat array inside the object, so short
+// sequences never touch the heap. The first insertion beyond N moves the
+// elements into an indexing_tree, and clear() returns to the inline array.
+// As with std::vector, moving between the two modes invalidates iterators.
+template<class T, std::size_t N = 16, class Alloc = ::std::allocator<T> >
+class small_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc> tree_type;
+  typedef typename tree_type::reference reference;
+  typedef typename tree_type::pointer pointer;
+  typedef typename tree_type::const_reference const_reference;
+  typedef typename tree_type::const_pointer const_pointer;
+  typedef Alloc allocator_type;
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  static const size_type inline_capacity = N;
+
+  class iterator : public std::iterator<std::random_access_iterator_tag, value_type, difference_type, pointer, reference>
+  {
+  public:
+    iterator(const iterator& i);
+    iterator();
+    iterator& operator++();
+    iterator operator++(int);
+    iterator& operator--();
+    iterator operator--(int);
+    iterator operator+(difference_type diff) const;
+    iterator operator-(difference_type diff) const;
+    iterator& operator+=(difference_type diff);
+    iterator& operator-=(difference_type diff);
+    difference_type operator - (const iterator& i) const;
+    bool operator == (const iterator& i) const;
+    bool operator != (const iterator& i) const;
+    bool operator < (const iterator& i) const;
+    bool operator <= (const iterator& i) const;
+    bool operator > (const iterator& i) const;
+    bool operator >= (const iterator& i) const;
+    reference operator [] (difference_type diff) const;
+    reference operator*() const;
+    pointer operator->() const;
+  private:
+    iterator(pointer ptr);
+    iterator(typename tree_type::iterator it);
+
+    pointer ptr_;
+    typename tree_type::iterator it_;
+
+    friend class small_indexing_tree;
+  };
+
+  class const_iterator : public std::iterator<std::random_access_iterator_tag, value_type, difference_type, const_pointer, const_reference>
+  {
+  public:
+    const_iterator(const iterator& i);
+    const_iterator(const const_iterator& i);
+    const_iterator();
+    const_iterator& operator++();
+    const_iterator operator++(int);
+    const_iterator& operator--();
+    const_iterator operator--(int);
+    const_iterator operator+(difference_type diff) const;
+    const_iterator operator-(difference_type diff) const;
+    const_iterator& operator+=(difference_type diff);
+    const_iterator& operator-=(difference_type diff);
+    difference_type operator - (const const_iterator& i) const;
+    bool operator == (const const_iterator& i) const;
+    bool operator != (const const_iterator& i) const;
+    bool operator < (const const_iterator& i) const;
+    bool operator <= (const const_iterator& i) const;
+    bool operator > (const const_iterator& i) const;
+    bool operator >= (const const_iterator& i) const;
+    const_reference operator [] (difference_type diff) const;
+    const_reference operator*() const;
+    const_pointer operator->() const;
+  private:
+    const_iterator(const_pointer ptr);
+    const_iterator(typename tree_type::const_iterator it);
+
+    const_pointer ptr_;
+    typename tree_type::const_iterator it_;
+
+    friend class small_indexing_tree;
+  };
+
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  explicit small_indexing_tree(const Alloc& alloc = Alloc());
+  explicit small_indexing_tree(size_type n, const T& x, const Alloc& alloc = Alloc());
+  small_indexing_tree(const small_indexing_tree& that);
+  small_indexing_tree(const small_indexing_tree& that, const Alloc& alloc);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  small_indexing_tree(small_indexing_tree&& that);
+#endif
+  ~small_indexing_tree();
+
+  small_indexing_tree& operator = (const small_indexing_tree& that);
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+  small_indexing_tree& operator = (small_indexing_tree&& that);
+#endif
+  void assign(size_type n, const T& x);
+  Alloc get_allocator() const;
+
+  iterator begin();
+  const_iterator begin() const;
+  iterator end();
+  const_iterator end() const;
+  reverse_iterator rbegin();
+  const_reverse_iterator rbegin() const;
+  reverse_iterator rend();
+  const_reverse_iterator rend() const;
+  size_type size() const;
+  size_type max_size() const;
+  void resize(size_type sz, const T& x = T());
+  bool empty() const;
+  bool is_inline() const;
+
+  reference operator [] (size_type n);
+  const_reference operator [] (size_type n) const;
+  const_reference at(size_type n) const;
+  reference at(size_type n);
+  reference front();
+  const_reference front() const;
+  reference back();
+  const_reference back() const;
+
+  void push_back(const T& x);
+  void pop_back();
+  void push_front(const T& x);
+  void pop_front();
+  iterator insert(iterator position, const T& x);
+  void insert(iterator position, size_type n, const T& x);
+  iterator erase(iterator position);
+  iterator erase(iterator first, iterator last);
+  void swap(small_indexing_tree& that);
+
+  void clear();
+private:
+  union
+  {
+    char bytes_[N * sizeof(T)];
+    long double long_double_;
+    void* pointer_;
+    long long_;
+  } storage_;
+  size_type count_;
+  bool inline_;
+  tree_type tree_;
+
+  pointer data();
+  const_pointer data() const;
+  void range_check_leq(size_type n) const;
+  static allocator_type select_allocator(const allocator_type& alloc);
+  static void construct_value(allocator_type& alloc, T* p, const T& x);
+  static void relocate_value(allocator_type& alloc, T* p, T& x);
+  static void destroy_value(allocator_type& alloc, T* p);
+  void destroy_inline();
+  void take_inline(small_indexing_tree& that);
+  void copy_construct(const small_indexing_tree& that);
+  void move_to_tree();
+  void insert_inline(size_type n, const T& x);
+  void erase_inline(size_type n);
+};
+
+template<class T, std::size_t N, class A>
+const typename small_indexing_tree<T,N,A>::size_type small_indexing_tree<T,N,A>::inline_capacity;
+
+//////////////////
+// iterator
+//////////////////
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::iterator::iterator(const iterator& i):
+ptr_(i.ptr_),it_(i.it_)
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::iterator::iterator():
+ptr_(0),it_()
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::iterator::iterator(pointer ptr):
+ptr_(ptr),it_()
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::iterator::iterator(typename tree_type::iterator it):
+ptr_(0),it_(it)
+{
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator& small_indexing_tree<T,N,A>::iterator::operator++()
+{
+  if (ptr_)
+  {
+    ++ptr_;
+  }
+  else
+  {
+    ++it_;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::iterator::operator++(int)
+{
+  iterator tmp = *this;
+  operator++();
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator& small_indexing_tree<T,N,A>::iterator::operator--()
+{
+  if (ptr_)
+  {
+    --ptr_;
+  }
+  else
+  {
+    --it_;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::iterator::operator--(int)
+{
+  iterator tmp = *this;
+  operator--();
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::iterator::operator + (difference_type diff) const
+{
+  iterator tmp = *this;
+  tmp += diff;
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::iterator::operator - (difference_type diff) const
+{
+  iterator tmp = *this;
+  tmp -= diff;
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator& small_indexing_tree<T,N,A>::iterator::operator += (difference_type diff)
+{
+  if (ptr_)
+  {
+    ptr_ += diff;
+  }
+  else
+  {
+    it_ += diff;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator& small_indexing_tree<T,N,A>::iterator::operator -= (difference_type diff)
+{
+  return operator+=(-diff);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::difference_type small_indexing_tree<T,N,A>::iterator::operator - (const iterator& i) const
+{
+  if (ptr_)
+  {
+    return ptr_ - i.ptr_;
+  }
+  return it_ - i.it_;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator == (const iterator& i) const
+{
+  if (ptr_)
+  {
+    return ptr_ == i.ptr_;
+  }
+  return it_ == i.it_;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator != (const iterator& i) const
+{
+  return !operator==(i);
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator < (const iterator& i) const
+{
+  return (*this - i) < 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator <= (const iterator& i) const
+{
+  return (*this - i) <= 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator > (const iterator& i) const
+{
+  return (*this - i) > 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::iterator::operator >= (const iterator& i) const
+{
+  return (*this - i) >= 0;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::iterator::operator [] (difference_type diff) const
+{
+  return *(*this + diff);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::iterator::operator*() const
+{
+  if (ptr_)
+  {
+    return *ptr_;
+  }
+  typename tree_type::iterator tmp = it_;
+  return *tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::pointer small_indexing_tree<T,N,A>::iterator::operator->() const
+{
+  return &(operator*());
+}
+
+//////////////////
+// const_iterator
+//////////////////
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::const_iterator::const_iterator(const iterator& i):
+ptr_(i.ptr_),it_(i.it_)
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::const_iterator::const_iterator(const const_iterator& i):
+ptr_(i.ptr_),it_(i.it_)
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::const_iterator::const_iterator():
+ptr_(0),it_()
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::const_iterator::const_iterator(const_pointer ptr):
+ptr_(ptr),it_()
+{
+}
+
+template<class T, std::size_t N, class A>
+inline small_indexing_tree<T,N,A>::const_iterator::const_iterator(typename tree_type::const_iterator it):
+ptr_(0),it_(it)
+{
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator& small_indexing_tree<T,N,A>::const_iterator::operator++()
+{
+  if (ptr_)
+  {
+    ++ptr_;
+  }
+  else
+  {
+    ++it_;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::const_iterator::operator++(int)
+{
+  const_iterator tmp = *this;
+  operator++();
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator& small_indexing_tree<T,N,A>::const_iterator::operator--()
+{
+  if (ptr_)
+  {
+    --ptr_;
+  }
+  else
+  {
+    --it_;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::const_iterator::operator--(int)
+{
+  const_iterator tmp = *this;
+  operator--();
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::const_iterator::operator + (difference_type diff) const
+{
+  const_iterator tmp = *this;
+  tmp += diff;
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::const_iterator::operator - (difference_type diff) const
+{
+  const_iterator tmp = *this;
+  tmp -= diff;
+  return tmp;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator& small_indexing_tree<T,N,A>::const_iterator::operator += (difference_type diff)
+{
+  if (ptr_)
+  {
+    ptr_ += diff;
+  }
+  else
+  {
+    it_ += diff;
+  }
+  return *this;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator& small_indexing_tree<T,N,A>::const_iterator::operator -= (difference_type diff)
+{
+  return operator+=(-diff);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::difference_type small_indexing_tree<T,N,A>::const_iterator::operator - (const const_iterator& i) const
+{
+  if (ptr_)
+  {
+    return ptr_ - i.ptr_;
+  }
+  return it_ - i.it_;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator == (const const_iterator& i) const
+{
+  if (ptr_)
+  {
+    return ptr_ == i.ptr_;
+  }
+  return it_ == i.it_;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator != (const const_iterator& i) const
+{
+  return !operator==(i);
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator < (const const_iterator& i) const
+{
+  return (*this - i) < 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator <= (const const_iterator& i) const
+{
+  return (*this - i) <= 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator > (const const_iterator& i) const
+{
+  return (*this - i) > 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::const_iterator::operator >= (const const_iterator& i) const
+{
+  return (*this - i) >= 0;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::const_iterator::operator [] (difference_type diff) const
+{
+  return *(*this + diff);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::const_iterator::operator*() const
+{
+  if (ptr_)
+  {
+    return *ptr_;
+  }
+  return *it_;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_pointer small_indexing_tree<T,N,A>::const_iterator::operator->() const
+{
+  return &(operator*());
+}
+
+//////////////////
+// small_indexing_tree
+//////////////////
+// private member functions
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::pointer small_indexing_tree<T,N,A>::data()
+{
+  return reinterpret_cast<pointer>(storage_.bytes_);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_pointer small_indexing_tree<T,N,A>::data() const
+{
+  return reinterpret_cast<const_pointer>(storage_.bytes_);
+}
+
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::range_check_leq(size_type n) const
+{
+  if ( size() <= n )
+  {
+    throw std::out_of_range("small_indexing_tree::out_of_range");
+  }
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::allocator_type small_indexing_tree<T,N,A>::select_allocator(const allocator_type& alloc)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  return std::allocator_traits<A>::select_on_container_copy_construction(alloc);
+#else
+  return alloc;
+#endif
+}
+
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::construct_value(allocator_type& alloc, T* p, const T& x)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::construct(alloc, p, x);
+#else
+  alloc.construct(p, x);
+#endif
+}
+
+// constructs *p from x, which is about to be destroyed
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::relocate_value(allocator_type& alloc, T* p, T& x)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::construct(alloc, p, std::move(x));
+#else
+  alloc.construct(p, x);
+#endif
+}
+
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::destroy_value(allocator_type& alloc, T* p)
+{
+#if INDEXING_TREE_HAS_ALLOCATOR_TRAITS
+  std::allocator_traits<A>::destroy(alloc, p);
+#else
+  alloc.destroy(p);
+#endif
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::destroy_inline()
+{
+  A alloc = get_allocator();
+  while (count_ != 0)
+  {
+    destroy_value(alloc, data() + --count_);
+  }
+}
+
+// Moves the inline elements of that into this empty array and leaves that
+// with none. If a move throws, the elements moved so far are destroyed.
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::take_inline(small_indexing_tree& that)
+{
+  A alloc = get_allocator();
+  try
+  {
+    for (; count_ < that.count_; ++count_)
+    {
+      relocate_value(alloc, data() + count_, that.data()[count_]);
+    }
+  }
+  catch (...)
+  {
+    destroy_inline();
+    throw;
+  }
+  that.destroy_inline();
+}
+
+// Copies the inline elements into tree_. If that fails the inline array is
+// left untouched.
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::move_to_tree()
+{
+  try
+  {
+    for (size_type i = 0; i < count_; ++i)
+    {
+      tree_.push_back(data()[i]);
+    }
+  }
+  catch (...)
+  {
+    tree_.clear();
+    throw;
+  }
+  destroy_inline();
+  inline_ = false;
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::insert_inline(size_type n, const T& x)
+{
+  A alloc = get_allocator();
+  pointer p = data();
+  if (n == count_)
+  {
+    construct_value(alloc, p + count_, x);
+    ++count_;
+    return;
+  }
+  T tmp(x);
+  construct_value(alloc, p + count_, p[count_ - 1]);
+  ++count_;
+  for (size_type i = count_ - 2; i != n; --i)
+  {
+    p[i] = p[i - 1];
+  }
+  p[n] = tmp;
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::erase_inline(size_type n)
+{
+  pointer p = data();
+  for (size_type i = n + 1; i < count_; ++i)
+  {
+    p[i - 1] = p[i];
+  }
+  A alloc = get_allocator();
+  destroy_value(alloc, p + --count_);
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::copy_construct(const small_indexing_tree& that)
+{
+  try
+  {
+    for (const_iterator it = that.begin(); it != that.end(); ++it)
+    {
+      push_back(*it);
+    }
+  }
+  catch (...)
+  {
+    clear();
+    throw;
+  }
+}
+
+// public member functions
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::small_indexing_tree(const A& alloc)
+  : count_(0),inline_(true),tree_(alloc)
+{
+}
+
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::small_indexing_tree(size_type n, const T& x, const A& alloc)
+  : count_(0),inline_(true),tree_(alloc)
+{
+  try
+  {
+    insert(end(), n, x);
+  }
+  catch (...)
+  {
+    clear();
+    throw;
+  }
+}
+
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::small_indexing_tree(const small_indexing_tree& that)
+  : count_(0),inline_(true),tree_(select_allocator(that.get_allocator()))
+{
+  copy_construct(that);
+}
+
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::small_indexing_tree(const small_indexing_tree& that, const A& alloc)
+  : count_(0),inline_(true),tree_(alloc)
+{
+  copy_construct(that);
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+// The tree and its allocator are taken over; inline elements are moved one
+// by one. that is left empty and inline.
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::small_indexing_tree(small_indexing_tree&& that)
+  : count_(0),inline_(that.inline_),tree_(std::move(that.tree_))
+{
+  take_inline(that);
+  that.inline_ = true;
+}
+#endif
+
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>::~small_indexing_tree()
+{
+  destroy_inline();
+}
+
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>& small_indexing_tree<T,N,A>::operator=(const small_indexing_tree& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  clear();
+  tree_ = that.tree_;
+  inline_ = that.inline_;
+  A alloc = get_allocator();
+  for (; count_ < that.count_; ++count_)
+  {
+    construct_value(alloc, data() + count_, that.data()[count_]);
+  }
+  return *this;
+}
+
+#if INDEXING_TREE_HAS_RVALUE_REFERENCES
+// The tree is move-assigned, so its allocator follows the same rules as in
+// indexing_tree; inline elements are moved into storage of the allocator
+// this ends up with.
+template<class T, std::size_t N, class A>
+small_indexing_tree<T,N,A>& small_indexing_tree<T,N,A>::operator=(small_indexing_tree&& that)
+{
+  if (this == &that)
+  {
+    return *this;
+  }
+  clear();
+  tree_ = std::move(that.tree_);
+  inline_ = that.inline_;
+  take_inline(that);
+  that.inline_ = true;
+  return *this;
+}
+#endif
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::assign(size_type n, const T& x)
+{
+  small_indexing_tree tmp(n,x,get_allocator());
+  swap(tmp);
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::allocator_type small_indexing_tree<T,N,A>::get_allocator() const
+{
+  return tree_.get_allocator();
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::begin()
+{
+  return inline_ ? iterator(data()) : iterator(tree_.begin());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::begin() const
+{
+  return inline_ ? const_iterator(data()) : const_iterator(tree_.begin());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::end()
+{
+  return inline_ ? iterator(data() + count_) : iterator(tree_.end());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_iterator small_indexing_tree<T,N,A>::end() const
+{
+  return inline_ ? const_iterator(data() + count_) : const_iterator(tree_.end());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reverse_iterator small_indexing_tree<T,N,A>::rbegin()
+{
+  return reverse_iterator(end());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reverse_iterator small_indexing_tree<T,N,A>::rbegin() const
+{
+  return const_reverse_iterator(end());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reverse_iterator small_indexing_tree<T,N,A>::rend()
+{
+  return reverse_iterator(begin());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reverse_iterator small_indexing_tree<T,N,A>::rend() const
+{
+  return const_reverse_iterator(begin());
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::size_type small_indexing_tree<T,N,A>::size() const
+{
+  return inline_ ? count_ : tree_.size();
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::size_type small_indexing_tree<T,N,A>::max_size() const
+{
+  return tree_.max_size();
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::resize(size_type sz, const T& x)
+{
+  if (size() < sz)
+  {
+    insert(end(),sz-size(),x);
+    return;
+  }
+  while (sz < size())
+  {
+    pop_back();
+  }
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::empty() const
+{
+  return size() == 0;
+}
+
+template<class T, std::size_t N, class A>
+inline bool small_indexing_tree<T,N,A>::is_inline() const
+{
+  return inline_;
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::operator[](size_type n)
+{
+  range_check_leq(n);
+  return inline_ ? data()[n] : tree_[n];
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::operator[](size_type n) const
+{
+  range_check_leq(n);
+  return inline_ ? data()[n] : tree_[n];
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::at(size_type n)
+{
+  range_check_leq(n);
+  return inline_ ? data()[n] : tree_[n];
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::at(size_type n) const
+{
+  range_check_leq(n);
+  return inline_ ? data()[n] : tree_[n];
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::front()
+{
+  return inline_ ? data()[0] : tree_.front();
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::front() const
+{
+  return inline_ ? data()[0] : tree_.front();
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::reference small_indexing_tree<T,N,A>::back()
+{
+  return inline_ ? data()[count_ - 1] : tree_.back();
+}
+
+template<class T, std::size_t N, class A>
+inline typename small_indexing_tree<T,N,A>::const_reference small_indexing_tree<T,N,A>::back() const
+{
+  return inline_ ? data()[count_ - 1] : tree_.back();
+}
+
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::push_back(const T& x)
+{
+  insert(end(), x);
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::pop_back()
+{
+  if (!inline_)
+  {
+    tree_.pop_back();
+    return;
+  }
+  if (count_ != 0)
+  {
+    erase_inline(count_ - 1);
+  }
+}
+
+template<class T, std::size_t N, class A>
+inline void small_indexing_tree<T,N,A>::push_front(const T& x)
+{
+  insert(begin(), x);
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::pop_front()
+{
+  if (!inline_)
+  {
+    tree_.pop_front();
+    return;
+  }
+  if (count_ != 0)
+  {
+    erase_inline(0);
+  }
+}
+
+template<class T, std::size_t N, class A>
+typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::insert(iterator position, const T& x)
+{
+  if (!inline_)
+  {
+    return iterator(tree_.insert(position.it_, x));
+  }
+  size_type n = position.ptr_ - data();
+  if (count_ < N)
+  {
+    insert_inline(n, x);
+    return iterator(data() + n);
+  }
+  T tmp(x);
+  move_to_tree();
+  return iterator(tree_.insert(tree_.begin() + n, tmp));
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::insert(iterator position, size_type n, const T& x)
+{
+  if (!inline_)
+  {
+    tree_.insert(position.it_, n, x);
+    return;
+  }
+  size_type pos = position.ptr_ - data();
+  if (N < count_ + n)
+  {
+    T tmp(x);
+    move_to_tree();
+    tree_.insert(tree_.begin() + pos, n, tmp);
+    return;
+  }
+  size_type i;
+  try
+  {
+    for (i=0;i<n;++i)
+    {
+      insert_inline(pos, x);
+    }
+  }
+  catch (...)
+  {
+    while (i-- != 0)
+    {
+      erase_inline(pos);
+    }
+    throw;
+  }
+}
+
+template<class T, std::size_t N, class A>
+typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::erase(iterator position)
+{
+  if (!inline_)
+  {
+    return iterator(tree_.erase(position.it_));
+  }
+  if (position.ptr_ == data() + count_)
+  {
+    return position;
+  }
+  erase_inline(position.ptr_ - data());
+  return position;
+}
+
+template<class T, std::size_t N, class A>
+typename small_indexing_tree<T,N,A>::iterator small_indexing_tree<T,N,A>::erase(iterator first, iterator last)
+{
+  difference_type n = last - first;
+  while (n-- != 0)
+  {
+    first = erase(first);
+  }
+  return first;
+}
+
+// Inline elements are swapped in place and the surplus of the longer array
+// is moved over, so at most N elements are touched; the trees are swapped in
+// O(1). A side in tree mode has no inline elements.
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::swap(small_indexing_tree& that)
+{
+  small_indexing_tree* shorter = (count_ < that.count_) ? this : &that;
+  small_indexing_tree* longer = (count_ < that.count_) ? &that : this;
+  pointer a = shorter->data();
+  pointer b = longer->data();
+  size_type common = shorter->count_;
+  for (size_type i = 0; i < common; ++i)
+  {
+    using std::swap;
+    swap(a[i], b[i]);
+  }
+  A alloc = get_allocator();
+  while (shorter->count_ < longer->count_)
+  {
+    relocate_value(alloc, a + shorter->count_, b[shorter->count_]);
+    ++shorter->count_;
+  }
+  while (common < longer->count_)
+  {
+    destroy_value(alloc, b + --longer->count_);
+  }
+  tree_.swap(that.tree_);
+  std::swap(inline_, that.inline_);
+}
+
+template<class T, std::size_t N, class A>
+void small_indexing_tree<T,N,A>::clear()
+{
+  destroy_inline();
+  tree_.clear();
+  inline_ = true;
+}
+
+} // end of namespace osoken
+
+#endif // SMALL_INDEXING_TREE_HPP_
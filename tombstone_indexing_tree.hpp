@@ -0,0 +1,373 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+
+#ifndef TOMBSTONE_INDEXING_TREE_HPP_
+#define TOMBSTONE_INDEXING_TREE_HPP_
+
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include "indexing_tree.hpp"
+
+namespace osoken
+{
+
+// A sequence whose erasures only mark the element dead (see tombstoned<>):
+// erase() costs one descent and one walk back to the root, without
+// relinking or rotations. Positions, size() and iteration see the live
+// elements only. Once the dead elements outnumber compact_ratio times the
+// live ones, the next erasure removes them all in one linear rebuild, so
+// erasure stays amortized O(log n); compact() does so at any time.
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
+class tombstone_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc,tombstoned<Balance> > tree_type;
+  typedef typename tree_type::reference reference;
+  typedef typename tree_type::const_reference const_reference;
+  typedef typename tree_type::size_type size_type;
+  typedef typename tree_type::difference_type difference_type;
+  typedef T value_type;
+
+  class const_iterator : public std::iterator<std::bidirectional_iterator_tag, T, difference_type, const T*, const T&>
+  {
+  public:
+    const_iterator();
+    const_iterator& operator++();
+    const_iterator operator++(int);
+    const_iterator& operator--();
+    const_iterator operator--(int);
+    bool operator == (const const_iterator& i) const;
+    bool operator != (const const_iterator& i) const;
+    const_reference operator*() const;
+    const T* operator->() const;
+  private:
+    const_iterator(const tree_type* tree, typename tree_type::const_iterator position);
+
+    const tree_type* tree_;
+    typename tree_type::const_iterator position_;
+
+    friend class tombstone_indexing_tree;
+  };
+
+  explicit tombstone_indexing_tree(double compact_ratio = 1.0, const Alloc& alloc = Alloc());
+
+  const tree_type& tree() const;
+  const_iterator begin() const;
+  const_iterator end() const;
+  size_type size() const;
+  bool empty() const;
+  size_type dead() const;
+  double compact_ratio() const;
+  void set_compact_ratio(double ratio);
+
+  reference operator [] (size_type n);
+  const_reference operator [] (size_type n) const;
+  reference at(size_type n);
+  const_reference at(size_type n) const;
+  reference front();
+  const_reference front() const;
+  reference back();
+  const_reference back() const;
+
+  void push_back(const T& x);
+  void pop_back();
+  void push_front(const T& x);
+  void pop_front();
+  void insert(size_type position, const T& x);
+  void erase(size_type position);
+  void clear();
+  size_type compact();
+private:
+  tombstone_indexing_tree(const tombstone_indexing_tree&);
+  tombstone_indexing_tree& operator = (const tombstone_indexing_tree&);
+
+  tree_type tree_;
+  size_type dead_;
+  double ratio_;
+
+  void range_check(size_type n) const;
+};
+
+//////////////////
+// tombstone_indexing_tree::const_iterator
+//////////////////
+template<class T, class A, class B>
+inline tombstone_indexing_tree<T,A,B>::const_iterator::const_iterator()
+  : tree_(0),position_()
+{
+}
+
+template<class T, class A, class B>
+inline tombstone_indexing_tree<T,A,B>::const_iterator::const_iterator(const tree_type* tree, typename tree_type::const_iterator position)
+  : tree_(tree),position_(position)
+{
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator& tombstone_indexing_tree<T,A,B>::const_iterator::operator++()
+{
+  do
+  {
+    ++position_;
+  }
+  while (position_ != tree_->end() && tree_->is_dead(position_));
+  return *this;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator tombstone_indexing_tree<T,A,B>::const_iterator::operator++(int)
+{
+  const_iterator ret(*this);
+  ++(*this);
+  return ret;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator& tombstone_indexing_tree<T,A,B>::const_iterator::operator--()
+{
+  do
+  {
+    --position_;
+  }
+  while (tree_->is_dead(position_));
+  return *this;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator tombstone_indexing_tree<T,A,B>::const_iterator::operator--(int)
+{
+  const_iterator ret(*this);
+  --(*this);
+  return ret;
+}
+
+template<class T, class A, class B>
+inline bool tombstone_indexing_tree<T,A,B>::const_iterator::operator == (const const_iterator& i) const
+{
+  return position_ == i.position_;
+}
+
+template<class T, class A, class B>
+inline bool tombstone_indexing_tree<T,A,B>::const_iterator::operator != (const const_iterator& i) const
+{
+  return position_ != i.position_;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_reference tombstone_indexing_tree<T,A,B>::const_iterator::operator*() const
+{
+  return *position_;
+}
+
+template<class T, class A, class B>
+inline const T* tombstone_indexing_tree<T,A,B>::const_iterator::operator->() const
+{
+  return &*position_;
+}
+
+//////////////////
+// tombstone_indexing_tree
+//////////////////
+// private member functions
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::range_check(size_type n) const
+{
+  if (size() <= n)
+  {
+    throw std::out_of_range("indexing_tree::out_of_range");
+  }
+}
+
+// public member functions
+template<class T, class A, class B>
+tombstone_indexing_tree<T,A,B>::tombstone_indexing_tree(double compact_ratio, const A& alloc)
+  : tree_(alloc),dead_(0),ratio_(compact_ratio)
+{
+}
+
+template<class T, class A, class B>
+inline const typename tombstone_indexing_tree<T,A,B>::tree_type& tombstone_indexing_tree<T,A,B>::tree() const
+{
+  return tree_;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator tombstone_indexing_tree<T,A,B>::begin() const
+{
+  return const_iterator(&tree_, tree_.nth_live(0));
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_iterator tombstone_indexing_tree<T,A,B>::end() const
+{
+  return const_iterator(&tree_, tree_.end());
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::size_type tombstone_indexing_tree<T,A,B>::size() const
+{
+  return tree_.size() - dead_;
+}
+
+template<class T, class A, class B>
+inline bool tombstone_indexing_tree<T,A,B>::empty() const
+{
+  return size() == 0;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::size_type tombstone_indexing_tree<T,A,B>::dead() const
+{
+  return dead_;
+}
+
+template<class T, class A, class B>
+inline double tombstone_indexing_tree<T,A,B>::compact_ratio() const
+{
+  return ratio_;
+}
+
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::set_compact_ratio(double ratio)
+{
+  ratio_ = ratio;
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::reference tombstone_indexing_tree<T,A,B>::operator [] (size_type n)
+{
+  return *tree_.nth_live(n);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_reference tombstone_indexing_tree<T,A,B>::operator [] (size_type n) const
+{
+  return *tree_.nth_live(n);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::reference tombstone_indexing_tree<T,A,B>::at(size_type n)
+{
+  range_check(n);
+  return *tree_.nth_live(n);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_reference tombstone_indexing_tree<T,A,B>::at(size_type n) const
+{
+  range_check(n);
+  return *tree_.nth_live(n);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::reference tombstone_indexing_tree<T,A,B>::front()
+{
+  return *tree_.nth_live(0);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_reference tombstone_indexing_tree<T,A,B>::front() const
+{
+  return *tree_.nth_live(0);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::reference tombstone_indexing_tree<T,A,B>::back()
+{
+  return *tree_.nth_live(size() - 1);
+}
+
+template<class T, class A, class B>
+inline typename tombstone_indexing_tree<T,A,B>::const_reference tombstone_indexing_tree<T,A,B>::back() const
+{
+  return *tree_.nth_live(size() - 1);
+}
+
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::push_back(const T& x)
+{
+  tree_.push_back(x);
+}
+
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::pop_back()
+{
+  erase(size() - 1);
+}
+
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::push_front(const T& x)
+{
+  tree_.push_front(x);
+}
+
+template<class T, class A, class B>
+inline void tombstone_indexing_tree<T,A,B>::pop_front()
+{
+  erase(0);
+}
+
+// The new element goes right in front of the live element at position,
+// behind any dead ones before it.
+template<class T, class A, class B>
+void tombstone_indexing_tree<T,A,B>::insert(size_type position, const T& x)
+{
+  if (size() < position)
+  {
+    throw std::out_of_range("indexing_tree::out_of_range");
+  }
+  tree_.insert(tree_.nth_live(position), x);
+}
+
+template<class T, class A, class B>
+void tombstone_indexing_tree<T,A,B>::erase(size_type position)
+{
+  range_check(position);
+  tree_.mark_dead(tree_.nth_live(position));
+  ++dead_;
+  if (ratio_ * static_cast<double>(size()) < static_cast<double>(dead_))
+  {
+    compact();
+  }
+}
+
+template<class T, class A, class B>
+void tombstone_indexing_tree<T,A,B>::clear()
+{
+  tree_.clear();
+  dead_ = 0;
+}
+
+template<class T, class A, class B>
+typename tombstone_indexing_tree<T,A,B>::size_type tombstone_indexing_tree<T,A,B>::compact()
+{
+  size_type n = tree_.compact();
+  dead_ = 0;
+  return n;
+}
+
+} // end of namespace osoken
+
+#endif // TOMBSTONE_INDEXING_TREE_HPP_
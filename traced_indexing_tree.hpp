@@ -0,0 +1,398 @@
+/* --
+Copyright (c) 2012--2014 Takeshi OSOEKAWA
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+-- */
+
+#ifndef TRACED_INDEXING_TREE_HPP_
+#define TRACED_INDEXING_TREE_HPP_
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "indexing_tree.hpp"
+#include "indexing_tree_codec.hpp"
+
+namespace osoken
+{
+
+// Binary trace of the calls made on a traced_indexing_tree. The file starts
+// with an 8 byte magic; every record then holds the operation in one byte
+// and its position, element count and the size of the sequence just before
+// the call as variable-length numbers. Element values are not recorded.
+class indexing_tree_trace
+{
+public:
+  enum opcode
+  {
+    read_op = 1,
+    insert_op,
+    erase_op,
+    push_back_op,
+    pop_back_op,
+    push_front_op,
+    pop_front_op,
+    clear_op
+  };
+
+  struct record
+  {
+    opcode op_;
+    std::size_t position_;
+    std::size_t count_;
+    std::size_t size_;
+  };
+
+  static const char* magic();
+  static void put(std::vector<char>& out, const record& r);
+  static void read(const std::string& path, std::vector<record>& out);
+};
+
+// indexing_tree that appends every call to a trace file for later replay
+// (see bench/replay.cpp). Positional reads through operator[], at(),
+// front() and back() are recorded as well, so the trace keeps the access
+// skew of the workload; reads through iterators are not. Records are
+// buffered and written in blocks, and by flush() or the destructor.
+template<class T, class Alloc = ::std::allocator<T>, class Balance = weight_balance<> >
+class traced_indexing_tree
+{
+public:
+  typedef indexing_tree<T,Alloc,Balance> tree_type;
+  typedef typename tree_type::const_reference const_reference;
+  typedef typename tree_type::const_iterator const_iterator;
+  typedef typename tree_type::size_type size_type;
+  typedef typename tree_type::difference_type difference_type;
+  typedef T value_type;
+
+  explicit traced_indexing_tree(const std::string& path, const Alloc& alloc = Alloc());
+  ~traced_indexing_tree();
+
+  const tree_type& tree() const;
+  const_iterator begin() const;
+  const_iterator end() const;
+  size_type size() const;
+  bool empty() const;
+  const_reference operator [] (size_type n) const;
+  const_reference at(size_type n) const;
+  const_reference front() const;
+  const_reference back() const;
+
+  void push_back(const T& x);
+  void pop_back();
+  void push_front(const T& x);
+  void pop_front();
+  void insert(size_type position, const T& x);
+  void erase(size_type position);
+  void erase(size_type position, size_type n);
+  void clear();
+
+  void flush() const;
+private:
+  traced_indexing_tree(const traced_indexing_tree&);
+  traced_indexing_tree& operator = (const traced_indexing_tree&);
+
+  static const std::size_t block_size_ = 1 << 16;
+
+  tree_type tree_;
+  std::FILE* file_;
+  mutable std::vector<char> buffer_;
+
+  void trace(indexing_tree_trace::opcode op, size_type position, size_type n, size_type size) const;
+  static void fail(const char* what);
+};
+
+//////////////////
+// indexing_tree_trace
+//////////////////
+inline const char* indexing_tree_trace::magic()
+{
+  return "itreetrc";
+}
+
+inline void indexing_tree_trace::put(std::vector<char>& out, const record& r)
+{
+  out.push_back(static_cast<char>(r.op_));
+  indexing_tree_codec::put_number(out, r.position_);
+  indexing_tree_codec::put_number(out, r.count_);
+  indexing_tree_codec::put_number(out, r.size_);
+}
+
+// Appends the records of the trace at path to out. A record cut short at
+// the end, as left by a process that did not flush, is dropped.
+inline void indexing_tree_trace::read(const std::string& path, std::vector<record>& out)
+{
+  std::FILE* f = std::fopen(path.c_str(), "rb");
+  if (f == 0)
+  {
+    throw std::runtime_error("indexing_tree_trace: open: " + path + ": " + std::strerror(errno));
+  }
+  std::vector<char> data;
+  char block[1 << 16];
+  std::size_t got;
+  while ((got = std::fread(block, 1, sizeof(block), f)) != 0)
+  {
+    data.insert(data.end(), block, block + got);
+  }
+  bool failed = std::ferror(f) != 0;
+  std::fclose(f);
+  if (failed)
+  {
+    throw std::runtime_error("indexing_tree_trace: read: " + path);
+  }
+  if (data.size() < 8 || std::memcmp(&data[0], magic(), 8) != 0)
+  {
+    throw std::runtime_error("indexing_tree_trace: not a trace: " + path);
+  }
+  const char* p = &data[0] + 8;
+  const char* end = &data[0] + data.size();
+  while (p != end)
+  {
+    unsigned char op = static_cast<unsigned char>(*p++);
+    unsigned long long position, count, size;
+    if (op < read_op || clear_op < op)
+    {
+      throw std::runtime_error("indexing_tree_trace: bad record: " + path);
+    }
+    if (!indexing_tree_codec::get_number(p, end, position) || !indexing_tree_codec::get_number(p, end, count) || !indexing_tree_codec::get_number(p, end, size))
+    {
+      break;
+    }
+    record r = { static_cast<opcode>(op), static_cast<std::size_t>(position), static_cast<std::size_t>(count), static_cast<std::size_t>(size) };
+    out.push_back(r);
+  }
+}
+
+//////////////////
+// traced_indexing_tree
+//////////////////
+// private member functions
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::fail(const char* what)
+{
+  indexing_tree_codec::fail("traced_indexing_tree", what);
+}
+
+template<class T, class A, class B>
+inline void traced_indexing_tree<T,A,B>::trace(indexing_tree_trace::opcode op, size_type position, size_type n, size_type size) const
+{
+  indexing_tree_trace::record r = { op, position, n, size };
+  indexing_tree_trace::put(buffer_, r);
+  if (block_size_ <= buffer_.size())
+  {
+    flush();
+  }
+}
+
+// public member functions
+template<class T, class A, class B>
+traced_indexing_tree<T,A,B>::traced_indexing_tree(const std::string& path, const A& alloc)
+  : tree_(alloc),file_(std::fopen(path.c_str(), "wb"))
+{
+  if (file_ == 0)
+  {
+    fail("open");
+  }
+  buffer_.reserve(block_size_ + 64);
+  buffer_.insert(buffer_.end(), indexing_tree_trace::magic(), indexing_tree_trace::magic() + 8);
+}
+
+// Errors while writing the last block cannot be reported here; call
+// flush() first to see them.
+template<class T, class A, class B>
+traced_indexing_tree<T,A,B>::~traced_indexing_tree()
+{
+  try
+  {
+    flush();
+  }
+  catch (...)
+  {
+  }
+  std::fclose(file_);
+}
+
+template<class T, class A, class B>
+inline const typename traced_indexing_tree<T,A,B>::tree_type& traced_indexing_tree<T,A,B>::tree() const
+{
+  return tree_;
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_iterator traced_indexing_tree<T,A,B>::begin() const
+{
+  return tree_.begin();
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_iterator traced_indexing_tree<T,A,B>::end() const
+{
+  return tree_.end();
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::size_type traced_indexing_tree<T,A,B>::size() const
+{
+  return tree_.size();
+}
+
+template<class T, class A, class B>
+inline bool traced_indexing_tree<T,A,B>::empty() const
+{
+  return tree_.empty();
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_reference traced_indexing_tree<T,A,B>::operator [] (size_type n) const
+{
+  trace(indexing_tree_trace::read_op, n, 1, tree_.size());
+  return tree_[n];
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_reference traced_indexing_tree<T,A,B>::at(size_type n) const
+{
+  const_reference x = tree_.at(n);
+  trace(indexing_tree_trace::read_op, n, 1, tree_.size());
+  return x;
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_reference traced_indexing_tree<T,A,B>::front() const
+{
+  size_type n = tree_.size();
+  if (n == 0)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  trace(indexing_tree_trace::read_op, 0, 1, n);
+  return tree_.front();
+}
+
+template<class T, class A, class B>
+inline typename traced_indexing_tree<T,A,B>::const_reference traced_indexing_tree<T,A,B>::back() const
+{
+  size_type n = tree_.size();
+  if (n == 0)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  trace(indexing_tree_trace::read_op, n - 1, 1, n);
+  return tree_.back();
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::push_back(const T& x)
+{
+  size_type n = tree_.size();
+  tree_.push_back(x);
+  trace(indexing_tree_trace::push_back_op, n, 1, n);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::pop_back()
+{
+  size_type n = tree_.size();
+  if (n == 0)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  tree_.pop_back();
+  trace(indexing_tree_trace::pop_back_op, n - 1, 1, n);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::push_front(const T& x)
+{
+  size_type n = tree_.size();
+  tree_.push_front(x);
+  trace(indexing_tree_trace::push_front_op, 0, 1, n);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::pop_front()
+{
+  size_type n = tree_.size();
+  if (n == 0)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  tree_.pop_front();
+  trace(indexing_tree_trace::pop_front_op, 0, 1, n);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::insert(size_type position, const T& x)
+{
+  size_type n = tree_.size();
+  if (n < position)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  tree_.insert(tree_.begin() + position, x);
+  trace(indexing_tree_trace::insert_op, position, 1, n);
+}
+
+template<class T, class A, class B>
+inline void traced_indexing_tree<T,A,B>::erase(size_type position)
+{
+  erase(position, 1);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::erase(size_type position, size_type n)
+{
+  size_type size = tree_.size();
+  if (size < n || size - n < position)
+  {
+    throw std::out_of_range("traced_indexing_tree::out_of_range");
+  }
+  typename tree_type::iterator first = tree_.begin() + position;
+  tree_.erase(first, first + n);
+  trace(indexing_tree_trace::erase_op, position, n, size);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::clear()
+{
+  size_type n = tree_.size();
+  tree_.clear();
+  trace(indexing_tree_trace::clear_op, 0, n, n);
+}
+
+template<class T, class A, class B>
+void traced_indexing_tree<T,A,B>::flush() const
+{
+  if (buffer_.empty())
+  {
+    return;
+  }
+  if (std::fwrite(&buffer_[0], 1, buffer_.size(), file_) != buffer_.size() || std::fflush(file_) != 0)
+  {
+    fail("write");
+  }
+  buffer_.clear();
+}
+
+} // end of namespace osoken
+
+#endif // TRACED_INDEXING_TREE_HPP_